@@ -53,8 +53,14 @@ SOURCES +=\
     brush.cpp \
     brushviewwidget.cpp \
     buffer.cpp \
+    bufferatlas.cpp \
+    streambuffer.cpp \
+    overlaybatcher.cpp \
+    bufferbatcher.cpp \
+    bufferpyramid.cpp \
     colourcomponentsplanewidget.cpp \
     colourplanewidget.cpp \
+    computecompositor.cpp \
     coloursliderswidget.cpp \
     dabeditorwidget.cpp \
     dockwidget.cpp \
@@ -62,11 +68,22 @@ SOURCES +=\
     documentmanager.cpp \
     documentsmodel.cpp \
     editingcontext.cpp \
+    framescheduler.cpp \
     mainwindow.cpp \
     multitoolbutton.cpp \
     node.cpp \
     opengl.cpp \
     program.cpp \
+    programcache.cpp \
+    programcompiler.cpp \
+    renderthread.cpp \
+    gpuworkerpool.cpp \
+    asynctask.cpp \
+    frameprofiler.cpp \
+    profilerwidget.cpp \
+    tracer.cpp \
+    globjectregistry.cpp \
+    globjectswidget.cpp \
     renderedwidget.cpp \
     rendermanager.cpp \
     scene.cpp \
@@ -104,8 +121,14 @@ HEADERS  += \
     brush.h \
     brushviewwidget.h \
     buffer.h \
+    bufferatlas.h \
+    streambuffer.h \
+    overlaybatcher.h \
+    bufferbatcher.h \
+    bufferpyramid.h \
     colourcomponentsplanewidget.h \
     colourplanewidget.h \
+    computecompositor.h \
     coloursliderswidget.h \
     dabeditorwidget.h \
     dockwidget.h \
@@ -113,11 +136,22 @@ HEADERS  += \
     documentmanager.h \
     documentsmodel.h \
     editingcontext.h \
+    framescheduler.h \
     mainwindow.h \
     multitoolbutton.h \
     node.h \
     opengl.h \
     program.h \
+    programcache.h \
+    programcompiler.h \
+    renderthread.h \
+    gpuworkerpool.h \
+    asynctask.h \
+    frameprofiler.h \
+    profilerwidget.h \
+    tracer.h \
+    globjectregistry.h \
+    globjectswidget.h \
     renderedwidget.h \
     rendermanager.h \
     scene.h \
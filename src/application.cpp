@@ -22,10 +22,12 @@
 #include <QProgressDialog>
 #include <QCommonStyle>
 #include <QFontDatabase>
+#include <QDebug>
 
 #include "mainwindow.h"
 #include "utils.h"
 #include "scene.h"
+#include "tracer.h"
 
 namespace GfxPaint {
 
@@ -49,10 +51,10 @@ const std::map<Buffer::Format, QImage::Format> Application::bufferToQImage = {
 const QString Application::sessionExtension = "session.gfx";
 
 const QList<Application::NodeInfo> Application::nodeInfo = {
-    {"Node", &Node::create, nullptr, nullptr},
-    {"Spatial", &SpatialNode::create, nullptr, nullptr},
-    {"Buffer", nullptr, &BufferNode::createFromFile, &BufferNode::createFromDialog},
-    {"Palette", &PaletteNode::create, &PaletteNode::createFromFile, nullptr},
+    {"Node", &Node::create, nullptr, nullptr, nullptr},
+    {"Spatial", &SpatialNode::create, nullptr, nullptr, nullptr},
+    {"Buffer", nullptr, &BufferNode::createFromFile, &BufferNode::createFromUpload, &BufferNode::createFromDialog},
+    {"Palette", &PaletteNode::create, &PaletteNode::createFromFile, &PaletteNode::createFromUpload, nullptr},
 };
 
 Application::Application(int &argc, char **argv)
@@ -341,6 +343,17 @@ void Application::readSettings(QSettings &settings)
     if (settings.contains("saveSessionAtExit")) m_saveSessionAtExit = settings.value("saveSessionAtExit").toBool();
     if (settings.contains("lastSession")) sessionManager.setSessionFilename(settings.value("lastSession").toString());
 
+    RenderManager::InteractiveResolution &interactiveResolution = renderManager.interactiveResolution;
+    settings.beginGroup("interactiveResolution");
+    if (settings.contains("mode")) interactiveResolution.mode = static_cast<RenderManager::InteractiveResolution::Mode>(settings.value("mode").toInt());
+    if (settings.contains("fixedScale")) interactiveResolution.fixedScale = settings.value("fixedScale").toFloat();
+    if (settings.contains("minScale")) interactiveResolution.minScale = settings.value("minScale").toFloat();
+    if (settings.contains("targetFrameTime")) interactiveResolution.targetFrameTime = settings.value("targetFrameTime").toFloat();
+    if (settings.contains("refineDelay")) interactiveResolution.refineDelay = settings.value("refineDelay").toInt();
+    settings.endGroup();
+    if (settings.contains("compositor")) renderManager.compositor = static_cast<RenderManager::Compositor>(settings.value("compositor").toInt());
+    if (settings.contains("tracing")) Tracer::setEnabled(settings.value("tracing").toBool());
+
     if (m_reopenSessionAtStartup && sessionManager.openSession(sessionManager.sessionFilename())) {}
     else sessionManager.newSession();
 }
@@ -371,6 +384,17 @@ void Application::writeSettings(QSettings &settings)
     settings.setValue("saveSessionAtExit", m_saveSessionAtExit);
     settings.setValue("lastSession", sessionManager.sessionFilename());
 
+    const RenderManager::InteractiveResolution &interactiveResolution = renderManager.interactiveResolution;
+    settings.beginGroup("interactiveResolution");
+    settings.setValue("mode", static_cast<int>(interactiveResolution.mode));
+    settings.setValue("fixedScale", interactiveResolution.fixedScale);
+    settings.setValue("minScale", interactiveResolution.minScale);
+    settings.setValue("targetFrameTime", interactiveResolution.targetFrameTime);
+    settings.setValue("refineDelay", interactiveResolution.refineDelay);
+    settings.endGroup();
+    settings.setValue("compositor", static_cast<int>(renderManager.compositor));
+    settings.setValue("tracing", Tracer::isEnabled());
+
     if (m_saveSessionAtExit) {
         sessionManager.saveSession(sessionManager.sessionFilename());
     }
@@ -388,12 +412,34 @@ int main(int argc, char *argv[])
 
     GfxPaint::Application app(argc, argv);
 
+    // Run instead of the editor, results are logged
+    const std::map<QString, std::function<void()>> benchmarks = {
+        {"traversal", [](){ GfxPaint::Scene::benchmarkTraversal(); }},
+        {"compositors", [](){ GfxPaint::Scene::benchmarkCompositors(); }},
+        {"sprites", [](){ GfxPaint::Scene::benchmarkSprites(); }},
+        {"programs", [](){ GfxPaint::RenderManager::benchmarkProgramGeneration(); }},
+    };
+    QStringList benchmarkNames;
+    for (const auto &[name, benchmark] : benchmarks) benchmarkNames.append(name);
+
     QCommandLineParser parser;
     parser.setApplicationDescription(app.applicationDisplayName() + " - Image Editor");
     parser.addHelpOption();
     parser.addVersionOption();
     parser.addPositionalArgument("files", "Files to open.", "[files...]");
+    const QCommandLineOption benchmarkOption("benchmark", "Run a benchmark and quit, one of: " + benchmarkNames.join(", ") + ".", "name");
+    parser.addOption(benchmarkOption);
     parser.process(app);
 
+    if (parser.isSet(benchmarkOption)) {
+        const auto benchmark = benchmarks.find(parser.value(benchmarkOption));
+        if (benchmark == benchmarks.end()) {
+            qWarning() << "Unknown benchmark:" << parser.value(benchmarkOption);
+            return 1;
+        }
+        benchmark->second();
+        return 0;
+    }
+
     return app.exec();
 }
@@ -97,6 +97,8 @@ public:
         QString label;
         Node *(*create)();
         Node *(*createFromFile)(const QString &filename);
+        // Render context part of createFromFile, for images decoded and uploaded elsewhere
+        Node *(*createFromUpload)(ImageUpload &upload, const Colour &transparent);
         Node *(*createFromDialog)(QWidget *const parentWindow);
     };
     static const QList<NodeInfo> nodeInfo;
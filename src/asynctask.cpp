@@ -0,0 +1,72 @@
+#include "asynctask.h"
+
+#include <QThreadPool>
+
+#include "application.h"
+
+namespace GfxPaint {
+
+AsyncTask::AsyncTask(const QString &name, QObject *const parent) :
+    QObject(parent),
+    name(name),
+    stages(), cancelled(false)
+{
+}
+
+AsyncTask::~AsyncTask()
+{
+}
+
+AsyncTask &AsyncTask::then(const Stage stage, const Function &function)
+{
+    stages.emplace_back(stage, function);
+    return *this;
+}
+
+void AsyncTask::start()
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+    runNext();
+}
+
+void AsyncTask::setProgress(const int value, const int maximum)
+{
+    emit progressChanged(value, maximum);
+}
+
+void AsyncTask::runNext()
+{
+    if (cancelled || stages.empty()) {
+        emit finished(cancelled);
+        deleteLater();
+        return;
+    }
+
+    const Stage stage = stages.front().first;
+    const Function function = stages.front().second;
+    stages.pop_front();
+    // Stages on other threads come back here to start the next one
+    const std::function<void()> run = [this, function](){
+        function(*this);
+        QMetaObject::invokeMethod(this, &AsyncTask::runNext, Qt::QueuedConnection);
+    };
+    switch (stage) {
+    case Stage::Cpu:
+        QThreadPool::globalInstance()->start(run);
+        break;
+    case Stage::Gpu:
+        if (qApp->renderManager.renderThread.isRunning()) {
+            qApp->renderManager.renderThread.enqueue<void>(run);
+        }
+        else {
+            ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+            run();
+        }
+        break;
+    case Stage::Main:
+        run();
+        break;
+    }
+}
+
+} // namespace GfxPaint
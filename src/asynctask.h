@@ -0,0 +1,56 @@
+#ifndef ASYNCTASK_H
+#define ASYNCTASK_H
+
+#include <QObject>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <utility>
+
+namespace GfxPaint {
+
+// A long document operation run as a chain of stages, each on the thread suited to it: CPU stages on the global
+// thread pool, GPU stages with the render context current and main stages on the main thread. Stages pass data on
+// through state they capture. The chain stops at the next stage boundary once cancelled, stages doing a lot of
+// work check isCancelled between chunks. The task deletes itself once finished.
+class AsyncTask : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Stage {
+        Cpu,
+        Gpu,
+        Main,
+    };
+    using Function = std::function<void(AsyncTask &task)>;
+
+    explicit AsyncTask(const QString &name, QObject *const parent = nullptr);
+    virtual ~AsyncTask() override;
+
+    const QString name;
+
+    AsyncTask &then(const Stage stage, const Function &function);
+    void start();
+
+    // Both thread safe
+    void cancel() { cancelled = true; }
+    bool isCancelled() const { return cancelled; }
+    void setProgress(const int value, const int maximum);
+
+signals:
+    // Emitted from the stage's thread
+    void progressChanged(const int value, const int maximum);
+    void finished(const bool cancelled);
+
+protected:
+    void runNext();
+
+    std::deque<std::pair<Stage, Function>> stages;
+    std::atomic<bool> cancelled;
+};
+
+} // namespace GfxPaint
+
+#endif // ASYNCTASK_H
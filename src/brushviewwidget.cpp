@@ -26,7 +26,7 @@ void BrushViewWidget::setBrush(const Brush &brush)
     oldPrograms.clear();
 
     this->brush = brush;
-    update();
+    requestFrame();
 }
 
 void BrushViewWidget::initializeGL()
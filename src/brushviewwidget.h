@@ -24,7 +24,7 @@ public slots:
     {
         if (this->colour != colour) {
             this->colour = colour;
-            update();
+            requestFrame();
         }
     }
 
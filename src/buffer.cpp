@@ -1,6 +1,11 @@
 #include "buffer.h"
 
+#include "bufferatlas.h"
+#include "frameprofiler.h"
+#include "tracer.h"
+#include <QOpenGLContext>
 #include <limits>
+#include <numeric>
 
 namespace GfxPaint {
 
@@ -98,16 +103,62 @@ const std::map<BufferData::Format, BufferData::Format::FormatInfo> BufferData::F
 BufferData::BufferData() :
     QSharedData(), OpenGL(false),
     size(0, 0), format(),
+    array(), arrayLayer(-1),
+    atlasPage(), atlasRect(),
     texture(0),
-    framebuffer(0)
+    framebuffer(0),
+    version(nextVersion()),
+    tileVersions()
 {
 }
 
 BufferData::BufferData(const QSize size, const Format format, const GLvoid *const data) :
     QSharedData(), OpenGL(true),
     size(size), format(format),
+    array(), arrayLayer(-1),
+    atlasPage(), atlasRect(),
     texture(createTexture(size, format, data)),
-    framebuffer(createFramebuffer(format, texture))
+    framebuffer(createFramebuffer(format, texture)),
+    version(nextVersion()),
+    tileVersions(tileCount().width() * tileCount().height(), version)
+{
+    Q_ASSERT(Format::formats.contains(format));
+}
+
+BufferData::BufferData(const std::shared_ptr<BufferArray> &array) :
+    QSharedData(), OpenGL(true),
+    size(array->size), format(array->format),
+    array(array), arrayLayer(array->takeLayer()),
+    atlasPage(), atlasRect(),
+    texture(this->array->createLayerView(arrayLayer)),
+    framebuffer(createFramebuffer(format, texture)),
+    version(nextVersion()),
+    tileVersions(tileCount().width() * tileCount().height(), version)
+{
+}
+
+BufferData::BufferData(const std::shared_ptr<BufferAtlasPage> &atlasPage, const QRect &atlasRect) :
+    QSharedData(), OpenGL(true),
+    size(atlasRect.size()), format(atlasPage->format),
+    array(), arrayLayer(-1),
+    atlasPage(atlasPage), atlasRect(atlasRect),
+    texture(atlasPage->texture),
+    framebuffer(createFramebuffer(format, texture)),
+    version(nextVersion()),
+    tileVersions(tileCount().width() * tileCount().height(), version)
+{
+    this->atlasPage->add(this);
+}
+
+BufferData::BufferData(const GLuint texture, const QSize size, const Format format) :
+    QSharedData(), OpenGL(true),
+    size(size), format(format),
+    array(), arrayLayer(-1),
+    atlasPage(), atlasRect(),
+    texture(texture),
+    framebuffer(createFramebuffer(format, texture)),
+    version(nextVersion()),
+    tileVersions(tileCount().width() * tileCount().height(), version)
 {
     Q_ASSERT(Format::formats.contains(format));
 }
@@ -115,8 +166,15 @@ BufferData::BufferData(const QSize size, const Format format, const GLvoid *cons
 BufferData::BufferData(const BufferData &other) :
     QSharedData(other), OpenGL(!other.isNull()),
     size(other.size), format(other.format),
-    texture(createTexture(size, format, nullptr)),
-    framebuffer(createFramebuffer(format, texture))
+    // Copies stay in the same array while it has free layers
+    array(other.array && !other.array->isFull() ? other.array : nullptr),
+    arrayLayer(array ? array->takeLayer() : -1),
+    // Copies of atlas buffers get their own texture
+    atlasPage(), atlasRect(),
+    texture(array ? array->createLayerView(arrayLayer) : createTexture(size, format, nullptr)),
+    framebuffer(createFramebuffer(format, texture)),
+    version(nextVersion()),
+    tileVersions(tileCount().width() * tileCount().height(), version)
 {
     Q_ASSERT(Format::formats.contains(format));
     copy(other);
@@ -125,9 +183,11 @@ BufferData::BufferData(const BufferData &other) :
 BufferData::~BufferData()
 {
     if (!isNull()) {
-        glDeleteFramebuffers(1, &framebuffer);
-        glDeleteTextures(1, &texture);        
+        OpenGLState::deleteFramebuffers(1, &framebuffer);
+        if (!atlasPage) OpenGLState::deleteTextures(1, &texture);
     }
+    if (array) array->returnLayer(arrayLayer);
+    if (atlasPage) atlasPage->remove(this);
 }
 
 bool BufferData::isNull() const
@@ -139,9 +199,14 @@ void BufferData::copy(const BufferData &other, const QRect &from, const QPoint &
 {
     Q_ASSERT(format == other.format);
 
-    glCopyImageSubData(other.texture, GL_TEXTURE_2D, 0, from.x(), from.y(), 0,
-                       texture, GL_TEXTURE_2D, 0, to.x(), to.y(), 0,
+    const QPoint src = from.topLeft() + other.origin();
+    const QPoint dest = to + origin();
+    glCopyImageSubData(other.texture, GL_TEXTURE_2D, 0, src.x(), src.y(), 0,
+                       texture, GL_TEXTURE_2D, 0, dest.x(), dest.y(), 0,
                        from.width(), from.height(), 1);
+    FrameProfiler::count(FrameProfiler::Counter::TextureCopies);
+    FrameProfiler::count(FrameProfiler::Counter::BytesMoved, static_cast<quint64>(from.width()) * from.height() * format.pixelSize());
+    touch(QRect(to, from.size()));
 }
 
 void BufferData::copy(const BufferData &other)
@@ -157,25 +222,48 @@ void BufferData::blit(const BufferData &other, const QRect &from, const QRect &t
 
     FramebufferBinder readBinder(GL_READ_FRAMEBUFFER, other.framebuffer);
     FramebufferBinder drawBinder(GL_DRAW_FRAMEBUFFER, framebuffer);
-    glBlitFramebuffer(from.x(), from.y(), from.width(), from.height(), to.x(), to.y(), to.width(), to.height(), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    const QRect src = from.translated(other.origin());
+    const QRect dest = to.translated(origin());
+    glBlitFramebuffer(src.x(), src.y(), src.width(), src.height(), dest.x(), dest.y(), dest.width(), dest.height(), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    FrameProfiler::count(FrameProfiler::Counter::TextureCopies);
+    FrameProfiler::count(FrameProfiler::Counter::BytesMoved, static_cast<quint64>(to.width()) * to.height() * format.pixelSize());
+    touch(to);
 }
 
 void BufferData::readPixel(const QPoint &pos, GLvoid *const pixel)
 {
     FramebufferBinder readBinder(GL_READ_FRAMEBUFFER, framebuffer);
     //glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glReadPixels(pos.x(), pos.y(), 1, 1, format.format(), format.type(), pixel);
+    const QPoint texturePos = pos + origin();
+    glReadPixels(texturePos.x(), texturePos.y(), 1, 1, format.format(), format.type(), pixel);
+    FrameProfiler::count(FrameProfiler::Counter::BytesMoved, format.pixelSize());
 }
 
 void BufferData::writePixel(const QPoint &pos, const GLvoid *const pixel)
 {
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, pos.x(), pos.y(), 1, 1, format.format(), format.type(), pixel);
+    OpenGLState::current().bindTexture(GL_TEXTURE_2D, texture);
+    const QPoint texturePos = pos + origin();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, texturePos.x(), texturePos.y(), 1, 1, format.format(), format.type(), pixel);
+    FrameProfiler::count(FrameProfiler::Counter::BytesMoved, format.pixelSize());
+    touch(QRect(pos, QSize(1, 1)));
+}
+
+void BufferData::touch(const QRect &rect)
+{
+    version = nextVersion();
+    const QRect touched = rect.intersected(this->rect());
+    if (touched.isEmpty()) return;
+    const int columns = tileCount().width();
+    for (int y = touched.top() / tileSize; y <= touched.bottom() / tileSize; ++y) {
+        for (int x = touched.left() / tileSize; x <= touched.right() / tileSize; ++x) {
+            tileVersions[y * columns + x] = version;
+        }
+    }
 }
 
 GLuint BufferData::createTexture(const QSize size, const Format format, const GLvoid *const data)
 {
-    qDebug() << "Creating texture:" << size;////////////////////////////////
+    const Tracer::Scope traceScope("BufferData::createTexture", "alloc", Tracer::isEnabled() ? QString("%1x%2").arg(size.width()).arg(size.height()) : QString());
     OpenGLFunctions gl;
     gl.initializeOpenGLFunctions();
 
@@ -187,6 +275,8 @@ GLuint BufferData::createTexture(const QSize size, const Format format, const GL
     gl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     gl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     gl.glTexImage2D(GL_TEXTURE_2D, 0, format.internalFormat(), size.width(), size.height(), 0, format.format(), format.type(), data);
+    GLObjectRegistry::add(GLObjectRegistry::Type::Texture, texture, static_cast<qint64>(size.width()) * size.height() * format.pixelSize());
+    if (data) FrameProfiler::count(FrameProfiler::Counter::BytesMoved, static_cast<quint64>(size.width()) * size.height() * format.pixelSize());
     return texture;
 }
 
@@ -197,6 +287,7 @@ GLuint BufferData::createFramebuffer(const Format format, const GLuint texture)
 
     GLuint framebuffer;
     gl.glGenFramebuffers(1, &framebuffer);
+    GLObjectRegistry::add(GLObjectRegistry::Type::Framebuffer, framebuffer);
     FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, framebuffer);
     gl.glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
     gl.glReadBuffer(GL_COLOR_ATTACHMENT0);
@@ -206,6 +297,93 @@ GLuint BufferData::createFramebuffer(const Format format, const GLuint texture)
     return framebuffer;
 }
 
+BufferArray::BufferArray(const QSize size, const Format format, const int capacity) :
+    OpenGL(true),
+    size(size), format(format), capacity(capacity),
+    texture(createTexture(size, format, capacity)),
+    freeLayers(capacity)
+{
+    Q_ASSERT(Format::formats.contains(format));
+    Q_ASSERT(capacity > 0 && capacity <= maxCapacity());
+
+    // Lowest layers are taken first
+    std::iota(freeLayers.rbegin(), freeLayers.rend(), 0);
+}
+
+BufferArray::~BufferArray()
+{
+    Q_ASSERT(static_cast<int>(freeLayers.size()) == capacity);
+    OpenGLState::deleteTextures(1, &texture);
+}
+
+bool BufferArray::isSupported()
+{
+    QOpenGLContext *const context = QOpenGLContext::currentContext();
+    return context && !context->isOpenGLES() && context->getProcAddress("glTextureView");
+}
+
+int BufferArray::maxCapacity()
+{
+    OpenGLFunctions gl;
+    gl.initializeOpenGLFunctions();
+
+    GLint maxLayers = 0;
+    gl.glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    return maxLayers;
+}
+
+int BufferArray::takeLayer()
+{
+    Q_ASSERT(!freeLayers.empty());
+    const int layer = freeLayers.back();
+    freeLayers.pop_back();
+    return layer;
+}
+
+void BufferArray::returnLayer(const int layer)
+{
+    Q_ASSERT(layer >= 0 && layer < capacity);
+    freeLayers.push_back(layer);
+}
+
+GLuint BufferArray::createTexture(const QSize size, const Format format, const int capacity)
+{
+    OpenGLFunctions gl;
+    gl.initializeOpenGLFunctions();
+
+    GLuint texture;
+    gl.glGenTextures(1, &texture);
+    TextureBinder textureBinder(GL_TEXTURE_2D_ARRAY, texture);
+    gl.glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl.glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Views need immutable storage
+    gl.glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, format.internalFormat(), size.width(), size.height(), capacity);
+    GLObjectRegistry::add(GLObjectRegistry::Type::Texture, texture, static_cast<qint64>(size.width()) * size.height() * capacity * format.pixelSize());
+    return texture;
+}
+
+GLuint BufferArray::createLayerView(const int layer)
+{
+    using TextureViewFunction = void (QOPENGLF_APIENTRYP)(GLuint, GLenum, GLuint, GLenum, GLuint, GLuint, GLuint, GLuint);
+    const TextureViewFunction textureView = reinterpret_cast<TextureViewFunction>(QOpenGLContext::currentContext()->getProcAddress("glTextureView"));
+    Q_ASSERT(textureView);
+
+    // View names must be fresh, never bound before the view is made
+    GLuint view;
+    glGenTextures(1, &view);
+    textureView(view, GL_TEXTURE_2D, texture, static_cast<GLenum>(format.internalFormat()), 0, 1, static_cast<GLuint>(layer), 1);
+    // Layers are counted with their array
+    GLObjectRegistry::add(GLObjectRegistry::Type::Texture, view);
+    TextureBinder textureBinder(GL_TEXTURE_2D, view);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return view;
+}
+
 Buffer::Buffer() :
     data(new BufferData())
 {
@@ -216,30 +394,62 @@ Buffer::Buffer(const QSize size, const Format format, const GLvoid *const data)
 {
 }
 
+Buffer::Buffer(const std::shared_ptr<BufferArray> &array) :
+    data(new BufferData(array))
+{
+}
+
+Buffer::Buffer(const std::shared_ptr<BufferAtlasPage> &atlasPage, const QRect &atlasRect) :
+    data(new BufferData(atlasPage, atlasRect))
+{
+}
+
+Buffer::Buffer(const GLuint texture, const QSize size, const Format format) :
+    data(new BufferData(texture, size, format))
+{
+}
+
 Buffer::Buffer(const Buffer &other) :
     data(other.data)
 {
 }
 
+void Buffer::unpack()
+{
+    if (!data->atlasPage) return;
+    Buffer unpacked(size(), format());
+    unpacked.copy(*this);
+    data = unpacked.data;
+}
+
 void Buffer::bindTextureUnit(const GLuint textureUnit) const
 {
-    BufferData *const data = const_cast<BufferData *>(this->data.constData());
-    data->glActiveTexture(GL_TEXTURE0 + textureUnit);
-    data->glBindTexture(GL_TEXTURE_2D, data->texture);
+    OpenGLState::current().bindTextureUnit(textureUnit, GL_TEXTURE_2D, data->texture);
 }
 
 void Buffer::bindImageUnit(const GLuint imageUnit) const
 {
     BufferData *const data = const_cast<BufferData *>(this->data.constData());
     data->glBindImageTexture(imageUnit, data->texture, 0, GL_FALSE, 0, GL_READ_WRITE, static_cast<GLenum>(data->format.internalFormat()));
+    data->touch();
+}
+
+void Buffer::bindFramebuffer(const QRect &viewport, const QRect &scissor, const GLenum target)
+{
+    // Atlas neighbours lie outside the buffer rect
+    const QRect textureViewport = viewport.translated(data->origin());
+    const QRect textureScissor = (data->atlasPage ? scissor.intersected(rect()) : scissor).translated(data->origin());
+    OpenGLState &state = OpenGLState::current();
+    state.bindFramebuffer(target, data->framebuffer);
+    state.setViewport(textureViewport);
+    state.setScissorTest(true);
+    state.setScissor(textureScissor);
+    data->touch(scissor);
 }
 
 void Buffer::bindFramebuffer(const QRect &rect, const GLenum target)
 {
-    data->glBindFramebuffer(target, data->framebuffer);
-    data->glViewport(rect.x(), rect.y(), rect.width(), rect.height());
-    data->glEnable(GL_SCISSOR_TEST);
-    data->glScissor(rect.x(), rect.y(), rect.width(), rect.height());
+    bindFramebuffer(rect, rect, target);
 }
 
 void Buffer::bindFramebuffer(const GLenum target)
@@ -264,23 +474,26 @@ void Buffer::clear()
 
 void Buffer::clearUInt(const GLuint r, const GLuint g, const GLuint b, const GLuint a)
 {
-    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, data->framebuffer, rect());
+    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, data->framebuffer, data->textureRect());
     const GLuint values[] = {r, g, b, a};
     data->glClearBufferuiv(GL_COLOR, 0, values);
+    data->touch();
 }
 
 void Buffer::clearSInt(const GLint r, const GLint g, const GLint b, const GLint a)
 {
-    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, data->framebuffer, rect());
+    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, data->framebuffer, data->textureRect());
     const GLint values[] = {r, g, b, a};
     data->glClearBufferiv(GL_COLOR, 0, values);
+    data->touch();
 }
 
 void Buffer::clearFloat(const GLfloat r, const GLfloat g, const GLfloat b, const GLfloat a)
 {
-    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, data->framebuffer, rect());
+    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, data->framebuffer, data->textureRect());
     const GLfloat values[] = {r, g, b, a};
     data->glClearBufferfv(GL_COLOR, 0, values);
+    data->touch();
 }
 
 } // namespace GfxPaint
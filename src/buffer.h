@@ -5,14 +5,20 @@
 #include <QSharedData>
 #include <QSharedDataPointer>
 #include <QDebug>
+#include <memory>
+#include <vector>
 //#include <frozen/map.h>
 //#include <frozen/unordered_map.h>
 //#include <frozen/string.h>
 
 #include "opengl.h"
+#include "types.h"
 
 namespace GfxPaint {
 
+class BufferArray;
+class BufferAtlasPage;
+
 class BufferData : public QSharedData, public OpenGL {
 public:
     class Format {
@@ -62,6 +68,7 @@ public:
         bool isValid() const {
             return componentType != ComponentType::Invalid;
         }
+        int pixelSize() const { return componentSize * componentCount; }
 
         ComponentInfo componentInfo() const {
             Q_ASSERT(components.contains(this->componentType));
@@ -92,11 +99,27 @@ public:
 
     const QSize size;
     const Format format;
+    // Texture array this buffer is a layer of, texture is then a view of that layer
+    const std::shared_ptr<BufferArray> array;
+    const int arrayLayer;
+    // Atlas page holding this buffer at atlasRect, texture is then the page texture. Defragmenting the page moves atlasRect,
+    // the page texture stays the same
+    std::shared_ptr<BufferAtlasPage> atlasPage;
+    QRect atlasRect;
     const GLuint texture;
     const GLuint framebuffer;
+    quint64 version;
+    // Version of the last write to each tile, row major
+    std::vector<quint64> tileVersions;
+
+    static constexpr int tileSize = 256;
 
     BufferData();
     BufferData(const QSize size, const Format format, const GLvoid *const data = nullptr);
+    explicit BufferData(const std::shared_ptr<BufferArray> &array);
+    explicit BufferData(const std::shared_ptr<BufferAtlasPage> &atlasPage, const QRect &atlasRect);
+    // Takes ownership of a texture made elsewhere, e.g. uploaded by a GPU worker
+    explicit BufferData(const GLuint texture, const QSize size, const Format format);
     explicit BufferData(const BufferData &other);
     ~BufferData();
     inline bool operator==(const BufferData &rhs) const {
@@ -112,6 +135,11 @@ public:
     int width() const { return size.width(); }
     int height() const { return size.height(); }
     QRect rect() const { return QRect(QPoint(0, 0), size); }
+    // Position and rect of the buffer in its texture
+    QPoint origin() const { return atlasPage ? atlasRect.topLeft() : QPoint(0, 0); }
+    QRect textureRect() const { return rect().translated(origin()); }
+    QSize tileCount() const { return QSize((size.width() + tileSize - 1) / tileSize, (size.height() + tileSize - 1) / tileSize); }
+    quint64 tileVersion(const int x, const int y) const { return tileVersions[y * tileCount().width() + x]; }
 
     void copy(const BufferData &other, const QRect &from, const QPoint &to);
     void copy(const BufferData &other);
@@ -120,11 +148,46 @@ public:
     void readPixel(const QPoint &pos, GLvoid *const pixel);
     void writePixel(const QPoint &pos, const GLvoid *const pixel);
 
-protected:
+    void touch() { touch(rect()); }
+    void touch(const QRect &rect);
+
+    // Usable from any context sharing with the render context
     static GLuint createTexture(const QSize size, const Format format, const GLvoid *const data);
+
+protected:
     static GLuint createFramebuffer(const Format format, const GLuint texture);
 };
 
+// Same size and format buffers stored as layers of one immutable GL_TEXTURE_2D_ARRAY
+// Each layer is given to its buffer as a GL_TEXTURE_2D view, so only compositing needs to know about arrays
+class BufferArray : protected OpenGL {
+public:
+    using Format = BufferData::Format;
+
+    explicit BufferArray(const QSize size, const Format format, const int capacity);
+    BufferArray(const BufferArray &other) = delete;
+    ~BufferArray();
+
+    // Texture views need desktop OpenGL 4.3
+    static bool isSupported();
+    static int maxCapacity();
+
+    const QSize size;
+    const Format format;
+    const int capacity;
+    const GLuint texture;
+
+    bool isFull() const { return freeLayers.empty(); }
+    int takeLayer();
+    void returnLayer(const int layer);
+    GLuint createLayerView(const int layer);
+
+protected:
+    static GLuint createTexture(const QSize size, const Format format, const int capacity);
+
+    std::vector<int> freeLayers;
+};
+
 inline QDebug operator<<(QDebug debug, const BufferData::Format &format)
 {
     QDebugStateSaver saver(debug);
@@ -140,6 +203,9 @@ public:
 
     explicit Buffer();
     explicit Buffer(const QSize size, const Format format, const GLvoid *const data = nullptr);
+    explicit Buffer(const std::shared_ptr<BufferArray> &array);
+    explicit Buffer(const std::shared_ptr<BufferAtlasPage> &atlasPage, const QRect &atlasRect);
+    explicit Buffer(const GLuint texture, const QSize size, const Format format);
     Buffer(const Buffer &other);
     inline Buffer &operator=(const Buffer &rhs) { data = rhs.data; return *this; }
     inline bool operator==(const Buffer &rhs) const { return data == rhs.data; }
@@ -154,6 +220,18 @@ public:
     const Format &format() const { return data->format; }
     GLuint texture() const { return data->texture; }
     GLuint framebuffer() { return data->framebuffer; }
+    const BufferArray *array() const { return data->array.get(); }
+    // For making more layers in the same array
+    std::shared_ptr<BufferArray> sharedArray() const { return data->array; }
+    int arrayLayer() const { return data->arrayLayer; }
+    const BufferAtlasPage *atlasPage() const { return data->atlasPage.get(); }
+    QPoint origin() const { return data->origin(); }
+    // Moves an atlas buffer to its own texture, needed before it's rendered to with attachments of its own size
+    void unpack();
+    void detach() { data.detach(); }
+    quint64 version() const { return data->version; }
+    QSize tileCount() const { return data->tileCount(); }
+    quint64 tileVersion(const int x, const int y) const { return data->tileVersion(x, y); }
 
     void copy(const Buffer &other, const QRect &from, const QPoint &to) { data->copy(*other.data, from, to); }
     void copy(const Buffer &other) { data->copy(*other.data); }
@@ -164,6 +242,7 @@ public:
 
     void bindTextureUnit(const GLuint textureUnit) const;
     void bindImageUnit(const GLuint imageUnit) const;
+    void bindFramebuffer(const QRect &viewport, const QRect &scissor, const GLenum target = GL_FRAMEBUFFER);
     void bindFramebuffer(const QRect &rect, const GLenum target = GL_FRAMEBUFFER);
     void bindFramebuffer(const GLenum target = GL_FRAMEBUFFER);
 
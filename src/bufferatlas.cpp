@@ -0,0 +1,249 @@
+#include "bufferatlas.h"
+
+#include <algorithm>
+
+namespace GfxPaint {
+
+BufferAtlasPage::BufferAtlasPage(const QSize size, const Format format) :
+    OpenGL(true),
+    size(size), format(format),
+    texture(createTexture(size, format)),
+    skyline{{0, 0, size.width()}},
+    residents()
+{
+}
+
+BufferAtlasPage::~BufferAtlasPage()
+{
+    Q_ASSERT(residents.empty());
+    OpenGLState::deleteTextures(1, &texture);
+}
+
+QRect BufferAtlasPage::allocate(const QSize &size)
+{
+    if (size.isEmpty() || size.width() > this->size.width() || size.height() > this->size.height()) return QRect();
+
+    int segmentIndex;
+    const QRect rect = findPosition(size, segmentIndex);
+    if (!rect.isNull()) addSegment(segmentIndex, rect);
+    return rect;
+}
+
+void BufferAtlasPage::add(BufferData *const data)
+{
+    Q_ASSERT(std::find(residents.begin(), residents.end(), data) == residents.end());
+    residents.push_back(data);
+}
+
+void BufferAtlasPage::remove(BufferData *const data)
+{
+    const auto found = std::find(residents.begin(), residents.end(), data);
+    Q_ASSERT(found != residents.end());
+    residents.erase(found);
+}
+
+qint64 BufferAtlasPage::usedArea() const
+{
+    qint64 area = 0;
+    for (const BufferData *const data : residents) {
+        area += static_cast<qint64>(data->atlasRect.width()) * data->atlasRect.height();
+    }
+    return area;
+}
+
+qint64 BufferAtlasPage::allocatedArea() const
+{
+    qint64 area = 0;
+    for (const Segment &segment : skyline) {
+        area += static_cast<qint64>(segment.width) * segment.y;
+    }
+    return area;
+}
+
+bool BufferAtlasPage::defragment()
+{
+    std::vector<BufferData *> sorted = residents;
+    std::sort(sorted.begin(), sorted.end(), [](const BufferData *const a, const BufferData *const b){
+        return std::make_pair(a->size.height(), a->size.width()) > std::make_pair(b->size.height(), b->size.width());
+    });
+
+    const std::vector<Segment> oldSkyline = skyline;
+    skyline = {{0, 0, size.width()}};
+    std::vector<QRect> rects;
+    rects.reserve(sorted.size());
+    for (const BufferData *const data : sorted) {
+        const QRect rect = allocate(data->size);
+        if (rect.isNull()) {
+            skyline = oldSkyline;
+            return false;
+        }
+        rects.push_back(rect);
+    }
+
+    // New rects can overlap old ones, so move everything through a scratch texture
+    const GLuint scratch = createTexture(size, format);
+    int top = 0;
+    for (std::size_t i = 0; i < sorted.size(); ++i) {
+        const QRect &from = sorted[i]->atlasRect;
+        const QRect &to = rects[i];
+        glCopyImageSubData(texture, GL_TEXTURE_2D, 0, from.x(), from.y(), 0,
+                           scratch, GL_TEXTURE_2D, 0, to.x(), to.y(), 0,
+                           to.width(), to.height(), 1);
+        top = std::max(top, to.bottom() + 1);
+    }
+    if (top > 0) {
+        glCopyImageSubData(scratch, GL_TEXTURE_2D, 0, 0, 0, 0,
+                           texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+                           size.width(), top, 1);
+    }
+    OpenGLState::deleteTextures(1, &scratch);
+
+    for (std::size_t i = 0; i < sorted.size(); ++i) {
+        sorted[i]->atlasRect = rects[i];
+    }
+    return true;
+}
+
+GLuint BufferAtlasPage::createTexture(const QSize size, const Format format)
+{
+    OpenGLFunctions gl;
+    gl.initializeOpenGLFunctions();
+
+    GLuint texture;
+    gl.glGenTextures(1, &texture);
+    TextureBinder textureBinder(GL_TEXTURE_2D, texture);
+    gl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl.glTexStorage2D(GL_TEXTURE_2D, 1, format.internalFormat(), size.width(), size.height());
+    GLObjectRegistry::add(GLObjectRegistry::Type::Texture, texture, static_cast<qint64>(size.width()) * size.height() * format.pixelSize());
+    return texture;
+}
+
+QRect BufferAtlasPage::findPosition(const QSize &size, int &segmentIndex) const
+{
+    // Lowest resulting top edge, then the narrowest segment to leave wide gaps for later buffers
+    QRect best;
+    int bestWidth = 0;
+    segmentIndex = -1;
+    for (int i = 0; i < static_cast<int>(skyline.size()); ++i) {
+        const int x = skyline[i].x;
+        if (x + size.width() > this->size.width()) break;
+        int y = 0;
+        for (int j = i, remaining = size.width(); remaining > 0; ++j) {
+            y = std::max(y, skyline[j].y);
+            remaining -= skyline[j].width;
+        }
+        if (y + size.height() > this->size.height()) continue;
+        if (best.isNull() || y < best.y() || (y == best.y() && skyline[i].width < bestWidth)) {
+            best = QRect(QPoint(x, y), size);
+            bestWidth = skyline[i].width;
+            segmentIndex = i;
+        }
+    }
+    return best;
+}
+
+void BufferAtlasPage::addSegment(const int segmentIndex, const QRect &rect)
+{
+    skyline.insert(skyline.begin() + segmentIndex, {rect.x(), rect.y() + rect.height(), rect.width()});
+
+    // Trim segments now covered by the new one
+    const int right = rect.x() + rect.width();
+    for (std::size_t i = segmentIndex + 1; i < skyline.size(); ) {
+        Segment &segment = skyline[i];
+        if (segment.x >= right) break;
+        const int covered = right - segment.x;
+        if (segment.width <= covered) {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+        segment.x += covered;
+        segment.width -= covered;
+        break;
+    }
+
+    // Merge neighbours at the same height
+    for (std::size_t i = 0; i + 1 < skyline.size(); ) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else ++i;
+    }
+}
+
+BufferAtlas::BufferAtlas() :
+    pages()
+{
+}
+
+BufferAtlas::~BufferAtlas()
+{
+    Q_ASSERT(pages.empty());
+}
+
+bool BufferAtlas::accepts(const Buffer &buffer)
+{
+    return !buffer.isNull() && !buffer.array() && !buffer.atlasPage() &&
+        buffer.width() <= maxBufferSize && buffer.height() <= maxBufferSize;
+}
+
+bool BufferAtlas::pack(Buffer &buffer)
+{
+    if (!accepts(buffer)) return false;
+
+    // Pages only referenced here have no buffers left
+    pages.erase(std::remove_if(pages.begin(), pages.end(), [](const std::shared_ptr<BufferAtlasPage> &page){
+        return page.use_count() == 1;
+    }), pages.end());
+
+    std::shared_ptr<BufferAtlasPage> page;
+    QRect rect;
+    for (const auto &candidate : pages) {
+        if (candidate->format != buffer.format()) continue;
+        rect = candidate->allocate(buffer.size());
+        if (!rect.isNull()) {
+            page = candidate;
+            break;
+        }
+    }
+    // Reclaim freed space before adding a page
+    if (!page) {
+        for (const auto &candidate : pages) {
+            if (candidate->format != buffer.format() || candidate->usedArea() >= minOccupancy * candidate->allocatedArea()) continue;
+            if (!candidate->defragment()) continue;
+            rect = candidate->allocate(buffer.size());
+            if (!rect.isNull()) {
+                page = candidate;
+                break;
+            }
+        }
+    }
+    if (!page) {
+        page = std::make_shared<BufferAtlasPage>(QSize(pageSize, pageSize), buffer.format());
+        pages.push_back(page);
+        rect = page->allocate(buffer.size());
+        Q_ASSERT(!rect.isNull());
+    }
+
+    Buffer packed(page, rect);
+    packed.copy(buffer);
+    buffer = packed;
+    return true;
+}
+
+void BufferAtlas::defragment()
+{
+    for (const auto &page : pages) {
+        if (page->usedArea() < minOccupancy * page->allocatedArea()) page->defragment();
+    }
+}
+
+void BufferAtlas::release()
+{
+    pages.clear();
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,80 @@
+#ifndef BUFFERATLAS_H
+#define BUFFERATLAS_H
+
+#include <memory>
+#include <vector>
+
+#include "opengl.h"
+#include "buffer.h"
+
+namespace GfxPaint {
+
+// One texture holding many small buffers of the same format, placed with a skyline packer
+// Space freed by removed buffers is only reclaimed by defragment
+class BufferAtlasPage : protected OpenGL
+{
+public:
+    using Format = BufferData::Format;
+
+    explicit BufferAtlasPage(const QSize size, const Format format);
+    BufferAtlasPage(const BufferAtlasPage &other) = delete;
+    ~BufferAtlasPage();
+
+    const QSize size;
+    const Format format;
+    const GLuint texture;
+
+    // Returns a null rect if there is no room left
+    QRect allocate(const QSize &size);
+    void add(BufferData *const data);
+    void remove(BufferData *const data);
+
+    bool isEmpty() const { return residents.empty(); }
+    qint64 usedArea() const;
+    qint64 allocatedArea() const;
+
+    // Repacks residents from the bottom left, tallest first, returns false if they no longer fit
+    bool defragment();
+
+protected:
+    struct Segment {
+        int x;
+        int y;
+        int width;
+    };
+
+    static GLuint createTexture(const QSize size, const Format format);
+    QRect findPosition(const QSize &size, int &segmentIndex) const;
+    void addSegment(const int segmentIndex, const QRect &rect);
+
+    std::vector<Segment> skyline;
+    std::vector<BufferData *> residents;
+};
+
+// Pages per format for small buffers, so scenes of many sprites need few textures and
+// nodes on the same page can be drawn together
+class BufferAtlas
+{
+public:
+    static constexpr int pageSize = 2048;
+    static constexpr int maxBufferSize = 64;
+    // Pages with less of their allocated area in use than this are repacked before a new page is made
+    static constexpr float minOccupancy = 0.5f;
+
+    explicit BufferAtlas();
+    ~BufferAtlas();
+
+    static bool accepts(const Buffer &buffer);
+
+    // Moves the buffer contents to a page, the buffer then references its page rect
+    bool pack(Buffer &buffer);
+    void defragment();
+    void release();
+
+protected:
+    std::vector<std::shared_ptr<BufferAtlasPage>> pages;
+};
+
+} // namespace GfxPaint
+
+#endif // BUFFERATLAS_H
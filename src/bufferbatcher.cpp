@@ -0,0 +1,119 @@
+#include "bufferbatcher.h"
+
+#include <cmath>
+#include <limits>
+
+#include "application.h"
+
+namespace GfxPaint {
+
+BufferBatcher::BufferBatcher() :
+    batch(), src(nullptr),
+    instances(), instanceBounds(),
+    programs()
+{
+    instances.reserve(maxInstances);
+    instanceBounds.reserve(maxInstances);
+}
+
+BufferBatcher::~BufferBatcher()
+{
+    Q_ASSERT(programs.empty());
+}
+
+bool BufferBatcher::isSupported()
+{
+    static const bool supported = [](){
+        OpenGLFunctions gl;
+        gl.initializeOpenGLFunctions();
+        GLint maxBlocks = 0;
+        gl.glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &maxBlocks);
+        return maxBlocks > 0;
+    }();
+    return supported;
+}
+
+bool BufferBatcher::accepts(const Buffer &buffer, const int pyramidLevel)
+{
+    return !buffer.isNull() && pyramidLevel == 0;
+}
+
+void BufferBatcher::add(const Batch &batch, const Buffer *const buffer, const Mat4 &worldToClip)
+{
+    const QRect bounds = destBounds(*buffer, worldToClip, batch.dest->size());
+    if (!instances.empty()) {
+        bool overlaps = batch != this->batch || static_cast<int>(instances.size()) == maxInstances;
+        for (std::size_t i = 0; i < instanceBounds.size() && !overlaps; ++i) {
+            overlaps = instanceBounds[i].intersects(bounds);
+        }
+        if (overlaps) flush();
+    }
+    this->batch = batch;
+    src = buffer;
+
+    BufferProgram::InstanceData instance{};
+    memcpy(instance.worldToClip, worldToClip.constData(), sizeof(instance.worldToClip));
+    instance.origin[0] = buffer->origin().x();
+    instance.origin[1] = buffer->origin().y();
+    instance.size[0] = buffer->width();
+    instance.size[1] = buffer->height();
+    instances.push_back(instance);
+    instanceBounds.push_back(bounds);
+}
+
+void BufferBatcher::flush()
+{
+    if (instances.empty()) return;
+
+    const Buffer::Format paletteFormat = batch.palette ? batch.palette->format() : Buffer::Format();
+    const Buffer::Format destPaletteFormat = batch.destPalette ? batch.destPalette->format() : Buffer::Format();
+    const ProgramKey key = {batch.format, batch.indexed, paletteFormat, batch.dest->format(), batch.destIndexed, destPaletteFormat, batch.blendMode, batch.composeMode};
+    auto found = programs.find(key);
+    if (found == programs.end()) {
+        found = programs.insert({key, new BufferProgram(batch.format, batch.indexed, paletteFormat, batch.dest->format(), batch.destIndexed, destPaletteFormat, batch.blendMode, batch.composeMode, false, true)}).first;
+    }
+
+    // Same pooled, scissored dest copy as drawing nodes one by one, made once per batch
+    const QRect scissor = !batch.scissor.isNull() ? batch.scissor.intersected(batch.dest->rect()) : batch.dest->rect();
+    Buffer *const destCopy = qApp->workBufferManager.takeBuffer(batch.dest->format(), batch.dest->size());
+    destCopy->copy(*batch.dest, scissor, scissor.topLeft());
+    batch.dest->bindFramebuffer(batch.dest->rect(), scissor);
+    if (found->second->isReady()) found->second->renderInstances(instances, src, batch.palette, batch.transparent, destCopy, batch.destPalette, Colour{});
+    // Uber program until the specialised program is compiled in the background
+    else qApp->renderManager.bufferUberProgram(batch.format, paletteFormat, batch.dest->format(), destPaletteFormat, false, true)
+        ->renderInstances(instances, src, batch.indexed, batch.palette, batch.transparent, destCopy, batch.destIndexed, batch.destPalette, Colour{}, batch.blendMode, batch.composeMode);
+    qApp->workBufferManager.returnBuffer(destCopy);
+
+    instances.clear();
+    instanceBounds.clear();
+    src = nullptr;
+    batch = Batch();
+}
+
+void BufferBatcher::release()
+{
+    instances.clear();
+    instanceBounds.clear();
+    src = nullptr;
+    batch = Batch();
+    for (auto &[key, program] : programs) {
+        delete program;
+    }
+    programs.clear();
+}
+
+QRect BufferBatcher::destBounds(const Buffer &buffer, const Mat4 &worldToClip, const QSize &destSize)
+{
+    const Mat4 bufferToViewport = viewportToClipTransform(destSize).inverted() * worldToClip;
+    Vec2 boundsMin(std::numeric_limits<float>::infinity());
+    Vec2 boundsMax(-std::numeric_limits<float>::infinity());
+    for (const Vec2 &corner : {Vec2(0.0f, 0.0f), Vec2(buffer.width(), 0.0f), Vec2(0.0f, buffer.height()), Vec2(buffer.width(), buffer.height())}) {
+        const Vec2 point = bufferToViewport.map(corner);
+        boundsMin = GfxPaint::min(boundsMin, point);
+        boundsMax = GfxPaint::max(boundsMax, point);
+    }
+    // Whole pixels the quad touches, so edge to edge neighbours don't overlap
+    return QRect(QPoint(std::floor(boundsMin.x()), std::floor(boundsMin.y())), QPoint(std::ceil(boundsMax.x()) - 1, std::ceil(boundsMax.y()) - 1));
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,65 @@
+#ifndef BUFFERBATCHER_H
+#define BUFFERBATCHER_H
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "buffer.h"
+#include "program.h"
+#include "types.h"
+
+namespace GfxPaint {
+
+// Queues consecutive buffer nodes that sample one texture, either one shared buffer or one atlas page, with the
+// same palette, modes and render target, and draws them with one instanced BufferProgram draw. Blending reads
+// dest as it was before the draw, so a node overlapping an earlier node of the batch starts a new batch.
+class BufferBatcher
+{
+public:
+    static constexpr int maxInstances = 256;
+
+    // Everything that has to match for nodes to be drawn together
+    struct Batch {
+        GLuint texture = 0;
+        Buffer::Format format = Buffer::Format();
+        bool indexed = false;
+        const Buffer *palette = nullptr;
+        Colour transparent = Colour();
+        int blendMode = 0;
+        int composeMode = 0;
+        Buffer *dest = nullptr;
+        bool destIndexed = false;
+        const Buffer *destPalette = nullptr;
+        QRect scissor = QRect();
+
+        inline bool operator==(const Batch &rhs) const = default;
+    };
+
+    explicit BufferBatcher();
+    ~BufferBatcher();
+
+    // Instance data is read in the vertex stage, which may have no storage blocks on OpenGL ES
+    static bool isSupported();
+    // Zoomed out nodes drawn from their pyramid are drawn one by one
+    static bool accepts(const Buffer &buffer, const int pyramidLevel);
+
+    void add(const Batch &batch, const Buffer *const buffer, const Mat4 &worldToClip);
+    void flush();
+    void release();
+
+protected:
+    using ProgramKey = std::tuple<Buffer::Format, bool, Buffer::Format, Buffer::Format, bool, Buffer::Format, int, int>;
+
+    static QRect destBounds(const Buffer &buffer, const Mat4 &worldToClip, const QSize &destSize);
+
+    Batch batch;
+    const Buffer *src;
+    std::vector<BufferProgram::InstanceData> instances;
+    std::vector<QRect> instanceBounds;
+    std::map<ProgramKey, BufferProgram *> programs;
+};
+
+} // namespace GfxPaint
+
+#endif // BUFFERBATCHER_H
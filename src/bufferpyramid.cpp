@@ -0,0 +1,151 @@
+#include "bufferpyramid.h"
+
+#include <QRegion>
+#include <cmath>
+
+#include "application.h"
+#include "program.h"
+
+namespace GfxPaint {
+
+const Buffer::Format BufferPyramid::format = Buffer::Format(BufferData::Format::ComponentType::Float, 2, 4);
+
+BufferPyramid::BufferPyramid() :
+    OpenGL(false),
+    texture(0), framebuffer(0),
+    size(), srcFormat(),
+    levelVersions(),
+    bufferProgram(nullptr), levelProgram(nullptr)
+{
+}
+
+BufferPyramid::~BufferPyramid()
+{
+    Q_ASSERT(!texture);
+}
+
+float BufferPyramid::transformScale(const Mat4 &worldToClip, const QSize &viewportSize)
+{
+    // Pixels per texel from the area scale of the transform in viewport pixels
+    const float a = worldToClip(0, 0) * viewportSize.width() / 2.0f;
+    const float b = worldToClip(0, 1) * viewportSize.width() / 2.0f;
+    const float c = worldToClip(1, 0) * viewportSize.height() / 2.0f;
+    const float d = worldToClip(1, 1) * viewportSize.height() / 2.0f;
+    return std::sqrt(std::fabs(a * d - b * c));
+}
+
+int BufferPyramid::level(const float scale, const QSize &size)
+{
+    // Nearest texels at 100% and above so pixel art stays crisp
+    if (scale >= 1.0f || scale <= 0.0f) return 0;
+    return std::min(static_cast<int>(std::floor(std::log2(1.0f / scale))), levelCount(size));
+}
+
+int BufferPyramid::levelCount(const QSize &size)
+{
+    // Level sizes are rounded down, matching texture mip levels
+    int count = 0;
+    for (int extent = std::max(size.width(), size.height()) >> 1; extent > 0; extent >>= 1) {
+        ++count;
+    }
+    return count;
+}
+
+GLuint BufferPyramid::update(const Buffer &buffer, const int level)
+{
+    if (level <= 0) return 0;
+
+    if (!texture || size != buffer.size() || srcFormat != buffer.format()) allocate(buffer.size(), buffer.format());
+    if (!texture) return 0;
+
+    FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, framebuffer);
+    OpenGLState &state = OpenGLState::current();
+    state.setScissorTest(true);
+
+    const QSize tileCount = buffer.tileCount();
+    for (int n = 1; n <= std::min(level, static_cast<int>(levelVersions.size())); ++n) {
+        quint64 &levelVersion = levelVersions[n - 1];
+        if (levelVersion == buffer.version()) continue;
+
+        // Tiles written since this level was last generated, in level texels
+        QRegion dirty;
+        for (int y = 0; y < tileCount.height(); ++y) {
+            for (int x = 0; x < tileCount.width(); ++x) {
+                if (buffer.tileVersion(x, y) <= levelVersion) continue;
+                const QRect tile(x * BufferData::tileSize, y * BufferData::tileSize, BufferData::tileSize, BufferData::tileSize);
+                dirty += QRect(QPoint(tile.left() >> n, tile.top() >> n), QPoint((tile.right() >> n), (tile.bottom() >> n)));
+            }
+        }
+
+        const int storedLevel = n - 1;
+        const QSize levelSize(std::max(1, (size.width() >> n)), std::max(1, (size.height() >> n)));
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, storedLevel);
+        state.setViewport(QRect(QPoint(0, 0), levelSize));
+
+        // Limit sampling to the source level so the attached level isn't part of a feedback loop
+        state.bindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, std::max(0, storedLevel - 1));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(0, storedLevel - 1));
+
+        BufferPyramidProgram *const program = (n == 1 ? bufferProgram : levelProgram);
+        for (const QRect &rect : dirty) {
+            state.setScissor(rect);
+            if (n == 1) program->render(buffer.texture(), 0, buffer.size());
+            else program->render(texture, storedLevel - 1, QSize(std::max(1, size.width() >> (n - 1)), std::max(1, size.height() >> (n - 1))));
+        }
+
+        levelVersion = buffer.version();
+    }
+
+    state.bindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levelVersions.size()) - 1);
+
+    return texture;
+}
+
+void BufferPyramid::release()
+{
+    if (texture) {
+        OpenGLState::deleteFramebuffers(1, &framebuffer);
+        OpenGLState::deleteTextures(1, &texture);
+        texture = 0;
+        framebuffer = 0;
+    }
+    delete bufferProgram;
+    bufferProgram = nullptr;
+    delete levelProgram;
+    levelProgram = nullptr;
+    levelVersions.clear();
+}
+
+void BufferPyramid::allocate(const QSize &size, const Buffer::Format &srcFormat)
+{
+    initialize();
+    release();
+    this->size = size;
+    this->srcFormat = srcFormat;
+    levelVersions.assign(levelCount(size), 0);
+    if (levelVersions.empty()) return;
+
+    glGenTextures(1, &texture);
+    TextureBinder textureBinder(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexStorage2D(GL_TEXTURE_2D, static_cast<GLsizei>(levelVersions.size()), format.internalFormat(), std::max(1, size.width() >> 1), std::max(1, size.height() >> 1));
+    qint64 bytes = 0;
+    for (int n = 1; n <= static_cast<int>(levelVersions.size()); ++n) {
+        bytes += static_cast<qint64>(std::max(1, size.width() >> n)) * std::max(1, size.height() >> n) * format.pixelSize();
+    }
+    GLObjectRegistry::add(GLObjectRegistry::Type::Texture, texture, bytes);
+
+    glGenFramebuffers(1, &framebuffer);
+    GLObjectRegistry::add(GLObjectRegistry::Type::Framebuffer, framebuffer);
+
+    bufferProgram = new BufferPyramidProgram(srcFormat);
+    levelProgram = new BufferPyramidProgram(format);
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,47 @@
+#ifndef BUFFERPYRAMID_H
+#define BUFFERPYRAMID_H
+
+#include <vector>
+
+#include "opengl.h"
+#include "buffer.h"
+#include "types.h"
+
+namespace GfxPaint {
+
+class BufferPyramidProgram;
+
+// Box filtered downsamples of a displayed buffer for drawing it zoomed out, level n is 1/2^n of the buffer size
+// Levels from 1 are stored in one mipmapped texture and only regenerated for tiles written since their last update
+class BufferPyramid : protected OpenGL
+{
+public:
+    static const Buffer::Format format;
+
+    explicit BufferPyramid();
+    BufferPyramid(const BufferPyramid &other) = delete;
+    ~BufferPyramid();
+
+    static float transformScale(const Mat4 &worldToClip, const QSize &viewportSize);
+    static int level(const float scale, const QSize &size);
+    static int levelCount(const QSize &size);
+
+    // Brings levels up to and including level up to date with buffer, returns the texture holding levels 1 and above
+    GLuint update(const Buffer &buffer, const int level);
+    void release();
+
+protected:
+    void allocate(const QSize &size, const Buffer::Format &srcFormat);
+
+    GLuint texture;
+    GLuint framebuffer;
+    QSize size;
+    Buffer::Format srcFormat;
+    std::vector<quint64> levelVersions;
+    BufferPyramidProgram *bufferProgram;
+    BufferPyramidProgram *levelProgram;
+};
+
+} // namespace GfxPaint
+
+#endif // BUFFERPYRAMID_H
@@ -30,9 +30,13 @@ ColourComponentsPlaneWidget::~ColourComponentsPlaneWidget()
 void ColourComponentsPlaneWidget::mouseEvent(QMouseEvent *event)
 {
     if (event->buttons() & Qt::LeftButton) {
-        m_pos = Vec2(xComponent >= 0 ? clamp(0.0f, 1.0f, static_cast<float>(event->pos().x()) / static_cast<float>(width() - 1)) : 0.5f,
-                          yComponent >= 0 ? clamp(0.0f, 1.0f, static_cast<float>(event->pos().y()) / static_cast<float>(height() - 1)) : 0.5f);
+        {
+            const QMutexLocker frameLocker(&frameMutex);
+            m_pos = Vec2(xComponent >= 0 ? clamp(0.0f, 1.0f, static_cast<float>(event->pos().x()) / static_cast<float>(width() - 1)) : 0.5f,
+                              yComponent >= 0 ? clamp(0.0f, 1.0f, static_cast<float>(event->pos().y()) / static_cast<float>(height() - 1)) : 0.5f);
+        }
         emit posChanged(m_pos);
+        requestFrame();
         event->accept();
     }
     else event->ignore();
@@ -41,8 +45,11 @@ void ColourComponentsPlaneWidget::mouseEvent(QMouseEvent *event)
 void ColourComponentsPlaneWidget::setColour(const Colour &colour)
 {
     if (m_colour != colour) {
-        m_colour = colour;
-        update();
+        {
+            const QMutexLocker frameLocker(&frameMutex);
+            m_colour = colour;
+        }
+        requestFrame();
     }
 }
 
@@ -54,16 +61,19 @@ void ColourComponentsPlaneWidget::setPalette(const Buffer *const palette)
     oldPrograms.clear();
     if (m_palette != palette) {
         m_palette = palette;
-        if (quantise) update();
+        if (quantise) requestFrame();
     }
 }
 
 void ColourComponentsPlaneWidget::setPos(const Vec2 &pos)
 {
     if (m_pos != pos) {
-        m_pos = Vec2(xComponent >= 0 ? pos.x() : 0.5f, yComponent >= 0 ? pos.y() : 0.5f);
+        {
+            const QMutexLocker frameLocker(&frameMutex);
+            m_pos = Vec2(xComponent >= 0 ? pos.x() : 0.5f, yComponent >= 0 ? pos.y() : 0.5f);
+        }
         emit posChanged(m_pos);
-        update();
+        requestFrame();
     }
 }
 
@@ -82,19 +92,16 @@ void ColourComponentsPlaneWidget::render()
     float markerSize = std::min((float)sizeHint().width(), (float)sizeHint().height());
     if (xComponent >= 0 && yComponent >= 0) markerSize /= 4;
     markerTransform.scale(markerSize / (float)width(), markerSize / (float)height());
-    Model *markerModel = nullptr;
-    if (xComponent >= 0 && yComponent >= 0) {
-        markerModel = qApp->renderManager.models["planeMarker"];
-    }
-    else {
-        markerModel = qApp->renderManager.models["sliderMarker"];
+    OverlayBatcher::Marker marker = OverlayBatcher::Marker::Plane;
+    if (xComponent < 0 || yComponent < 0) {
+        marker = OverlayBatcher::Marker::Slider;
         if (yComponent >= 0) {
             markerTransform.rotate(90.0f);
         }
     }
 
-    VertexColourModelProgram *const markerProgram = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
-    markerProgram->render(markerModel, markerTransform, widgetBuffer, nullptr);
+    overlay.setTransform(Mat4());
+    overlay.marker(marker, markerTransform);
 }
 
 } // namespace GfxPaint
@@ -11,9 +11,11 @@ ColourPaletteWidget::ColourPaletteWidget(QWidget *const parent) :
     leftIndex(INDEX_INVALID), rightIndex(INDEX_INVALID),
     dragStartIndex(INDEX_INVALID), dragEndIndex(INDEX_INVALID),
     program(nullptr), pickProgram(nullptr), selectionProgram(nullptr),
-    m_palette(nullptr), m_selection(nullptr), m_ordering(nullptr)
+    m_palette(nullptr), paletteVersion(0), m_selection(nullptr), m_ordering(nullptr)
 {
     updatePaletteLayout();
+
+    QObject::connect(&qApp->renderManager.frameScheduler, &FrameScheduler::frameStarted, this, &ColourPaletteWidget::checkPaletteVersion);
 }
 
 ColourPaletteWidget::~ColourPaletteWidget()
@@ -66,12 +68,16 @@ bool ColourPaletteWidget::event(QEvent *const event)
                 Buffer workBuffer(*m_selection);
                 workBuffer.copy(*m_selection);
             }
-            if (mouseEvent->buttons() & Qt::LeftButton) leftIndex = index;
-            if (mouseEvent->buttons() & Qt::RightButton) rightIndex = index;
+            {
+                const QMutexLocker frameLocker(&frameMutex);
+                if (mouseEvent->buttons() & Qt::LeftButton) leftIndex = index;
+                if (mouseEvent->buttons() & Qt::RightButton) rightIndex = index;
+            }
             Colour colour = pickProgram->pick(m_palette, cells(), pos);
             // TODO: painting with valid index screwy
             colour.index = INDEX_INVALID;///////////////////////////////////////////////////
             emit colourPicked(colour);
+            requestFrame();
         }
     }
 
@@ -86,6 +92,7 @@ bool ColourPaletteWidget::event(QEvent *const event)
 void ColourPaletteWidget::setPalette(const Buffer *const palette)
 {
     m_palette = palette;
+    paletteVersion = m_palette ? m_palette->version() : 0;
     ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
     if (m_palette) {
         delete m_selection;
@@ -105,10 +112,18 @@ void ColourPaletteWidget::setPalette(const Buffer *const palette)
         selectionProgram = nullptr;
         pickProgram = nullptr;
     }
-//    update();
+    requestFrame();
     updateGeometry();
 }
 
+void ColourPaletteWidget::checkPaletteVersion()
+{
+    if (m_palette && m_palette->version() != paletteVersion) {
+        paletteVersion = m_palette->version();
+        requestFrame();
+    }
+}
+
 void ColourPaletteWidget::updatePaletteLayout()
 {
     setSizeIncrement(m_swatchSize);
@@ -157,21 +172,20 @@ void ColourPaletteWidget::render()
 
         program->render(m_palette, cells, RenderManager::unitToClipTransform, widgetBuffer);
 
-        VertexColourModelProgram *const markerProgram = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
+        overlay.setTransform(Mat4());
 
         const QPoint leftCell = QPoint(leftIndex % cells.width(), leftIndex / cells.width());
         markerTransform = RenderManager::unitToClipTransform;
         markerTransform.translate((float)leftCell.x() * cellSize.x(), (float)leftCell.y() * cellSize.y());
         markerTransform.scale(cellSize.x(), cellSize.y());
-        Model *const markerModel = qApp->renderManager.models["paletteMouseMarker"];
-        markerProgram->render(markerModel, markerTransform, widgetBuffer, nullptr);
+        overlay.marker(OverlayBatcher::Marker::PaletteMouse, markerTransform);
 
         const QPoint rightCell = QPoint(rightIndex % cells.width(), rightIndex / cells.width());
         markerTransform = RenderManager::unitToClipTransform;
         markerTransform.translate((float)(rightCell.x() + 1) * cellSize.x(), (float)(rightCell.y() + 1) * cellSize.y());
         markerTransform.rotate(180.0f);
         markerTransform.scale(cellSize.x(), cellSize.y());
-        markerProgram->render(markerModel, markerTransform, widgetBuffer, nullptr);
+        overlay.marker(OverlayBatcher::Marker::PaletteMouse, markerTransform);
     }
 }
 
@@ -45,6 +45,8 @@ protected:
     }
     QSize cells() const;
     void updatePaletteLayout();
+    // Palettes are painted on as scene nodes, so edits show up as a new version rather than a setPalette()
+    void checkPaletteVersion();
 
     int m_columnCount;
     bool m_fitColumnCount;
@@ -59,6 +61,7 @@ protected:
     ColourPaletteProgram *selectionProgram;
 
     const Buffer *m_palette;
+    quint64 paletteVersion;
     Buffer *m_selection;
     Buffer *m_ordering;    
 };
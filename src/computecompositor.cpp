@@ -0,0 +1,63 @@
+#include "computecompositor.h"
+
+#include "application.h"
+
+namespace GfxPaint {
+
+ComputeCompositor::ComputeCompositor() :
+    layers(), dest(nullptr), scissor(), programs()
+{
+    layers.reserve(CompositorProgram::maxLayers);
+}
+
+ComputeCompositor::~ComputeCompositor()
+{
+    Q_ASSERT(programs.empty());
+}
+
+bool ComputeCompositor::accepts(const bool layerIndexed, const Buffer::Format &destFormat, const bool destIndexed)
+{
+    // Indexed layers need palette lookups and quantising, image stores need 1, 2 or 4 components
+    return !layerIndexed && !destIndexed && destFormat.componentCount != 3;
+}
+
+void ComputeCompositor::add(const CompositorProgram::Layer &layer, Buffer *const dest, const QRect &scissor)
+{
+    if (!layers.empty() && (dest != this->dest || scissor != this->scissor ||
+        !CompositorProgram::compatible(layers.front().buffer->format(), layer.buffer->format()) ||
+        layer.buffer->array() != layers.front().buffer->array() ||
+        (!layer.buffer->array() && static_cast<int>(layers.size()) == CompositorProgram::maxLayers))) {
+        flush();
+    }
+    this->dest = dest;
+    this->scissor = scissor;
+    layers.push_back(layer);
+}
+
+void ComputeCompositor::flush()
+{
+    if (layers.empty()) return;
+
+    const bool layerArray = layers.front().buffer->array();
+    const std::tuple<Buffer::Format::ComponentType, bool, Buffer::Format> key = {layers.front().buffer->format().componentType, layerArray, dest->format()};
+    auto found = programs.find(key);
+    if (found == programs.end()) {
+        found = programs.insert({key, new CompositorProgram(layers.front().buffer->format(), layerArray, dest->format())}).first;
+    }
+    if (found->second->isReady()) found->second->render(layers, dest, scissor);
+    else qApp->renderManager.programManager.countNotReady();
+
+    layers.clear();
+    dest = nullptr;
+}
+
+void ComputeCompositor::release()
+{
+    layers.clear();
+    for (auto &[key, program] : programs) {
+        delete program;
+    }
+    programs.clear();
+}
+
+} // namespace GfxPaint
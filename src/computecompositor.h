@@ -0,0 +1,37 @@
+#ifndef COMPUTECOMPOSITOR_H
+#define COMPUTECOMPOSITOR_H
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "buffer.h"
+#include "program.h"
+
+namespace GfxPaint {
+
+// Alternative to drawing each buffer node into its render target, layers are queued during traversal
+// and composited per screen tile by compute dispatches of up to CompositorProgram::maxLayers layers,
+// or of any number of consecutive layers from one texture array
+class ComputeCompositor
+{
+public:
+    explicit ComputeCompositor();
+    ~ComputeCompositor();
+
+    static bool accepts(const bool layerIndexed, const Buffer::Format &destFormat, const bool destIndexed);
+
+    void add(const CompositorProgram::Layer &layer, Buffer *const dest, const QRect &scissor);
+    void flush();
+    void release();
+
+protected:
+    std::vector<CompositorProgram::Layer> layers;
+    Buffer *dest;
+    QRect scissor;
+    std::map<std::tuple<Buffer::Format::ComponentType, bool, Buffer::Format>, CompositorProgram *> programs;
+};
+
+} // namespace GfxPaint
+
+#endif // COMPUTECOMPOSITOR_H
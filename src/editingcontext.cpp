@@ -2,6 +2,7 @@
 
 #include "application.h"
 #include "editor.h"
+#include "tracer.h"
 
 namespace GfxPaint {
 
@@ -28,7 +29,8 @@ EditingContext::EditingContext(Scene &scene) :
     colour{{0.0, 0.0, 0.0, 1.0}, INDEX_INVALID},
     palette(nullptr),
     m_selectionModel(qApp->documentManager.documentModel(&scene)),
-    m_selectedNodes()
+    m_selectedNodes(),
+    isSnapshot(false)
 {
 }
 
@@ -43,7 +45,8 @@ EditingContext::EditingContext(EditingContext &other) :
     palette(other.palette),
     m_selectionModel(other.m_selectionModel.model()),
     m_selectedNodes(other.m_selectedNodes),
-    formatToolPrograms{}
+    formatToolPrograms{}, sharedToolPrograms{},
+    isSnapshot(false)
 {
     m_selectionModel.select(other.m_selectionModel.selection(), QItemSelectionModel::ClearAndSelect);
 }
@@ -51,15 +54,23 @@ EditingContext::EditingContext(EditingContext &other) :
 EditingContext::~EditingContext()
 {
     ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    if (!isSnapshot) {
+        for (auto &[node, buffer] : selectedNodeRestoreBuffers) {
+            delete buffer;
+        }
+    }
     selectedNodeRestoreBuffers.clear();
     for (auto &[key, programs] : formatToolPrograms) {
-        programs.clear();
+        for (auto &[name, program] : programs) {
+            delete program;
+        }
     }
     formatToolPrograms.clear();
 }
 
 void EditingContext::update(Editor &editor)
 {
+    const Tracer::Scope traceScope("EditingContext::update", "edit");
     qDebug() << "EditingContext::update";/////////////////////////
     m_states.clear();
     for (const auto &node : m_selectedNodes) {
@@ -96,22 +107,71 @@ void EditingContext::update(Editor &editor)
             selectedNodeRestoreBuffers[bufferNode] = new Buffer(bufferNode->buffer);
             for (const ToolId toolId : tools) {
                 Tool *const tool = editor.toolInfo.at(toolId).tool;
-                auto programs = tool->formatPrograms(*this, bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format());
-                qDebug() << "PROGRAMS!!!";//////////////////////////////////////////
                 const std::tuple key{bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), tool};
                 if (!formatToolPrograms.contains(key)) {
+                    const GLObjectRegistry::OwnerScope ownerScope("Tool", editor.toolInfo.at(toolId).name);
+                    auto programs = tool->formatPrograms(*this, bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format());
+                    qDebug() << "PROGRAMS!!!";//////////////////////////////////////////
+                    // Compile in the background so the first stroke doesn't wait on it
+                    for (const auto &[name, program] : programs) {
+                        program->prepare();
+                    }
                     formatToolPrograms[key] = programs;
                 }
             }
         }
     }
+    // Old programs go after their replacements are made so shared GL programs stay linked
+    for (auto &[node, buffer] : oldSelectedNodeRestoreBuffers) {
+        delete buffer;
+    }
     oldSelectedNodeRestoreBuffers.clear();
+    for (auto &[key, programs] : oldFormatToolPrograms) {
+        for (auto &[name, program] : programs) {
+            delete program;
+        }
+    }
     oldFormatToolPrograms.clear();
 }
 
+void EditingContext::snapshot(const EditingContext &other)
+{
+    // Programs made for tools the source had none for were built with the previous modes and brush
+    if (blendMode != other.blendMode || composeMode != other.composeMode || brush != other.brush) {
+        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+        for (auto &[key, programs] : formatToolPrograms) {
+            for (auto &[name, program] : programs) {
+                delete program;
+            }
+        }
+        formatToolPrograms.clear();
+    }
+
+    selectedToolId = other.selectedToolId;
+    toolMode = other.toolMode;
+    toolSpace = other.toolSpace;
+    toolStroke = other.toolStroke;
+    transformTarget = other.transformTarget;
+    blendMode = other.blendMode;
+    composeMode = other.composeMode;
+    brush = other.brush;
+    colour = other.colour;
+    palette = other.palette;
+    m_states = other.m_states;
+    m_selectedNodes = other.m_selectedNodes;
+    selectedNodeRestoreBuffers = other.selectedNodeRestoreBuffers;
+    sharedToolPrograms = other.formatToolPrograms;
+    isSnapshot = true;
+}
+
 Program *EditingContext::toolProgram(const Buffer::Format &bufferFormat, const bool indexed, const Buffer::Format &paletteFormat, Tool *const tool, const QString &name)
 {
     auto key = std::tuple{bufferFormat, indexed, paletteFormat, tool};
+    const auto shared = sharedToolPrograms.find(key);
+    if (shared != sharedToolPrograms.end()) {
+        Q_ASSERT(shared->second.contains(name));
+        return shared->second[name];
+    }
     if (!formatToolPrograms.contains(key)) {
         formatToolPrograms[key] = tool->formatPrograms(*this, bufferFormat, indexed, paletteFormat);
     }
@@ -60,6 +60,9 @@ public:
     ~EditingContext();
 
     void update(Editor &editor);
+    // Copies what tools read while previewing, for frames rendering while events change other. Restore buffers and
+    // tool programs stay owned by other, which syncs frames before replacing them
+    void snapshot(const EditingContext &other);
 
     Program *toolProgram(const Buffer::Format &bufferFormat, const bool indexed, const Buffer::Format &paletteFormat, Tool *const tool, const QString &name);
 
@@ -83,6 +86,9 @@ public:
     std::vector<Node *> m_selectedNodes;
     std::unordered_map<Node *, Buffer *> selectedNodeRestoreBuffers;
     std::map<std::tuple<Buffer::Format, bool, Buffer::Format, Tool *>, std::map<QString, Program *>> formatToolPrograms;
+    // Programs of the snapshot source, looked up before making any of its own
+    std::map<std::tuple<Buffer::Format, bool, Buffer::Format, Tool *>, std::map<QString, Program *>> sharedToolPrograms;
+    bool isSnapshot;
 };
 
 } // namespace GfxPaint
@@ -1,10 +1,13 @@
 #include "editor.h"
 
 #include <QMouseEvent>
+#include <QRegion>
 #include <QtMath>
 //#include <QGamepadManager>
+#include <algorithm>
 #include <cmath>
 #include "application.h"
+#include "tracer.h"
 #include "utils.h"
 
 namespace GfxPaint {
@@ -16,6 +19,18 @@ void Editor::init()
 
     QObject::connect(&m_editingContext.selectionModel(), &QItemSelectionModel::selectionChanged, this, &Editor::updateContext);
 
+    // Repaint when the scene graph changes through any editor
+    QObject::connect(&model, &QAbstractItemModel::dataChanged, this, &Editor::requestFrame);
+    QObject::connect(&model, &QAbstractItemModel::rowsInserted, this, &Editor::requestFrame);
+    QObject::connect(&model, &QAbstractItemModel::rowsRemoved, this, &Editor::requestFrame);
+    QObject::connect(&model, &QAbstractItemModel::rowsMoved, this, &Editor::requestFrame);
+    QObject::connect(&model, &QAbstractItemModel::modelReset, this, &Editor::requestFrame);
+
+    // Refine to full resolution once the view has been idle
+    refineTimer.setSingleShot(true);
+    QObject::connect(&refineTimer, &QTimer::timeout, this, &Editor::requestFrame);
+    QObject::connect(&qApp->renderManager.programCompiler, &ProgramCompiler::programCompiled, this, &Editor::requestFrame);
+
 //    qDebug() << QGamepadManager::instance()->isGamepadConnected(0);
 //    QObject::connect(QGamepadManager::instance(), &QGamepadManager::gamepadAxisEvent, this, [](){
 
@@ -33,9 +48,14 @@ Editor::Editor(Scene &scene, QWidget *parent) :
     scene(scene), model(*qApp->documentManager.documentModel(&scene)),
     pixelTool(), brushTool(), rectTool(), ellipseTool(), contourTool(), pickTool(), transformTargetOverrideTool(*this), panTool(*this), rotoZoomTool(*this), zoomTool(*this), rotateTool(*this),
     m_editingContext(scene),
+    frameContext(m_editingContext), frameState(),
     cameraTransform(),
+    belowCache(), aboveCache(), subtreeCaches(), compositeProgram(nullptr), widgetBufferCopy(nullptr),
+    sceneFrame(),
+    reducedBuffer(nullptr), reducedScale(1.0f), reducedFrameTimer(), reducedFrameScales(), viewChangeTimer(), refineTimer(),
     inputState{}, cursorPos(), cursorDelta(), cursorOver{false}, wheelDelta{}, pressure{}, rotation{}, tilt{}, quaternion{},
-    selectedToolStack{}, activatedToolStack{}
+    selectedToolStack{}, activatedToolStack{},
+    pendingMoves(), replayingMoves(false)
 {
     init();
 }
@@ -45,10 +65,15 @@ Editor::Editor(const Editor &other) :
     scene(other.scene), model(other.model),
     pixelTool(other.pixelTool), brushTool(other.brushTool), rectTool(other.rectTool), ellipseTool(other.ellipseTool), contourTool(other.contourTool), pickTool(other.pickTool), transformTargetOverrideTool(other.transformTargetOverrideTool), panTool(other.panTool), rotoZoomTool(other.rotoZoomTool), zoomTool(other.zoomTool), rotateTool(other.rotateTool),
     m_editingContext(other.scene),
+    frameContext(m_editingContext), frameState(),
     cameraTransform(other.cameraTransform),
+    belowCache(), aboveCache(), subtreeCaches(), compositeProgram(nullptr), widgetBufferCopy(nullptr),
+    sceneFrame(),
+    reducedBuffer(nullptr), reducedScale(1.0f), reducedFrameTimer(), reducedFrameScales(), viewChangeTimer(), refineTimer(),
     inputState{}, cursorPos(), cursorDelta(), cursorOver{false}, wheelDelta{}, pressure{}, rotation{}, tilt{}, quaternion{},
     toolSelectors(other.toolSelectors), selectedToolActivators(other.selectedToolActivators), modelessToolActivators(other.modelessToolActivators), toolModeModifiers(other.toolModeModifiers),
-    selectedToolStack(other.selectedToolStack), activatedToolStack(other.activatedToolStack)
+    selectedToolStack(other.selectedToolStack), activatedToolStack(other.activatedToolStack),
+    pendingMoves(), replayingMoves(false)
 {
     init();
 }
@@ -56,6 +81,17 @@ Editor::Editor(const Editor &other) :
 Editor::~Editor()
 {
     qDebug() << "Editor destructor!";
+    syncFrame();
+    releaseCompositeCaches();
+    Scene::releaseSubtreeCaches(subtreeCaches);
+    qApp->workBufferManager.returnBuffer(sceneFrame.buffer);
+    qApp->workBufferManager.returnBuffer(reducedBuffer);
+    qApp->workBufferManager.returnBuffer(widgetBufferCopy);
+    {
+        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+        delete compositeProgram;
+        reducedFrameTimer.release();
+    }
 }
 
 bool Editor::eventFilter(QObject *const watched, QEvent *const event)
@@ -79,6 +115,24 @@ bool Editor::eventFilter(QObject *const watched, QEvent *const event)
 
 bool Editor::event(QEvent *const event)
 {
+    const Tracer::Scope traceScope("Editor::event", "input", Tracer::isEnabled() ? QString::number(event->type()) : QString());
+    const bool isMove = event->type() == QEvent::MouseMove || event->type() == QEvent::NonClientAreaMouseMove || event->type() == QEvent::TabletMove;
+    if (isMove && frameInFlight && !replayingMoves) {
+        pendingMoves.emplace_back(event->clone());
+        event->accept();
+        return true;
+    }
+    // Frames read a snapshot of the state events below change, earlier moves are handled first to keep their order
+    static constexpr QEvent::Type stateEvents[] = {
+        QEvent::KeyPress, QEvent::KeyRelease,
+        QEvent::MouseButtonPress, QEvent::MouseButtonRelease, QEvent::NonClientAreaMouseButtonRelease, QEvent::MouseMove, QEvent::NonClientAreaMouseMove,
+        QEvent::Wheel, QEvent::TabletPress, QEvent::TabletRelease, QEvent::TabletMove,
+        QEvent::Enter, QEvent::Leave, QEvent::FocusOut, QEvent::WindowDeactivate,
+    };
+    if (!replayingMoves && std::find(std::begin(stateEvents), std::end(stateEvents), event->type()) != std::end(stateEvents)) {
+        replayPendingMoves();
+    }
+
     bool consume = false;
     bool inputStateChanged = false;
 
@@ -199,6 +253,7 @@ bool Editor::event(QEvent *const event)
                 const auto &[trigger, id] = *iterator;
                 if (!trigger.testExact(inputState)) {
                     const ToolInfo &info = toolInfo.at(id);
+                    const GLObjectRegistry::OwnerScope ownerScope("Tool", info.name);
                     m_editingContext.toolStroke.add(cursorWorldPos, pressure, quaternion);
                     m_editingContext.toolMode = info.operationMode;
                     info.tool->end(m_editingContext, transform());
@@ -222,6 +277,7 @@ bool Editor::event(QEvent *const event)
                     if (std::find(activatedToolStack.begin(), activatedToolStack.end(), pair) == activatedToolStack.end()) {
                         activatedToolStack.push_front(pair);
                         const ToolInfo &info = toolInfo.at(id);
+                        const GLObjectRegistry::OwnerScope ownerScope("Tool", info.name);
                         m_editingContext.toolStroke = {};
                         m_editingContext.toolStroke.add(cursorWorldPos, pressure, quaternion);
                         m_editingContext.toolMode = info.operationMode;
@@ -240,6 +296,7 @@ bool Editor::event(QEvent *const event)
         {
             for (auto &[inputState, toolId] : activatedToolStack) {
                 const ToolInfo &info = toolInfo.at(toolId);
+                const GLObjectRegistry::OwnerScope ownerScope("Tool", info.name);
                 // Handle mouse wheel
                 if (event->type() == QEvent::Wheel) {
                     m_editingContext.toolMode = info.operationMode;
@@ -290,6 +347,10 @@ bool Editor::event(QEvent *const event)
         consume = true;
     }
 
+    // Tools may have edited the scene shown by other editors
+    if (!activatedToolStack.empty() || consume) requestSceneFrames();
+    else if (inputStateChanged) requestFrame();
+
     if (consume) {
         event->accept();
         return true;
@@ -297,6 +358,31 @@ bool Editor::event(QEvent *const event)
     else return RenderedWidget::event(event);
 }
 
+void Editor::replayPendingMoves()
+{
+    if (pendingMoves.empty()) return;
+
+    replayingMoves = true;
+    std::vector<std::unique_ptr<QEvent>> moves;
+    moves.swap(pendingMoves);
+    for (const std::unique_ptr<QEvent> &move : moves) {
+        event(move.get());
+    }
+    replayingMoves = false;
+}
+
+void Editor::frameFinished()
+{
+    replayPendingMoves();
+}
+
+void Editor::requestSceneFrames()
+{
+    for (Editor *const editor : qApp->documentManager.documentEditors(&scene)) {
+        editor->requestFrame();
+    }
+}
+
 void Editor::updateWindowTitle()
 {
     setWindowModified(scene.modified());
@@ -357,8 +443,9 @@ void Editor::setSelectedToolId(const EditingContext::ToolId toolId)
 {
     if (m_editingContext.selectedToolId != toolId) {
         m_editingContext.selectedToolId = toolId;
-        m_editingContext.update(*this);
+        updateEditingContext();
         emit selectedToolIdChanged(toolId);
+        requestFrame();
     }
 }
 
@@ -374,8 +461,9 @@ void Editor::setBlendMode(const int blendMode)
 {
     if (m_editingContext.blendMode != blendMode) {
         m_editingContext.blendMode = blendMode;
-        m_editingContext.update(*this);
+        updateEditingContext();
         emit blendModeChanged(blendMode);
+        requestFrame();
     }
 }
 
@@ -383,8 +471,9 @@ void Editor::setComposeMode(const int composeMode)
 {
     if (m_editingContext.composeMode != composeMode) {
         m_editingContext.composeMode = composeMode;
-        m_editingContext.update(*this);
+        updateEditingContext();
         emit composeModeChanged(composeMode);
+        requestFrame();
     }
 }
 
@@ -392,8 +481,9 @@ void Editor::setBrush(const Brush &brush)
 {
     if (m_editingContext.brush != brush) {
         m_editingContext.brush = brush;
-        m_editingContext.update(*this);
+        updateEditingContext();
         emit brushChanged(brush);
+        requestFrame();
     }
 }
 
@@ -402,53 +492,82 @@ void Editor::setColour(const Colour &colour)
     if (m_editingContext.colour != colour) {
         m_editingContext.colour = colour;
         emit colourChanged(colour);
+        requestFrame();
     }
 }
 
-void Editor::render()
+void Editor::prepareFrame()
 {
-    Tool *onCanvasPreviewTool = nullptr;
-    bool onCanvasPreviewIsActive = false;
-    int onCanvasPreviewMode = 0;
-    if (activatedToolStack.size() > 0) {
+    // States the previous frame harvested, while the selection it rendered is still current
+    if (frameContext.selectedNodes() == m_editingContext.selectedNodes()) m_editingContext.states() = frameContext.states();
+
+    frameState = FrameState();
+    if (!activatedToolStack.empty()) {
         const ToolInfo &info = toolInfo.at(activatedToolStack.front().second);
-        onCanvasPreviewTool = info.tool;
-        onCanvasPreviewIsActive = true;
-        onCanvasPreviewMode = info.operationMode;
+        frameState.previewTool = info.tool;
+        frameState.previewMode = info.operationMode;
+        frameState.previewIsActive = true;
     }
-    else if (selectedToolStack.size() > 0) {
+    else if (!selectedToolStack.empty()) {
         const ToolInfo &info = toolInfo.at(selectedToolStack.front().second);
-        onCanvasPreviewTool = info.tool;
-        onCanvasPreviewMode = info.operationMode;
+        frameState.previewTool = info.tool;
+        frameState.previewMode = info.operationMode;
     }
+    frameState.cursorOver = cursorOver;
+    frameState.viewInteraction = viewInteraction();
+    frameState.cameraTransform = cameraTransform;
+    frameContext.snapshot(m_editingContext);
+}
 
-    for (Node *node : m_editingContext.selectedNodes()) {
+void Editor::render()
+{
+    const GLObjectRegistry::OwnerScope ownerScope("Editor", scene.filename());
+    Tool *const previewTool = frameState.previewTool;
+    // View transform tools have no on-canvas preview
+    const bool onCanvasPreview = frameState.cursorOver && previewTool && !previewTool->updatesViewTransform();
+    const quint64 sceneVersion = scene.contentVersion(0, static_cast<int>(scene.flatNodes().size()));
+
+    for (Node *node : frameContext.selectedNodes()) {
         BufferNode *const bufferNode = dynamic_cast<BufferNode *>(node);
-        if (bufferNode && m_editingContext.selectedNodeRestoreBuffers[node]) {
+        if (bufferNode && frameContext.selectedNodeRestoreBuffers[node]) {
             // Draw on-canvas tool preview
-            if (cursorOver && onCanvasPreviewTool) {
-                m_editingContext.selectedNodeRestoreBuffers[node]->copy(bufferNode->buffer);
+            if (onCanvasPreview) {
+                FrameProfiler::Scope profileScope("On-canvas preview");
+                frameContext.selectedNodeRestoreBuffers[node]->copy(bufferNode->buffer);
                 ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
                 bufferNode->buffer.bindFramebuffer();
                 glDisable(GL_DEPTH_TEST);
                 glDisable(GL_BLEND);
 
-                m_editingContext.toolMode = onCanvasPreviewMode;
-                onCanvasPreviewTool->onCanvasPreview(m_editingContext, transform(), onCanvasPreviewIsActive);
+                frameContext.toolMode = frameState.previewMode;
+                previewTool->onCanvasPreview(frameContext, frameState.cameraTransform, frameState.previewIsActive);
             }
         }
     }
 
     // Draw scene
+    const quint64 notReadyCount = qApp->renderManager.programManager.notReadyCount();
     widgetBuffer->bindFramebuffer();
-    scene.render(widgetBuffer, false, nullptr, viewportTransform * cameraTransform, &m_editingContext.states());
+    bool reduced = false;
+    if (onCanvasPreview || !scrollScene(sceneVersion)) {
+        FrameProfiler::Scope profileScope("Scene composite");
+        if (!onCanvasPreview && frameState.viewInteraction) reduced = renderReducedScene();
+        else renderScene();
+    }
+    // Nodes were left out while their programs compile, show the previous frame of the same view until they're ready
+    const bool complete = qApp->renderManager.programManager.notReadyCount() == notReadyCount;
+    if (!complete && sceneFrame.valid && sceneFrame.buffer->size() == widgetBuffer->size() && sceneFrame.cameraTransform == frameState.cameraTransform) {
+        widgetBuffer->copy(*sceneFrame.buffer);
+    }
+    // Frames containing a preview or at reduced resolution can't be reused, incomplete frames keep the previous one
+    if (complete) storeSceneFrame(sceneVersion, !onCanvasPreview && !reduced);
 
-    for (Node *node : m_editingContext.selectedNodes()) {
+    for (Node *node : frameContext.selectedNodes()) {
         BufferNode *const bufferNode = dynamic_cast<BufferNode *>(node);
-        if (bufferNode && m_editingContext.selectedNodeRestoreBuffers[node]) {
+        if (bufferNode && frameContext.selectedNodeRestoreBuffers[node]) {
             // Undraw on-canvas tool preview
-            if (cursorOver && onCanvasPreviewTool) {
-                bufferNode->buffer.copy(*m_editingContext.selectedNodeRestoreBuffers[node]);
+            if (onCanvasPreview) {
+                bufferNode->buffer.copy(*frameContext.selectedNodeRestoreBuffers[node]);
             }
         }
     }
@@ -489,22 +608,38 @@ void Editor::render()
 //   };
 //    smoothQuadProgram->render(smoothQuadPoints, viewportTransform * cameraTransform, widgetBuffer, nullptr);
 
-    Tool *onTopPreviewTool = nullptr;
-    bool onTopPreviewIsActive = false;
-    int onTopPreviewMode = 0;
-    if (activatedToolStack.size() > 0) {
-        const ToolInfo &info = toolInfo.at(activatedToolStack.front().second);
-        onTopPreviewTool = info.tool;
-        onTopPreviewIsActive = true;
-        onTopPreviewMode = info.operationMode;
+    frameContext.toolMode = frameState.previewMode;
+    if (previewTool) {
+        FrameProfiler::Scope profileScope("Top preview");
+        previewTool->onTopPreview(*this, frameContext, frameState.cameraTransform, frameState.previewIsActive);
     }
-    else if (selectedToolStack.size() > 0) {
-        const ToolInfo &info = toolInfo.at(selectedToolStack.front().second);
-        onTopPreviewTool = info.tool;
-        onTopPreviewMode = info.operationMode;
+
+    FrameProfiler &profiler = qApp->renderManager.profiler;
+    if (profiler.overlayShown()) renderProfilerOverlay(profiler.lastFrame());
+    profiler.endFrame();
+}
+
+void Editor::renderProfilerOverlay(const FrameProfiler::Frame &frame)
+{
+    QStringList lines = {
+        QString("Frame %1 ms  %2 state calls  %3 program binds  %4 copies  %5 KiB moved")
+            .arg(frame.intervalMs, 0, 'f', 2).arg(frame.stateCalls).arg(frame.programBinds).arg(frame.textureCopies).arg(frame.bytesMoved / 1024),
+    };
+    for (const FrameProfiler::Pass &pass : frame.passes) {
+        lines.append(QString("%1 x%2  CPU %3 ms  GPU %4").arg(pass.name).arg(pass.calls).arg(pass.cpuMs, 0, 'f', 3)
+                     .arg(pass.gpuMs < 0.0 ? QString("-") : QString::number(pass.gpuMs, 'f', 3) + " ms"));
+    }
+
+    // Top left in widget pixels
+    static const float lineHeight = 14.0f;
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    font.setPixelSize(12);
+    overlay.setTransform(viewportToClipTransform(widgetBuffer->size()));
+    overlay.rect(QRectF(4.0, 4.0, 480.0, lines.size() * lineHeight + 8.0), {0.0f, 0.0f, 0.0f, 0.6f});
+    for (int i = 0; i < lines.size(); ++i) {
+        overlay.text(Vec2(8.0f, 4.0f + (i + 1) * lineHeight), lines[i], font, 1.0f, {1.0f, 1.0f, 1.0f, 1.0f});
     }
-    m_editingContext.toolMode = onTopPreviewMode;
-    if (onTopPreviewTool) onTopPreviewTool->onTopPreview(*this, m_editingContext, transform(), onTopPreviewIsActive);
 }
 
 float Editor::strokeSegmentDabs(const Stroke::Point &start, const Stroke::Point &end, const Vec2 &dabSize, const Vec2 &absoluteSpacing, const Vec2 &proportionalSpacing, const float offset, Stroke &output) {
@@ -559,6 +694,202 @@ Mat4 Editor::toolSpace(EditingContext &context, const Mat4 &viewTransform, Buffe
     return toolSpaceTransform;
 }
 
+void Editor::renderScene()
+{
+    const Mat4 viewTransform = viewportTransform * frameState.cameraTransform;
+
+    // Layers below and above a single active node are static while it is edited, so are composited once
+    // into cached buffers which are reused until any of their nodes change. Groups are cached on their own as
+    // well, so a change to one group or a new active node doesn't recomposite every other group.
+    Node *const activeNode = frameContext.selectedNodes().size() == 1 ? frameContext.selectedNodes().front() : nullptr;
+    const int activeBegin = activeNode ? scene.flatIndex(activeNode) : -1;
+    if (activeBegin <= 0) {
+        releaseCompositeCaches();
+        scene.renderSegments({}, [this](const int) -> Buffer * {
+            return widgetBuffer;
+        }, viewTransform, &frameContext.states(), &subtreeCaches);
+        return;
+    }
+    const int activeEnd = activeBegin + scene.flatNodes()[activeBegin].skip + 1;
+    const int nodeCount = static_cast<int>(scene.flatNodes().size());
+
+    // Nodes above depend on the transform and palette state set up by nodes below
+    const quint64 belowVersion = scene.contentVersion(0, activeBegin);
+    const quint64 aboveVersion = std::max(belowVersion, scene.contentVersion(activeEnd, nodeCount));
+    const bool belowValid = updateCompositeCache(belowCache, activeNode, belowVersion, viewTransform);
+    const bool aboveValid = updateCompositeCache(aboveCache, activeNode, aboveVersion, viewTransform);
+
+    scene.renderSegments({activeBegin, activeEnd}, [&](const int segment) -> Buffer * {
+        switch (segment) {
+        case 0: return belowValid ? nullptr : belowCache.buffer;
+        case 1: {
+            compositeCache(belowCache);
+            return widgetBuffer;
+        }
+        default: return aboveValid ? nullptr : aboveCache.buffer;
+        }
+    }, viewTransform, &frameContext.states(), &subtreeCaches);
+
+    compositeCache(aboveCache);
+}
+
+bool Editor::scrollScene(const quint64 sceneVersion)
+{
+    if (!sceneFrame.valid || sceneFrame.version != sceneVersion || sceneFrame.buffer->size() != widgetBuffer->size()) return false;
+
+    // Only a whole pixel translation of the camera since the previous frame can be scrolled
+    const Mat4 delta = frameState.cameraTransform * sceneFrame.cameraTransform.inverted();
+    static const float epsilon = 1.0e-4f;
+    if (std::fabs(delta(0, 0) - 1.0f) > epsilon || std::fabs(delta(1, 1) - 1.0f) > epsilon ||
+        std::fabs(delta(0, 1)) > epsilon || std::fabs(delta(1, 0)) > epsilon) return false;
+    const QPoint offset(std::lround(delta(0, 3)), std::lround(delta(1, 3)));
+    if (std::fabs(delta(0, 3) - offset.x()) > epsilon || std::fabs(delta(1, 3) - offset.y()) > epsilon) return false;
+
+    const QRect rect = widgetBuffer->rect();
+    const QRect kept = rect.intersected(rect.translated(offset));
+    if (kept.isEmpty()) return false;
+
+    widgetBuffer->copy(*sceneFrame.buffer, kept.translated(-offset), kept.topLeft());
+
+    // Render only the newly exposed strips
+    const QRegion exposed = QRegion(rect).subtracted(kept);
+    const Mat4 viewTransform = viewportTransform * frameState.cameraTransform;
+    for (const QRect &strip : exposed) {
+        scene.render(widgetBuffer, false, nullptr, viewTransform, &frameContext.states(), strip);
+    }
+    widgetBuffer->bindFramebuffer();
+
+    return true;
+}
+
+void Editor::storeSceneFrame(const quint64 sceneVersion, const bool valid)
+{
+    sceneFrame.valid = valid;
+    if (!valid) return;
+
+    if (!sceneFrame.buffer || sceneFrame.buffer->size() != widgetBuffer->size()) {
+        qApp->workBufferManager.returnBuffer(sceneFrame.buffer);
+        sceneFrame.buffer = qApp->workBufferManager.takeBuffer(RenderedWidget::format, widgetBuffer->size());
+    }
+    sceneFrame.buffer->copy(*widgetBuffer);
+    sceneFrame.cameraTransform = frameState.cameraTransform;
+    sceneFrame.version = sceneVersion;
+}
+
+bool Editor::viewInteraction() const
+{
+    const RenderManager::InteractiveResolution &policy = qApp->renderManager.interactiveResolution;
+    return policy.mode != RenderManager::InteractiveResolution::Mode::Full && viewChangeTimer.isValid() && viewChangeTimer.elapsed() < policy.refineDelay;
+}
+
+bool Editor::renderReducedScene()
+{
+    const RenderManager::InteractiveResolution &policy = qApp->renderManager.interactiveResolution;
+    // Frames may render on the render thread, the timer belongs to the main thread
+    QMetaObject::invokeMethod(&refineTimer, [this, delay = policy.refineDelay](){
+        refineTimer.start(delay);
+    });
+
+    // Time on the GPU, not submission, is what reduced resolution saves. It's read back frames later so the pipeline
+    // is never drained, and adapts from the scale the timed frame used.
+    for (double frameTime = reducedFrameTimer.take(); frameTime >= 0.0; frameTime = reducedFrameTimer.take()) {
+        const float timedScale = reducedFrameScales.front();
+        reducedFrameScales.pop_front();
+        // Cost is roughly proportional to pixel count, adjust outside a tolerance band to avoid oscillating
+        if (policy.mode == RenderManager::InteractiveResolution::Mode::Adaptive && frameTime > 0.0 &&
+            (frameTime > policy.targetFrameTime * 1.25f || frameTime < policy.targetFrameTime * 0.75f)) {
+            reducedScale = std::clamp(timedScale * std::sqrt(policy.targetFrameTime / static_cast<float>(frameTime)), policy.minScale, 1.0f);
+        }
+    }
+
+    float scale = policy.mode == RenderManager::InteractiveResolution::Mode::Fixed ? policy.fixedScale : reducedScale;
+    // Quantise so the pooled buffer is reused between frames
+    scale = std::ceil(std::clamp(scale, policy.minScale, 1.0f) * 8.0f) / 8.0f;
+
+    if (reducedFrameTimer.begin()) reducedFrameScales.push_back(scale);
+
+    bool reduced = false;
+    if (scale >= 1.0f) {
+        renderScene();
+    }
+    else {
+        const QSize size(std::max(1, qRound(widgetBuffer->width() * scale)), std::max(1, qRound(widgetBuffer->height() * scale)));
+        if (!reducedBuffer || reducedBuffer->size() != size) {
+            qApp->workBufferManager.returnBuffer(reducedBuffer);
+            reducedBuffer = qApp->workBufferManager.takeBuffer(RenderedWidget::format, size);
+        }
+        releaseCompositeCaches();
+
+        // The view transform is resolution independent, so rendering to the smaller target scales the whole scene
+        reducedBuffer->clear();
+        scene.render(reducedBuffer, false, nullptr, viewportTransform * frameState.cameraTransform, &frameContext.states());
+
+        if (!compositeProgram) {
+            compositeProgram = new BufferProgram(RenderedWidget::format, false, Buffer::Format(), RenderedWidget::format, false, Buffer::Format(), 0, RenderManager::composeModeDefault);
+        }
+        Mat4 upscaleTransform = viewportToClipTransform(widgetBuffer->size());
+        upscaleTransform.scale(QVector2D(static_cast<float>(widgetBuffer->width()) / size.width(), static_cast<float>(widgetBuffer->height()) / size.height()));
+        Buffer *const dest = copyWidgetBuffer();
+        widgetBuffer->bindFramebuffer();
+        compositeProgram->render(reducedBuffer, nullptr, Colour{}, upscaleTransform, dest, nullptr, Colour{});
+        reduced = true;
+    }
+
+    reducedFrameTimer.end();
+
+    return reduced;
+}
+
+bool Editor::updateCompositeCache(CompositeCache &cache, Node *const activeNode, const quint64 version, const Mat4 &viewTransform)
+{
+    if (!cache.buffer || cache.buffer->size() != widgetBuffer->size()) {
+        qApp->workBufferManager.returnBuffer(cache.buffer);
+        cache.buffer = qApp->workBufferManager.takeBuffer(RenderedWidget::format, widgetBuffer->size());
+        cache.version = 0;
+    }
+    if (cache.activeNode == activeNode && cache.version == version && cache.viewTransform == viewTransform) return true;
+
+    cache.activeNode = activeNode;
+    cache.version = version;
+    cache.viewTransform = viewTransform;
+    cache.buffer->clear();
+    return false;
+}
+
+void Editor::compositeCache(CompositeCache &cache)
+{
+    if (!compositeProgram) {
+        compositeProgram = new BufferProgram(RenderedWidget::format, false, Buffer::Format(), RenderedWidget::format, false, Buffer::Format(), 0, RenderManager::composeModeDefault);
+    }
+    Buffer *const dest = copyWidgetBuffer();
+    widgetBuffer->bindFramebuffer();
+    compositeProgram->render(cache.buffer, nullptr, Colour{}, viewportToClipTransform(widgetBuffer->size()), dest, nullptr, Colour{});
+}
+
+Buffer *Editor::copyWidgetBuffer()
+{
+    if (!widgetBufferCopy || widgetBufferCopy->size() != widgetBuffer->size()) {
+        qApp->workBufferManager.returnBuffer(widgetBufferCopy);
+        widgetBufferCopy = qApp->workBufferManager.takeBuffer(RenderedWidget::format, widgetBuffer->size());
+    }
+    widgetBufferCopy->copy(*widgetBuffer);
+    return widgetBufferCopy;
+}
+
+void Editor::updateEditingContext()
+{
+    syncFrame();
+    m_editingContext.update(*this);
+}
+
+void Editor::releaseCompositeCaches()
+{
+    for (CompositeCache *cache : {&belowCache, &aboveCache}) {
+        qApp->workBufferManager.returnBuffer(cache->buffer);
+        *cache = CompositeCache();
+    }
+}
+
 void Editor::setTransformTarget(const EditingContext::TransformTarget transformTarget)
 {
     if (m_editingContext.transformTarget != transformTarget) {
@@ -571,21 +902,23 @@ void Editor::setTransform(const Mat4 &transform)
 {
     if (this->cameraTransform != transform) {
         this->cameraTransform = transform;
+        viewChangeTimer.restart();
         emit transformChanged(this->cameraTransform);
-        update();
+        requestFrame();
     }
 }
 
 void Editor::updateContext()
 {
-    m_editingContext.update(*this);
+    updateEditingContext();
 
     Buffer *palette = nullptr;
     for (Node *node : m_editingContext.selectedNodes()) {
         const Traversal::State &state = m_editingContext.states().at(node);
-        if (state.palette) palette = state.palette;
+        if (state.palette) palette = state.palette.get();
     }
     emit paletteChanged(palette);
+    requestFrame();
 }
 
 } // namespace GfxPaint
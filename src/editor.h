@@ -4,6 +4,7 @@
 #include "renderedwidget.h"
 
 #include <QElapsedTimer>
+#include <QTimer>
 #include <QOpenGLShaderProgram>
 #include <QItemSelectionModel>
 #include <QUndoCommand>
@@ -12,6 +13,8 @@
 #include <tuple>
 #include <set>
 #include <deque>
+#include <memory>
+#include <vector>
 #include <valarray>
 
 #include "buffer.h"
@@ -119,6 +122,8 @@ public:
     virtual bool eventFilter(QObject *const watched, QEvent *const event) override;
     virtual bool event(QEvent *const event) override;
 
+    void requestSceneFrames();
+
     void updateWindowTitle();
     void setDocumentFilename(const QString &filename);
     void setDocumentModified(const bool modified = true);
@@ -130,6 +135,7 @@ public:
     EditingContext &editingContext() { return m_editingContext; }
 
     Buffer *getWidgetBuffer() { return RenderedWidget::widgetBuffer; }
+    OverlayBatcher &getOverlay() { return RenderedWidget::overlay; }
     const Mat4 &getViewportTransform() const { return viewportTransform; }
 
     void activeEditingContextUpdated();
@@ -307,13 +313,74 @@ signals:
     void composeModeChanged(const int composeMode);
 
 protected:
+    struct CompositeCache {
+        Buffer *buffer = nullptr;
+        Node *activeNode = nullptr;
+        quint64 version = 0;
+        Mat4 viewTransform;
+    };
+
+    // Scene as composited in the previous frame, before any previews
+    struct SceneFrame {
+        Buffer *buffer = nullptr;
+        Mat4 cameraTransform;
+        quint64 version = 0;
+        bool valid = false;
+    };
+
+    // Editor state a frame reads, copied when it's prepared
+    struct FrameState {
+        Tool *previewTool = nullptr;
+        int previewMode = 0;
+        bool previewIsActive = false;
+        bool cursorOver = false;
+        bool viewInteraction = false;
+        Mat4 cameraTransform;
+    };
+
     void init();
+    void prepareFrame() override;
     void render() override;
+    void renderProfilerOverlay(const FrameProfiler::Frame &frame);
+    void frameFinished() override;
+    void replayPendingMoves();
+    bool scrollScene(const quint64 sceneVersion);
+    void storeSceneFrame(const quint64 sceneVersion, const bool valid);
+    bool viewInteraction() const;
+    bool renderReducedScene();
+    void renderScene();
+    bool updateCompositeCache(CompositeCache &cache, Node *const activeNode, const quint64 version, const Mat4 &viewTransform);
+    void compositeCache(CompositeCache &cache);
+    // Widget buffer contents for composites blending over it, in a buffer kept between frames
+    Buffer *copyWidgetBuffer();
+    void releaseCompositeCaches();
+    // Rebuilds the editing context's restore buffers and tool programs, which frames share
+    void updateEditingContext();
 
     EditingContext m_editingContext;
+    // Snapshot of m_editingContext read by frames and written by the scene states they harvest
+    EditingContext frameContext;
+    FrameState frameState;
 
     Mat4 cameraTransform;
 
+    CompositeCache belowCache;
+    CompositeCache aboveCache;
+    // Groups within the cached ranges, so a range is rebuilt from its unchanged groups
+    Scene::SubtreeCaches subtreeCaches;
+    BufferProgram *compositeProgram;
+    Buffer *widgetBufferCopy;
+    SceneFrame sceneFrame;
+
+    // Reduced resolution scene rendering while the view is changing
+    Buffer *reducedBuffer;
+    float reducedScale;
+    FrameProfiler::GpuTimer reducedFrameTimer;
+    // Scales of the frames timed and not yet read back
+    std::deque<float> reducedFrameScales;
+    QElapsedTimer viewChangeTimer;
+    QTimer refineTimer;
+
     InputState inputState;
     Vec2 cursorPos;
     Vec2 cursorDelta;
@@ -326,6 +393,10 @@ protected:
 
     std::deque<std::pair<InputState, EditingContext::ToolId>> selectedToolStack;
     std::deque<std::pair<InputState, EditingContext::ToolId>> activatedToolStack;
+
+    // Pointer moves arriving while a frame renders, handled together once it has finished
+    std::vector<std::unique_ptr<QEvent>> pendingMoves;
+    bool replayingMoves;
 };
 
 } // namespace GfxPaint
@@ -0,0 +1,324 @@
+#include "frameprofiler.h"
+
+#include <map>
+
+#include "application.h"
+
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+namespace GfxPaint {
+
+FrameProfiler::Scope::Scope(const char *const name) :
+    frame(0),
+    sample(qApp->renderManager.profiler.isEnabled() ? qApp->renderManager.profiler.begin(QString(name), frame) : -1)
+{
+}
+
+FrameProfiler::Scope::Scope(const char *const category, const QString &name) :
+    frame(0),
+    sample(qApp->renderManager.profiler.isEnabled() ? qApp->renderManager.profiler.begin(QString(category) + " " + name, frame) : -1)
+{
+}
+
+FrameProfiler::Scope::~Scope()
+{
+    if (sample >= 0) qApp->renderManager.profiler.end(frame, sample);
+}
+
+FrameProfiler::GpuTimer::GpuTimer() :
+    current{0, 0}, pending()
+{
+}
+
+FrameProfiler::GpuTimer::~GpuTimer()
+{
+    Q_ASSERT(!current[0] && pending.empty());
+}
+
+bool FrameProfiler::GpuTimer::begin()
+{
+    FrameProfiler &profiler = qApp->renderManager.profiler;
+    Q_ASSERT(!current[0]);
+    if (!profiler.queryCounter || QOpenGLContext::currentContext() != profiler.context) return false;
+    if (static_cast<int>(pending.size()) >= maxPendingFrames) return false;
+
+    QMutexLocker locker(&profiler.mutex);
+    current = {profiler.takeQuery(), profiler.takeQuery()};
+    profiler.queryCounter(current[0], GL_TIMESTAMP);
+    return true;
+}
+
+void FrameProfiler::GpuTimer::end()
+{
+    if (!current[0]) return;
+    qApp->renderManager.profiler.queryCounter(current[1], GL_TIMESTAMP);
+    pending.push_back(current);
+    current = {0, 0};
+}
+
+double FrameProfiler::GpuTimer::take()
+{
+    FrameProfiler &profiler = qApp->renderManager.profiler;
+    if (pending.empty() || QOpenGLContext::currentContext() != profiler.context) return -1.0;
+
+    const std::array<GLuint, 2> queries = pending.front();
+    GLuint available = 0;
+    profiler.context->extraFunctions()->glGetQueryObjectuiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return -1.0;
+
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    profiler.getQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+    profiler.getQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+    pending.pop_front();
+    QMutexLocker locker(&profiler.mutex);
+    profiler.freeQueries.insert(profiler.freeQueries.end(), queries.begin(), queries.end());
+    return (end - start) / 1.0e6;
+}
+
+void FrameProfiler::GpuTimer::release()
+{
+    FrameProfiler &profiler = qApp->renderManager.profiler;
+    QMutexLocker locker(&profiler.mutex);
+    if (current[0]) pending.push_back(current);
+    current = {0, 0};
+    for (const std::array<GLuint, 2> &queries : pending) {
+        profiler.freeQueries.insert(profiler.freeQueries.end(), queries.begin(), queries.end());
+    }
+    pending.clear();
+}
+
+FrameProfiler::FrameProfiler(QObject *const parent) :
+    QObject(parent),
+    context(nullptr),
+    queryCounter(nullptr), getQueryObjectui64v(nullptr),
+    clients(0), m_overlayShown(false),
+    mutex(), timer(),
+    frameStart(0), frameIndex(0),
+    samples(), queriedPasses(0),
+    pendingFrames(), freeQueries(),
+    previousCounts{}, previousStateCalls(0), previousProgramBinds(0),
+    m_lastFrame()
+{
+}
+
+FrameProfiler::~FrameProfiler()
+{
+    Q_ASSERT(freeQueries.empty());
+}
+
+void FrameProfiler::start(QOpenGLContext *const context)
+{
+    this->context = context;
+    timer.start();
+
+    // Core from 3.3, an extension on OpenGL ES
+    const bool supported = context->isOpenGLES() ? context->hasExtension("GL_EXT_disjoint_timer_query") :
+        (context->format().version() >= qMakePair(3, 3) || context->hasExtension("GL_ARB_timer_query"));
+    if (supported) {
+        queryCounter = reinterpret_cast<QueryCounterFunction>(context->getProcAddress(context->isOpenGLES() ? "glQueryCounterEXT" : "glQueryCounter"));
+        getQueryObjectui64v = reinterpret_cast<GetQueryObjectui64vFunction>(context->getProcAddress(context->isOpenGLES() ? "glGetQueryObjectui64vEXT" : "glGetQueryObjectui64v"));
+    }
+    if (!queryCounter || !getQueryObjectui64v) {
+        qDebug() << "Timer queries not supported, profiling CPU times only";
+        queryCounter = nullptr;
+        getQueryObjectui64v = nullptr;
+    }
+}
+
+void FrameProfiler::stop()
+{
+    if (!context) return;
+
+    QMutexLocker locker(&mutex);
+    std::vector<GLuint> queries = std::move(freeQueries);
+    freeQueries.clear();
+    const auto collect = [&queries](const std::vector<Sample> &samples){
+        for (const Sample &sample : samples) {
+            if (sample.queries[0]) queries.insert(queries.end(), sample.queries.begin(), sample.queries.end());
+        }
+    };
+    collect(samples);
+    for (const PendingFrame &pending : pendingFrames) {
+        collect(pending.samples);
+    }
+    samples.clear();
+    pendingFrames.clear();
+    if (!queries.empty()) context->extraFunctions()->glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+}
+
+void FrameProfiler::addClient()
+{
+    ++clients;
+}
+
+void FrameProfiler::removeClient()
+{
+    --clients;
+    Q_ASSERT(clients >= 0);
+}
+
+void FrameProfiler::setOverlayShown(const bool shown)
+{
+    if (shown == m_overlayShown) return;
+    m_overlayShown = shown;
+    if (shown) addClient();
+    else removeClient();
+}
+
+void FrameProfiler::endFrame()
+{
+    Q_ASSERT(QOpenGLContext::currentContext() == context);
+
+    bool reported = false;
+    {
+        QMutexLocker locker(&mutex);
+        if (!isEnabled() && samples.empty() && pendingFrames.empty()) return;
+
+        const qint64 now = timer.nsecsElapsed();
+        PendingFrame pending;
+        pending.samples = std::move(samples);
+        samples.clear();
+        pending.frame.intervalMs = (now - frameStart) / 1.0e6;
+        frameStart = now;
+        ++frameIndex;
+        queriedPasses = 0;
+
+        std::array<quint64, static_cast<int>(Counter::Count)> frameCounts;
+        for (int i = 0; i < static_cast<int>(Counter::Count); ++i) {
+            const quint64 total = counts[i].load(std::memory_order_relaxed);
+            frameCounts[i] = total - previousCounts[i];
+            previousCounts[i] = total;
+        }
+        pending.frame.textureCopies = frameCounts[static_cast<int>(Counter::TextureCopies)];
+        pending.frame.bytesMoved = frameCounts[static_cast<int>(Counter::BytesMoved)];
+        quint64 stateCalls = 0;
+        for (int i = 0; i < static_cast<int>(OpenGLState::Call::Count); ++i) {
+            stateCalls += OpenGLState::issuedCount(static_cast<OpenGLState::Call>(i));
+        }
+        const quint64 programBinds = OpenGLState::issuedCount(OpenGLState::Call::Program);
+        pending.frame.stateCalls = stateCalls - previousStateCalls;
+        pending.frame.programBinds = programBinds - previousProgramBinds;
+        previousStateCalls = stateCalls;
+        previousProgramBinds = programBinds;
+        pendingFrames.push_back(std::move(pending));
+
+        // Disjoint timing on OpenGL ES, e.g. after a power state change, invalidates every query in flight
+        bool disjoint = false;
+        if (queryCounter && context->isOpenGLES()) {
+            GLint value = 0;
+            context->extraFunctions()->glGetIntegerv(GL_GPU_DISJOINT_EXT, &value);
+            disjoint = value;
+        }
+        while (!pendingFrames.empty()) {
+            const bool available = !disjoint && queriesAvailable(pendingFrames.front());
+            if (!available && !disjoint && static_cast<int>(pendingFrames.size()) <= maxPendingFrames) break;
+            m_lastFrame = summarise(pendingFrames.front(), available);
+            pendingFrames.pop_front();
+            reported = true;
+        }
+    }
+    if (reported) emit frameProfiled();
+}
+
+FrameProfiler::Frame FrameProfiler::lastFrame() const
+{
+    QMutexLocker locker(&mutex);
+    return m_lastFrame;
+}
+
+int FrameProfiler::begin(const QString &name, quint64 &frame)
+{
+    QMutexLocker locker(&mutex);
+    frame = frameIndex;
+    if (static_cast<int>(samples.size()) >= maxPasses) return -1;
+    Sample sample{name, timer.nsecsElapsed(), -1, {0, 0}};
+    // Query objects aren't shared, so only passes in the render context are timed on the GPU
+    if (queryCounter && queriedPasses < maxQueriedPasses && QOpenGLContext::currentContext() == context) {
+        sample.queries = {takeQuery(), takeQuery()};
+        queryCounter(sample.queries[0], GL_TIMESTAMP);
+        ++queriedPasses;
+    }
+    samples.push_back(sample);
+    return static_cast<int>(samples.size()) - 1;
+}
+
+void FrameProfiler::end(const quint64 frame, const int sample)
+{
+    QMutexLocker locker(&mutex);
+    // Passes still running when their frame ended are left out
+    if (frame != frameIndex) return;
+
+    Sample &ended = samples[sample];
+    ended.cpuNs = timer.nsecsElapsed() - ended.cpuStart;
+    if (ended.queries[0]) {
+        if (QOpenGLContext::currentContext() == context) queryCounter(ended.queries[1], GL_TIMESTAMP);
+        else {
+            freeQueries.insert(freeQueries.end(), ended.queries.begin(), ended.queries.end());
+            ended.queries = {0, 0};
+        }
+    }
+}
+
+GLuint FrameProfiler::takeQuery()
+{
+    if (freeQueries.empty()) {
+        freeQueries.resize(32);
+        context->extraFunctions()->glGenQueries(static_cast<GLsizei>(freeQueries.size()), freeQueries.data());
+    }
+    const GLuint query = freeQueries.back();
+    freeQueries.pop_back();
+    return query;
+}
+
+bool FrameProfiler::queriesAvailable(const PendingFrame &pending) const
+{
+    QOpenGLExtraFunctions *const gl = context->extraFunctions();
+    for (const Sample &sample : pending.samples) {
+        if (!sample.queries[0] || sample.cpuNs < 0) continue;
+        GLuint available = 0;
+        gl->glGetQueryObjectuiv(sample.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return false;
+    }
+    return true;
+}
+
+FrameProfiler::Frame FrameProfiler::summarise(PendingFrame &pending, const bool gpuTimes)
+{
+    // Passes in order of first use, repeated passes summed
+    Frame frame = std::move(pending.frame);
+    std::map<QString, std::size_t> passIndices;
+    for (const Sample &sample : pending.samples) {
+        const bool finished = sample.cpuNs >= 0;
+        double gpuMs = -1.0;
+        if (sample.queries[0]) {
+            if (gpuTimes && finished) {
+                GLuint64 start = 0;
+                GLuint64 end = 0;
+                getQueryObjectui64v(sample.queries[0], GL_QUERY_RESULT, &start);
+                getQueryObjectui64v(sample.queries[1], GL_QUERY_RESULT, &end);
+                gpuMs = (end - start) / 1.0e6;
+            }
+            freeQueries.insert(freeQueries.end(), sample.queries.begin(), sample.queries.end());
+        }
+        if (!finished) continue;
+
+        auto found = passIndices.find(sample.name);
+        if (found == passIndices.end()) {
+            found = passIndices.insert({sample.name, frame.passes.size()}).first;
+            frame.passes.push_back({sample.name, 0, 0.0, -1.0});
+        }
+        Pass &pass = frame.passes[found->second];
+        ++pass.calls;
+        pass.cpuMs += sample.cpuNs / 1.0e6;
+        if (gpuMs >= 0.0) pass.gpuMs = std::max(pass.gpuMs, 0.0) + gpuMs;
+    }
+    return frame;
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,159 @@
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "opengl.h"
+
+namespace GfxPaint {
+
+// CPU and GPU times of named passes and GL work counters, per editor frame. Passes are timed with scopes, on the GPU
+// with timestamp queries in the render context that are read back frames later, so profiling never waits on the GPU.
+// Scopes cost a check of an atomic while nothing shows the results.
+class FrameProfiler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Counter {
+        TextureCopies,
+        BytesMoved,
+        Count,
+    };
+    // Frames waiting on query results, older ones are reported without GPU times
+    static constexpr int maxPendingFrames = 4;
+    // Passes timed on the GPU per frame, further passes only get CPU times
+    static constexpr int maxQueriedPasses = 256;
+    // Passes recorded per frame, bounding memory while only widgets without frames of their own render
+    static constexpr int maxPasses = 4096;
+
+    struct Pass {
+        QString name;
+        int calls;
+        double cpuMs;
+        // Negative when unknown, for passes outside the render context or frames dropped while waiting
+        double gpuMs;
+    };
+    struct Frame {
+        double intervalMs = 0.0;
+        std::vector<Pass> passes;
+        quint64 stateCalls = 0;
+        quint64 programBinds = 0;
+        quint64 textureCopies = 0;
+        quint64 bytesMoved = 0;
+    };
+
+    class Scope
+    {
+    public:
+        explicit Scope(const char *const name);
+        // Named after an object, e.g. a node, the name is only built while profiling
+        explicit Scope(const char *const category, const QString &name);
+        ~Scope();
+
+    private:
+        quint64 frame;
+        int sample;
+    };
+
+    // One span at a time timed on the GPU whether or not profiling runs, for policies adapting to GPU cost. Results
+    // are read back frames later, spans begun while maxPendingFrames are unread aren't timed.
+    class GpuTimer
+    {
+    public:
+        explicit GpuTimer();
+        ~GpuTimer();
+
+        // With the render context current, returns whether the span is timed
+        bool begin();
+        void end();
+        // Milliseconds of the oldest timed span once its result is available, negative otherwise
+        double take();
+        // With the render context current, before the timer is destroyed
+        void release();
+
+    private:
+        std::array<GLuint, 2> current;
+        std::deque<std::array<GLuint, 2>> pending;
+    };
+
+    explicit FrameProfiler(QObject *const parent = nullptr);
+    virtual ~FrameProfiler() override;
+
+    // With the render context current
+    void start(QOpenGLContext *const context);
+    void stop();
+
+    // Profiling runs while anything shows the results
+    void addClient();
+    void removeClient();
+    bool isEnabled() const { return clients > 0; }
+    bool overlayShown() const { return m_overlayShown; }
+    void setOverlayShown(const bool shown);
+
+    static void count(const Counter counter, const quint64 amount = 1) {
+        counts[static_cast<int>(counter)].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // Closes the current frame and reports finished ones, with the render context current
+    void endFrame();
+    Frame lastFrame() const;
+
+signals:
+    // Emitted from the thread ending frames
+    void frameProfiled();
+
+protected:
+    using QueryCounterFunction = void (QOPENGLF_APIENTRYP)(GLuint id, GLenum target);
+    using GetQueryObjectui64vFunction = void (QOPENGLF_APIENTRYP)(GLuint id, GLenum pname, GLuint64 *params);
+
+    struct Sample {
+        QString name;
+        qint64 cpuStart;
+        qint64 cpuNs;
+        std::array<GLuint, 2> queries;
+    };
+    struct PendingFrame {
+        std::vector<Sample> samples;
+        Frame frame;
+    };
+
+    int begin(const QString &name, quint64 &frame);
+    void end(const quint64 frame, const int sample);
+    GLuint takeQuery();
+    bool queriesAvailable(const PendingFrame &pending) const;
+    // Returns the queries of the frame to the pool
+    Frame summarise(PendingFrame &pending, const bool gpuTimes);
+
+    static inline std::array<std::atomic<quint64>, static_cast<int>(Counter::Count)> counts{};
+
+    QOpenGLContext *context;
+    QueryCounterFunction queryCounter;
+    GetQueryObjectui64vFunction getQueryObjectui64v;
+    std::atomic<int> clients;
+    bool m_overlayShown;
+
+    mutable QMutex mutex;
+    QElapsedTimer timer;
+    qint64 frameStart;
+    quint64 frameIndex;
+    std::vector<Sample> samples;
+    int queriedPasses;
+    std::deque<PendingFrame> pendingFrames;
+    std::vector<GLuint> freeQueries;
+    std::array<quint64, static_cast<int>(Counter::Count)> previousCounts;
+    quint64 previousStateCalls;
+    quint64 previousProgramBinds;
+    Frame m_lastFrame;
+};
+
+} // namespace GfxPaint
+
+#endif // FRAMEPROFILER_H
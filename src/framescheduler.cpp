@@ -0,0 +1,78 @@
+#include "framescheduler.h"
+
+#include <QGuiApplication>
+#include <QScreen>
+#include <QTimerEvent>
+#include <QWidget>
+#include <QWindow>
+#include <cmath>
+
+namespace GfxPaint {
+
+FrameScheduler::FrameScheduler(QObject *const parent) :
+    QObject(parent),
+    pendingWidgets(), frameTimer(), clock(), lastFrameTime(0), m_frameCount(0)
+{
+    clock.start();
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    frameTimer.stop();
+}
+
+void FrameScheduler::requestFrame(QWidget *const widget)
+{
+    pendingWidgets.insert(widget);
+    if (isAwake(widget)) schedule();
+}
+
+void FrameScheduler::cancelFrame(QWidget *const widget)
+{
+    pendingWidgets.remove(widget);
+}
+
+qint64 FrameScheduler::frameInterval() const
+{
+    const QScreen *const screen = QGuiApplication::primaryScreen();
+    const qreal refreshRate = screen && screen->refreshRate() > 0.0 ? screen->refreshRate() : 60.0;
+    return std::max<qint64>(1, std::lround(1000.0 / refreshRate));
+}
+
+void FrameScheduler::timerEvent(QTimerEvent *const event)
+{
+    if (event->timerId() == frameTimer.timerId()) {
+        // Requests made meanwhile join this pass instead of scheduling another
+        emit frameStarted();
+        frameTimer.stop();
+        lastFrameTime = clock.elapsed();
+        ++m_frameCount;
+        // Hidden, minimised or fully occluded widgets stay pending until requested again when shown
+        const QSet<QWidget *> widgets = pendingWidgets;
+        for (QWidget *const widget : widgets) {
+            if (isAwake(widget)) {
+                pendingWidgets.remove(widget);
+                widget->update();
+            }
+        }
+    }
+    else QObject::timerEvent(event);
+}
+
+bool FrameScheduler::isAwake(QWidget *const widget)
+{
+    if (!widget->isVisible() || widget->visibleRegion().isEmpty()) return false;
+    const QWindow *const window = widget->window()->windowHandle();
+    return window && window->isExposed() && !(window->windowStates() & Qt::WindowMinimized);
+}
+
+void FrameScheduler::schedule()
+{
+    if (!frameTimer.isActive()) {
+        // Align to the display refresh so all widgets dirtied within a frame repaint together
+        const qint64 delay = std::max<qint64>(0, lastFrameTime + frameInterval() - clock.elapsed());
+        frameTimer.start(static_cast<int>(delay), Qt::PreciseTimer, this);
+    }
+}
+
+} // namespace GfxPaint
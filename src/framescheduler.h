@@ -0,0 +1,47 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QBasicTimer>
+#include <QElapsedTimer>
+#include <QSet>
+
+class QWidget;
+
+namespace GfxPaint {
+
+// Coalesces frame requests from rendered widgets into one repaint pass per display refresh
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FrameScheduler(QObject *const parent = nullptr);
+    virtual ~FrameScheduler() override;
+
+    void requestFrame(QWidget *const widget);
+    void cancelFrame(QWidget *const widget);
+
+    qint64 frameInterval() const;
+    qint64 frameCount() const { return m_frameCount; }
+
+signals:
+    // Emitted before each repaint pass, widgets showing state changed by others' frames request theirs here
+    void frameStarted();
+
+protected:
+    virtual void timerEvent(QTimerEvent *const event) override;
+
+    static bool isAwake(QWidget *const widget);
+    void schedule();
+
+    QSet<QWidget *> pendingWidgets;
+    QBasicTimer frameTimer;
+    QElapsedTimer clock;
+    qint64 lastFrameTime;
+    qint64 m_frameCount;
+};
+
+} // namespace GfxPaint
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,120 @@
+#include "globjectregistry.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <iterator>
+
+namespace GfxPaint {
+
+GLObjectRegistry::OwnerScope::OwnerScope(const char *const category, const QString &name) :
+    previousCategory(ownerCategory), previousName(ownerName)
+{
+    ownerCategory = category;
+    ownerName = name;
+}
+
+GLObjectRegistry::OwnerScope::~OwnerScope()
+{
+    ownerCategory = previousCategory;
+    ownerName = previousName;
+}
+
+const char *GLObjectRegistry::typeName(const Type type)
+{
+    static const char *const names[] = {"Texture", "Depth/stencil", "Framebuffer", "Vertex array", "Vertex buffer", "Index buffer", "Indirect buffer", "Uniform buffer", "Storage buffer", "Stream buffer", "Program"};
+    static_assert(std::size(names) == static_cast<std::size_t>(Type::Count));
+    return names[static_cast<int>(type)];
+}
+
+void GLObjectRegistry::add(const Type type, const GLuint name, const qint64 bytes)
+{
+    if (!name) return;
+    Object object{type, name, bytes, currentOwner()};
+    QMutexLocker locker(&mutex);
+    // A name still registered was deleted behind the registry's back and reused by the driver
+    registry.insert_or_assign(key(type, name), std::move(object));
+    m_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GLObjectRegistry::remove(const Type type, const GLuint name)
+{
+    if (!name) return;
+    QMutexLocker locker(&mutex);
+    if (registry.erase(key(type, name))) m_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<GLObjectRegistry::Object> GLObjectRegistry::objects()
+{
+    std::vector<Object> objects;
+    QMutexLocker locker(&mutex);
+    objects.reserve(registry.size());
+    for (const auto &[key, object] : registry) {
+        objects.push_back(object);
+    }
+    return objects;
+}
+
+std::array<GLObjectRegistry::Total, static_cast<int>(GLObjectRegistry::Type::Count)> GLObjectRegistry::totals()
+{
+    std::array<Total, static_cast<int>(Type::Count)> totals{};
+    QMutexLocker locker(&mutex);
+    for (const auto &[key, object] : registry) {
+        Total &total = totals[static_cast<int>(object.type)];
+        ++total.count;
+        total.bytes += object.bytes;
+    }
+    return totals;
+}
+
+int GLObjectRegistry::reportLeaks()
+{
+    // Grouped by type and owner, a leak usually repeats once per frame or per edit
+    std::map<std::pair<Type, QString>, Total> groups;
+    for (const Object &object : objects()) {
+        Total &total = groups[{object.type, object.owner}];
+        ++total.count;
+        total.bytes += object.bytes;
+    }
+    int count = 0;
+    for (const auto &[group, total] : groups) {
+        const auto &[type, owner] = group;
+        qDebug().nospace() << "GL objects leaked: " << total.count << " " << typeName(type) << " (" << total.bytes / 1024 << " KiB) owned by " << (owner.isEmpty() ? QString("-") : owner);
+        count += total.count;
+    }
+    if (count == 0) qDebug() << "GL objects leaked: none";
+    return count;
+}
+
+GLObjectRegistry::Kind GLObjectRegistry::kind(const Type type)
+{
+    switch (type) {
+    case Type::Texture:
+    case Type::DepthStencil:
+        return Kind::Texture;
+    case Type::Framebuffer:
+        return Kind::Framebuffer;
+    case Type::VertexArray:
+        return Kind::VertexArray;
+    case Type::Program:
+        return Kind::Program;
+    default:
+        return Kind::Buffer;
+    }
+}
+
+GLObjectRegistry::Key GLObjectRegistry::key(const Type type, const GLuint name)
+{
+    const Kind kind = GLObjectRegistry::kind(type);
+    // Container objects aren't shared, the same name can exist in each context
+    const bool perContext = kind == Kind::Framebuffer || kind == Kind::VertexArray;
+    return {kind, perContext ? QOpenGLContext::currentContext() : nullptr, name};
+}
+
+QString GLObjectRegistry::currentOwner()
+{
+    if (!ownerCategory) return QString();
+    if (ownerName.isEmpty()) return QString(ownerCategory);
+    return QString("%1 %2").arg(ownerCategory, ownerName);
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,95 @@
+#ifndef GLOBJECTREGISTRY_H
+#define GLOBJECTREGISTRY_H
+
+#include <QMutex>
+#include <QString>
+#include <array>
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <qopengl.h>
+
+namespace GfxPaint {
+
+// Every GL object created through the GL wrappers with its size and owner, for the GL objects dock and a leak report
+// at shutdown. Framebuffers and vertex arrays belong to the context they were made in, other objects are shared.
+class GLObjectRegistry
+{
+public:
+    enum class Type {
+        Texture,
+        DepthStencil,
+        Framebuffer,
+        VertexArray,
+        VertexBuffer,
+        IndexBuffer,
+        IndirectBuffer,
+        UniformBuffer,
+        StorageBuffer,
+        StreamBuffer,
+        Program,
+        Count,
+    };
+
+    struct Object {
+        Type type;
+        GLuint name;
+        qint64 bytes;
+        QString owner;
+    };
+
+    struct Total {
+        int count = 0;
+        qint64 bytes = 0;
+    };
+
+    // Objects created on this thread while a scope is alive are attributed to it, inner scopes win
+    class OwnerScope
+    {
+    public:
+        explicit OwnerScope(const char *const category, const QString &name = QString());
+        ~OwnerScope();
+
+    private:
+        const char *const previousCategory;
+        const QString previousName;
+    };
+
+    static const char *typeName(const Type type);
+
+    static void add(const Type type, const GLuint name, const qint64 bytes = 0);
+    static void remove(const Type type, const GLuint name);
+
+    static std::vector<Object> objects();
+    static std::array<Total, static_cast<int>(Type::Count)> totals();
+    // Changes whenever an object is added or removed, so views only rebuild when something changed
+    static quint64 generation() { return m_generation.load(std::memory_order_relaxed); }
+    // Logs every object still registered, returns how many there were
+    static int reportLeaks();
+
+protected:
+    // GL names are unique per kind of object, the buffer types only tell what a buffer is used for
+    enum class Kind {
+        Texture,
+        Framebuffer,
+        VertexArray,
+        Buffer,
+        Program,
+    };
+    using Key = std::tuple<Kind, const void *, GLuint>;
+
+    static Kind kind(const Type type);
+    static Key key(const Type type, const GLuint name);
+    static QString currentOwner();
+
+    static inline QMutex mutex;
+    static inline std::map<Key, Object> registry;
+    static inline std::atomic<quint64> m_generation{0};
+    static inline thread_local const char *ownerCategory = nullptr;
+    static inline thread_local QString ownerName;
+};
+
+} // namespace GfxPaint
+
+#endif // GLOBJECTREGISTRY_H
@@ -0,0 +1,95 @@
+#include "globjectswidget.h"
+
+#include <QHeaderView>
+#include <QSplitter>
+#include <QVBoxLayout>
+#include <algorithm>
+
+#include "globjectregistry.h"
+
+namespace GfxPaint {
+
+GLObjectsWidget::GLObjectsWidget(QWidget *const parent) :
+    QWidget(parent),
+    summaryLabel(new QLabel(this)), totalsTable(new QTableWidget(0, 3, this)), objectsTable(new QTableWidget(0, 4, this)),
+    refreshTimer(), generation(0)
+{
+    QSplitter *const splitter = new QSplitter(Qt::Vertical, this);
+    splitter->addWidget(totalsTable);
+    splitter->addWidget(objectsTable);
+    QVBoxLayout *const layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(summaryLabel);
+    layout->addWidget(splitter);
+
+    summaryLabel->setWordWrap(true);
+    totalsTable->setHorizontalHeaderLabels({"Type", "Count", "KiB"});
+    objectsTable->setHorizontalHeaderLabels({"Type", "Name", "Owner", "KiB"});
+    totalsTable->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    objectsTable->horizontalHeader()->setSectionResizeMode(2, QHeaderView::Stretch);
+    for (QTableWidget *const table : {totalsTable, objectsTable}) {
+        table->verticalHeader()->hide();
+        table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+        table->setSelectionMode(QAbstractItemView::NoSelection);
+        table->setAlternatingRowColors(true);
+    }
+
+    refreshTimer.setInterval(refreshInterval);
+    QObject::connect(&refreshTimer, &QTimer::timeout, this, [this](){
+        if (GLObjectRegistry::generation() != generation) refresh();
+    });
+}
+
+void GLObjectsWidget::showEvent(QShowEvent *const event)
+{
+    QWidget::showEvent(event);
+    refresh();
+    refreshTimer.start();
+}
+
+void GLObjectsWidget::hideEvent(QHideEvent *const event)
+{
+    QWidget::hideEvent(event);
+    refreshTimer.stop();
+}
+
+void GLObjectsWidget::setRow(QTableWidget *const table, const int row, const QStringList &columns)
+{
+    for (int column = 0; column < columns.size(); ++column) {
+        QTableWidgetItem *item = table->item(row, column);
+        if (!item) {
+            item = new QTableWidgetItem();
+            table->setItem(row, column, item);
+        }
+        item->setText(columns[column]);
+    }
+}
+
+void GLObjectsWidget::refresh()
+{
+    generation = GLObjectRegistry::generation();
+    const auto totals = GLObjectRegistry::totals();
+    std::vector<GLObjectRegistry::Object> objects = GLObjectRegistry::objects();
+    std::sort(objects.begin(), objects.end(), [](const GLObjectRegistry::Object &a, const GLObjectRegistry::Object &b){
+        return a.bytes > b.bytes;
+    });
+
+    int count = 0;
+    qint64 bytes = 0;
+    totalsTable->setRowCount(static_cast<int>(totals.size()));
+    for (int row = 0; row < static_cast<int>(totals.size()); ++row) {
+        const GLObjectRegistry::Total &total = totals[row];
+        setRow(totalsTable, row, {GLObjectRegistry::typeName(static_cast<GLObjectRegistry::Type>(row)), QString::number(total.count), QString::number(total.bytes / 1024)});
+        count += total.count;
+        bytes += total.bytes;
+    }
+    summaryLabel->setText(QString("%1 GL objects, %2 MiB").arg(count).arg(bytes / (1024.0 * 1024.0), 0, 'f', 1));
+
+    objectsTable->setRowCount(static_cast<int>(objects.size()));
+    for (int row = 0; row < static_cast<int>(objects.size()); ++row) {
+        const GLObjectRegistry::Object &object = objects[row];
+        setRow(objectsTable, row, {GLObjectRegistry::typeName(object.type), QString::number(object.name), object.owner.isEmpty() ? QString("-") : object.owner, QString::number(object.bytes / 1024)});
+    }
+}
+
+} // namespace GfxPaint
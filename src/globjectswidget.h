@@ -0,0 +1,38 @@
+#ifndef GLOBJECTSWIDGET_H
+#define GLOBJECTSWIDGET_H
+
+#include <QLabel>
+#include <QTableWidget>
+#include <QTimer>
+#include <QWidget>
+
+namespace GfxPaint {
+
+// Live GL objects and memory per type, and every object with its owner, largest first
+class GLObjectsWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    // Registry changes are polled while shown, objects can be made on any thread
+    static constexpr int refreshInterval = 500;
+
+    explicit GLObjectsWidget(QWidget *const parent = nullptr);
+
+protected:
+    virtual void showEvent(QShowEvent *const event) override;
+    virtual void hideEvent(QHideEvent *const event) override;
+
+    static void setRow(QTableWidget *const table, const int row, const QStringList &columns);
+    void refresh();
+
+    QLabel *summaryLabel;
+    QTableWidget *totalsTable;
+    QTableWidget *objectsTable;
+    QTimer refreshTimer;
+    quint64 generation;
+};
+
+} // namespace GfxPaint
+
+#endif // GLOBJECTSWIDGET_H
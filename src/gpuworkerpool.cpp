@@ -0,0 +1,81 @@
+#include "gpuworkerpool.h"
+
+namespace GfxPaint {
+
+GpuWorkerPool::GpuWorkerPool(QObject *const parent) :
+    QObject(parent),
+    renderThread(nullptr), shareContext(nullptr), shareSurface(nullptr),
+    workers()
+{
+}
+
+GpuWorkerPool::~GpuWorkerPool()
+{
+    Q_ASSERT(workers.empty());
+}
+
+void GpuWorkerPool::start(RenderThread *const renderThread, QOpenGLContext *const shareContext, QOffscreenSurface *const shareSurface, const int workerCount)
+{
+    this->renderThread = renderThread;
+    this->shareContext = shareContext;
+    this->shareSurface = shareSurface;
+
+    for (int i = 0; i < workerCount; ++i) {
+        // Surfaces and contexts have to be created on the main thread, each context is then only used by its worker
+        auto worker = std::make_unique<Worker>();
+        worker->surface.setFormat(shareContext->format());
+        worker->surface.create();
+        worker->context = new QOpenGLContext();
+        worker->context->setFormat(shareContext->format());
+        worker->context->setShareContext(shareContext);
+        if (!worker->context->create()) {
+            qDebug() << "GPU worker context creation failed";
+            delete worker->context;
+            worker->surface.destroy();
+            break;
+        }
+
+        worker->object = new QObject();
+        worker->object->moveToThread(&worker->thread);
+        worker->context->moveToThread(&worker->thread);
+        QOpenGLContext *const context = worker->context;
+        QObject::connect(&worker->thread, &QThread::finished, worker->object, [context](){
+            context->doneCurrent();
+        });
+        worker->thread.setObjectName(QString("GPU worker %1").arg(i));
+        worker->thread.start();
+        workers.push_back(std::move(worker));
+    }
+    if (workers.empty()) qDebug() << "No GPU workers, running jobs on the render thread";
+}
+
+void GpuWorkerPool::stop()
+{
+    for (const auto &worker : workers) {
+        worker->thread.quit();
+        worker->thread.wait();
+        delete worker->object;
+        delete worker->context;
+        worker->surface.destroy();
+    }
+    workers.clear();
+}
+
+GpuWorkerPool::Worker *GpuWorkerPool::leastBusy() const
+{
+    Worker *best = nullptr;
+    for (const auto &worker : workers) {
+        if (!best || worker->queued < best->queued) best = worker.get();
+    }
+    return best;
+}
+
+GLsync GpuWorkerPool::fence()
+{
+    QOpenGLExtraFunctions *const gl = QOpenGLContext::currentContext()->extraFunctions();
+    const GLsync sync = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glFlush();
+    return sync;
+}
+
+} // namespace GfxPaint
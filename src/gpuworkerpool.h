@@ -0,0 +1,109 @@
+#ifndef GPUWORKERPOOL_H
+#define GPUWORKERPOOL_H
+
+#include <QFuture>
+#include <QObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QPromise>
+#include <QThread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "opengl.h"
+#include "renderthread.h"
+
+namespace GfxPaint {
+
+// What a pool job made along with a fence signalled once its GPU work is done. Objects made by the job are only
+// complete for other contexts after they wait on the fence, which is done on the GPU so the CPU isn't held up.
+template<typename Result>
+struct GpuResult {
+    Result value;
+    GLsync fence = nullptr;
+
+    // Called in the context using the result, once
+    Result &wait() {
+        if (fence) {
+            QOpenGLExtraFunctions *const gl = QOpenGLContext::currentContext()->extraFunctions();
+            gl->glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+            gl->glDeleteSync(fence);
+            fence = nullptr;
+        }
+        return value;
+    }
+};
+
+// Worker threads each with their own context sharing objects with the render context, for GPU work such as
+// uploads and readbacks that would otherwise be serialised with interactive rendering
+class GpuWorkerPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int defaultWorkerCount = 2;
+
+    explicit GpuWorkerPool(QObject *const parent = nullptr);
+    virtual ~GpuWorkerPool() override;
+
+    // Workers whose context can't be created are left out, with no workers at all jobs run on the render thread and
+    // the submitting thread waits for them, so the render context is never bound off the thread that owns it
+    void start(RenderThread *const renderThread, QOpenGLContext *const shareContext, QOffscreenSurface *const shareSurface, const int workerCount = defaultWorkerCount);
+    void stop();
+    int workerCount() const { return static_cast<int>(workers.size()); }
+
+    // Jobs go to the worker with the fewest queued, so a long job doesn't hold up others
+    template<typename Result>
+    QFuture<GpuResult<Result>> submit(const std::function<Result()> &job)
+    {
+        static_assert(!std::is_void_v<Result>, "Jobs return what they made");
+
+        const auto promise = std::make_shared<QPromise<GpuResult<Result>>>();
+        QFuture<GpuResult<Result>> future = promise->future();
+        promise->start();
+
+        Worker *const worker = leastBusy();
+        if (!worker) {
+            promise->addResult(GpuResult<Result>{renderThread->run(job), nullptr});
+            promise->finish();
+            return future;
+        }
+
+        ++worker->queued;
+        QMetaObject::invokeMethod(worker->object, [worker, promise, job](){
+            if (QOpenGLContext::currentContext() != worker->context) worker->context->makeCurrent(&worker->surface);
+
+            Result result = job();
+            promise->addResult(GpuResult<Result>{std::move(result), fence()});
+            promise->finish();
+            --worker->queued;
+        }, Qt::QueuedConnection);
+        return future;
+    }
+
+protected:
+    struct Worker {
+        QThread thread;
+        QOffscreenSurface surface;
+        QOpenGLContext *context = nullptr;
+        QObject *object = nullptr;
+        std::atomic<int> queued{0};
+    };
+
+    Worker *leastBusy() const;
+    // Fences the job's commands and flushes them so contexts waiting on the fence can't wait forever
+    static GLsync fence();
+
+    RenderThread *renderThread;
+    QOpenGLContext *shareContext;
+    QOffscreenSurface *shareSurface;
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+} // namespace GfxPaint
+
+#endif // GPUWORKERPOOL_H
@@ -10,6 +10,11 @@
 #include <QProgressDialog>
 #include <QFileDialog>
 #include <QProgressBar>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QToolButton>
+#include <QPointer>
+#include <memory>
 
 #include "newbufferdialog.h"
 #include "application.h"
@@ -17,6 +22,8 @@
 #include "multitoolbutton.h"
 #include "utils.h"
 #include "editor.h"
+#include "asynctask.h"
+#include "tracer.h"
 
 namespace GfxPaint {
 
@@ -126,6 +133,25 @@ MainWindow::MainWindow(QWidget *const parent, const Qt::WindowFlags flags)
     QObject::connect(ui->actionShowMenuBar, &QAction::toggled, ui->menuBar, &QMenuBar::setVisible);
     QObject::connect(ui->actionShowStatusBar, &QAction::toggled, ui->statusBar, &QStatusBar::setVisible);
 
+    ui->actionComputeCompositor->setChecked(qApp->renderManager.compositor == RenderManager::Compositor::Compute);
+    QObject::connect(ui->actionComputeCompositor, &QAction::toggled, this, [this](const bool checked){
+        qApp->renderManager.compositor = (checked ? RenderManager::Compositor::Compute : RenderManager::Compositor::DrawPerLayer);
+        for (Editor *const editor : editorSubWindows.keys()) editor->requestFrame();
+    });
+    ui->actionRecordTrace->setChecked(Tracer::isEnabled());
+    QObject::connect(ui->actionRecordTrace, &QAction::toggled, this, [](const bool checked){
+        Tracer::setEnabled(checked);
+    });
+    QObject::connect(ui->actionSaveTrace, &QAction::triggered, this, [this](){
+        const QString filename = QFileDialog::getSaveFileName(this, "Save Trace", QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation), "Trace files (*.json)");
+        if (!filename.isEmpty() && !Tracer::save(filename)) QMessageBox::warning(this, "Save Trace", QString("Couldn't write %1.").arg(filename));
+    });
+    ui->actionProfilerOverlay->setChecked(qApp->renderManager.profiler.overlayShown());
+    QObject::connect(ui->actionProfilerOverlay, &QAction::toggled, this, [this](const bool checked){
+        qApp->renderManager.profiler.setOverlayShown(checked);
+        for (Editor *const editor : editorSubWindows.keys()) editor->requestFrame();
+    });
+
     const QList<QAction *> pixelRatiosActions = {
         ui->actionActualPixelRatio, ui->actionNearestIntegerPixelRatio, ui->actionSquarePixelRatio
     };
@@ -801,11 +827,50 @@ void MainWindow::buildNodesMenu()
                     const QString path = settings.value("file/openPath", QStandardPaths::writableLocation(QStandardPaths::PicturesLocation)).toString();
                     const QStringList filenames = QFileDialog::getOpenFileNames(this, "Open File", path, Application::openImageFilters());
                     if (!filenames.isEmpty()) {
-                        QList<Node *> nodes;
-                        for (const auto &filename : filenames) {
-                            nodes.append(nodeInfo.createFromFile(filename));
-                        }
-                        activeEditor->insertNodes(nodes);
+                        // Decoded on the thread pool and uploaded by GPU workers so large images don't freeze the window or
+                        // stall rendering, the render thread only waits on the uploads' fences
+                        struct Loaded {
+                            ImageUpload upload;
+                            Colour transparent;
+                            Node *node;
+                        };
+                        const auto loaded = std::make_shared<std::vector<Loaded>>();
+                        const QPointer<Editor> editor = activeEditor;
+                        AsyncTask *const task = new AsyncTask("Adding " + nodeInfo.label + " nodes");
+                        task->then(AsyncTask::Stage::Cpu, [filenames, loaded](AsyncTask &task){
+                            for (int i = 0; i < filenames.length() && !task.isCancelled(); ++i) {
+                                task.setProgress(i, filenames.length());
+                                Colour transparent;
+                                const QImage image = imageFromFile(filenames[i], &transparent);
+                                loaded->push_back({uploadImage(image), transparent, nullptr});
+                            }
+                            // Waited for here rather than in the GPU stage so the render thread doesn't block on workers
+                            for (Loaded &item : *loaded) {
+                                if (item.upload.texture.isValid()) item.upload.texture.waitForFinished();
+                            }
+                        }).then(AsyncTask::Stage::Gpu, [nodeInfo, loaded](AsyncTask &){
+                            for (Loaded &item : *loaded) {
+                                item.node = nodeInfo.createFromUpload(item.upload, item.transparent);
+                                // Scenes are only used on the main thread
+                                if (item.node) item.node->moveToThread(qApp->thread());
+                            }
+                        }).then(AsyncTask::Stage::Main, [editor, loaded](AsyncTask &){
+                            QList<Node *> nodes;
+                            for (Loaded &item : *loaded) {
+                                if (item.node) nodes.append(item.node);
+                                item.node = nullptr;
+                            }
+                            if (editor) editor->insertNodes(nodes);
+                            else qDeleteAll(nodes);
+                        });
+                        // Uploads and nodes made before the task was cancelled
+                        QObject::connect(task, &AsyncTask::finished, qApp, [loaded](){
+                            for (Loaded &item : *loaded) {
+                                discardUpload(item.upload);
+                                delete item.node;
+                            }
+                        });
+                        addTask(task);
                         settings.setValue("file/openPath", QFileInfo(filenames.last()).path());
                     }
                 }
@@ -829,6 +894,31 @@ void MainWindow::buildNodesMenu()
     });
 }
 
+void MainWindow::addTask(AsyncTask *const task)
+{
+    // Shown in the status bar with progress and a cancel button until the task is done
+    QWidget *const taskWidget = new QWidget(ui->statusBar);
+    QHBoxLayout *const layout = new QHBoxLayout(taskWidget);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(new QLabel(task->name, taskWidget));
+    QProgressBar *const progressBar = new QProgressBar(taskWidget);
+    progressBar->setRange(0, 0);
+    progressBar->setMaximumWidth(160);
+    layout->addWidget(progressBar);
+    QToolButton *const cancelButton = new QToolButton(taskWidget);
+    cancelButton->setText("Cancel");
+    layout->addWidget(cancelButton);
+    ui->statusBar->addPermanentWidget(taskWidget);
+
+    QObject::connect(task, &AsyncTask::progressChanged, progressBar, [progressBar](const int value, const int maximum){
+        progressBar->setRange(0, maximum);
+        progressBar->setValue(value);
+    });
+    QObject::connect(cancelButton, &QToolButton::clicked, task, &AsyncTask::cancel);
+    QObject::connect(task, &AsyncTask::finished, taskWidget, &QObject::deleteLater);
+    task->start();
+}
+
 void MainWindow::filesViewContextMenu(const QPoint &pos)
 {
 //    const QPoint globalPos = ui->documentsView->mapToGlobal(pos);
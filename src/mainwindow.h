@@ -16,6 +16,7 @@ namespace GfxPaint {
 
 class Application;
 class Scene;
+class AsyncTask;
 
 namespace Ui {
 class MainWindow;
@@ -57,6 +58,9 @@ public:
     void moveEditor(MainWindow *const other, Editor *const editor);
     void deleteEditor(Editor *const editor);
 
+    // Takes ownership and starts the task
+    void addTask(AsyncTask *const task);
+
 public slots:
     void activateDocument(GfxPaint::Scene *const document);
     void activateDocumentManagerIndex(const QModelIndex &index);
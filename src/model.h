@@ -10,8 +10,13 @@ public:
     Model(const GLenum primitive, const std::vector<GLsizei> &attributeSizes, const std::vector<GLfloat> &vertices, const std::vector<GLushort> &indices, const std::vector<GLushort> &elementSizes) :
         OpenGL(true),
         primitive(primitive), elementCount(elementSizes.size()),
-        vao(0), vertexBuffer(0), elementBuffer(0), indirectBuffer(0)
+        vao(0), vertexBuffer(0), elementBuffer(0), indirectBuffer(0),
+        multiDrawElementsIndirect(nullptr)
     {
+        // Core from 4.3, an extension on OpenGL ES
+        QOpenGLContext *const context = QOpenGLContext::currentContext();
+        multiDrawElementsIndirect = reinterpret_cast<MultiDrawElementsIndirectFunction>(context->getProcAddress(context->isOpenGLES() ? "glMultiDrawElementsIndirectEXT" : "glMultiDrawElementsIndirect"));
+
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vertexBuffer);
         glGenBuffers(1, &elementBuffer);
@@ -46,9 +51,18 @@ public:
             command.baseInstance = 0;
         }
         glBufferData(GL_DRAW_INDIRECT_BUFFER, elementCount * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+
+        GLObjectRegistry::add(GLObjectRegistry::Type::VertexArray, vao);
+        GLObjectRegistry::add(GLObjectRegistry::Type::VertexBuffer, vertexBuffer, static_cast<qint64>(vertexCount) * vertexStride);
+        GLObjectRegistry::add(GLObjectRegistry::Type::IndexBuffer, elementBuffer, static_cast<qint64>(indices.size() * sizeof(GLushort)));
+        GLObjectRegistry::add(GLObjectRegistry::Type::IndirectBuffer, indirectBuffer, static_cast<qint64>(elementCount * sizeof(DrawElementsIndirectCommand)));
     }
 
     virtual ~Model() override {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::IndirectBuffer, indirectBuffer);
+        GLObjectRegistry::remove(GLObjectRegistry::Type::IndexBuffer, elementBuffer);
+        GLObjectRegistry::remove(GLObjectRegistry::Type::VertexBuffer, vertexBuffer);
+        GLObjectRegistry::remove(GLObjectRegistry::Type::VertexArray, vao);
         glDeleteBuffers(1, &indirectBuffer);
         glDeleteBuffers(1, &elementBuffer);
         glDeleteBuffers(1, &vertexBuffer);
@@ -58,13 +72,19 @@ public:
     void render() {
         glBindVertexArray(vao);
         glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
-//        glMultiDrawElementsIndirect(primitive, GL_UNSIGNED_SHORT, nullptr, elementCount, sizeof(DrawElementsIndirectCommand));
-        for (int i = 0; i < elementCount; ++i) {
-            glDrawElementsIndirect(primitive, GL_UNSIGNED_SHORT, (void *)(i * sizeof(DrawElementsIndirectCommand)));
+        if (multiDrawElementsIndirect) {
+            multiDrawElementsIndirect(primitive, GL_UNSIGNED_SHORT, nullptr, elementCount, sizeof(DrawElementsIndirectCommand));
+        }
+        else {
+            for (int i = 0; i < elementCount; ++i) {
+                glDrawElementsIndirect(primitive, GL_UNSIGNED_SHORT, (void *)(i * sizeof(DrawElementsIndirectCommand)));
+            }
         }
     }
 
 protected:
+    using MultiDrawElementsIndirectFunction = void (QOPENGLF_APIENTRYP)(GLenum, GLenum, const void *, GLsizei, GLsizei);
+
     struct DrawElementsIndirectCommand {
         GLuint count;
         GLuint instanceCount;
@@ -80,6 +100,7 @@ protected:
     GLuint vertexBuffer;
     GLuint elementBuffer;
     GLuint indirectBuffer;
+    MultiDrawElementsIndirectFunction multiDrawElementsIndirect;
 };
 
 } // namespace GfxPaint
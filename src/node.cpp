@@ -51,6 +51,7 @@ Mat4 SpatialNode::transform() const
 void SpatialNode::setTransform(const Mat4 &transform)
 {
     m_transform = transform;
+    touch();
 }
 
 Mat4 SpatialNode::combinedTransform() const
@@ -72,7 +73,8 @@ BufferNode::BufferNode(const Buffer &buffer, const bool indexed, const int blend
     SpatialNode(), AbstractBufferNode(buffer, indexed),
     blendMode(blendMode), composeMode(composeMode), transparent(transparent),
     pixelAspectRatio(pixelAspectRatio), scrollScale(scrollScale),
-    program(nullptr)
+    program(nullptr),
+    pyramid()
 {
 }
 
@@ -80,7 +82,8 @@ BufferNode::BufferNode(const BufferNode &other) :
     SpatialNode(other), AbstractBufferNode(other),
     blendMode(other.blendMode), composeMode(other.composeMode), transparent(other.transparent),
     pixelAspectRatio(other.pixelAspectRatio), scrollScale(other.scrollScale),
-    program(nullptr)
+    program(nullptr),
+    pyramid()
 {
 }
 
@@ -88,14 +91,21 @@ BufferNode::~BufferNode()
 {
     ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
     delete program;
+    pyramid.release();
 }
 
 Node *BufferNode::createFromFile(const QString &filename)
+{
+    Colour transparent;
+    ImageUpload upload = uploadImage(imageFromFile(filename, &transparent));
+    return createFromUpload(upload, transparent);
+}
+
+Node *BufferNode::createFromUpload(ImageUpload &upload, const Colour &transparent)
 {
     ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
     Buffer palette;
-    Colour transparent;
-    Buffer buffer = bufferFromImageFile(filename, &palette, &transparent);
+    Buffer buffer = bufferFromUpload(upload, &palette);
     if (!buffer.isNull()) {
         BufferNode *bufferNode = new BufferNode(buffer, !palette.isNull(), 0, RenderManager::composeModeDefault, transparent);
         if (!palette.isNull()) {
@@ -145,6 +155,8 @@ void BufferNode::afterChildren(Traversal &traversal)
 
 void BufferNode::render(Traversal &traversal)
 {
+    FrameProfiler::Scope profileScope("Composite", name);
+    const GLObjectRegistry::OwnerScope ownerScope("Node", name);
     if (!traversal.renderTargetStack.isEmpty()) {
         const Traversal::RenderTarget &renderTarget = traversal.renderTargetStack.top();
         Mat4 transform = traversal.transformStack.top();
@@ -154,13 +166,39 @@ void BufferNode::render(Traversal &traversal)
             palette = traversal.paletteStack.top();
             paletteFormat = palette->format();
         }
-        std::list<Program *> oldPrograms = {program};
-        program = new BufferProgram(buffer.format(), indexed, paletteFormat, renderTarget.buffer->format(), renderTarget.indexed, renderTarget.palette ? renderTarget.palette->format() : Buffer::Format(), 0, 3);
-        oldPrograms.clear();
-        // TODO: don't recreate copy buffer every render
-        Buffer renderTargetCopy(*renderTarget.buffer);
-        renderTarget.buffer->bindFramebuffer();
-        program->render(&buffer, palette, transparent, renderTarget.transform * transform, &renderTargetCopy, renderTarget.palette, Colour{});
+        const Mat4 worldToClip = renderTarget.transform * transform;
+        // Same modes as drawn below
+        if (traversal.compositor && ComputeCompositor::accepts(indexed, renderTarget.buffer->format(), renderTarget.indexed)) {
+            traversal.compositor->add({&buffer, worldToClip, 0, RenderManager::composeModeDefault}, renderTarget.buffer, renderTarget.scissor);
+            return;
+        }
+        // Keep layer order when falling back to drawing
+        if (traversal.compositor) traversal.compositor->flush();
+        // Zoomed out direct colour buffers are drawn from a downsampled level, indices can't be averaged
+        // Atlas buffers are small and their pyramid would need their atlas origin
+        const bool usePyramid = !indexed && !buffer.atlasPage();
+        const int pyramidLevel = usePyramid ? BufferPyramid::level(BufferPyramid::transformScale(worldToClip, renderTarget.buffer->size()), buffer.size()) : 0;
+        // Consecutive nodes sharing this buffer or its atlas page are drawn together, same modes as drawn below
+        if (traversal.batcher && BufferBatcher::accepts(buffer, pyramidLevel)) {
+            traversal.batcher->add({buffer.texture(), buffer.format(), indexed, palette, transparent, 0, 3, renderTarget.buffer, renderTarget.indexed, renderTarget.palette, renderTarget.scissor}, &buffer, worldToClip);
+            return;
+        }
+        if (traversal.batcher) traversal.batcher->flush();
+        const GLuint pyramidTexture = pyramid.update(buffer, pyramidLevel);
+        // Replaced before the old one is deleted so a shared GL program with the same key stays linked
+        BufferProgram *const oldProgram = program;
+        program = new BufferProgram(buffer.format(), indexed, paletteFormat, renderTarget.buffer->format(), renderTarget.indexed, renderTarget.palette ? renderTarget.palette->format() : Buffer::Format(), 0, 3, usePyramid);
+        delete oldProgram;
+        // Only the scissored part of the target is drawn to, so only that part of the pooled copy is read
+        const QRect scissor = !renderTarget.scissor.isNull() ? renderTarget.scissor.intersected(renderTarget.buffer->rect()) : renderTarget.buffer->rect();
+        Buffer *const renderTargetCopy = qApp->workBufferManager.takeBuffer(renderTarget.buffer->format(), renderTarget.buffer->size());
+        renderTargetCopy->copy(*renderTarget.buffer, scissor, scissor.topLeft());
+        renderTarget.buffer->bindFramebuffer(renderTarget.buffer->rect(), scissor);
+        if (program->isReady()) program->render(&buffer, palette, transparent, worldToClip, renderTargetCopy, renderTarget.palette, Colour{}, pyramidTexture, pyramidLevel);
+        // Same modes through the uber program until the specialised program is compiled in the background
+        else qApp->renderManager.bufferUberProgram(buffer.format(), paletteFormat, renderTarget.buffer->format(), renderTarget.palette ? renderTarget.palette->format() : Buffer::Format(), usePyramid, false)
+            ->render(&buffer, indexed, palette, transparent, worldToClip, renderTargetCopy, renderTarget.indexed, renderTarget.palette, Colour{}, 0, 3, pyramidTexture, pyramidLevel);
+        qApp->workBufferManager.returnBuffer(renderTargetCopy);
 //        program->render(&buffer, palette, transparent, renderTarget.transform * transform, renderTarget.buffer, renderTarget.palette, Colour{});
     }
 }
@@ -182,10 +220,16 @@ Node *PaletteNode::create()
 }
 
 Node *PaletteNode::createFromFile(const QString &filename)
+{
+    ImageUpload upload = uploadImage(imageFromFile(filename));
+    return createFromUpload(upload, Colour{});
+}
+
+Node *PaletteNode::createFromUpload(ImageUpload &upload, const Colour &)
 {
     ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
     Buffer palette;
-    Buffer buffer = bufferFromImageFile(filename, &palette);
+    Buffer buffer = bufferFromUpload(upload, &palette);
     if (!palette.isNull()) {
         return new PaletteNode(palette, false);
     }
@@ -8,10 +8,12 @@
 #include <QOpenGLTexture>
 #include <QOpenGLVertexArrayObject>
 #include <QFileInfo>
+#include <QImage>
 #include <QJsonObject>
 
 #include "types.h"
 #include "buffer.h"
+#include "bufferpyramid.h"
 #include "opengl.h"
 #include "program.h"
 #include "rendermanager.h"
@@ -36,14 +38,16 @@ public:
 
     explicit Node() :
         QObject(),
-        name(), enabled(true), locked(false), promoteChildren(false), parent(nullptr), children()
+        name(), enabled(true), locked(false), promoteChildren(false), parent(nullptr), children(),
+        m_version(nextVersion())
     {
         setProperty("objectName", name);
         setProperty("poop", "hello");
     }
     explicit Node(const Node &other) :
         QObject(),
-        name(other.name), enabled(other.enabled), locked(other.locked), promoteChildren(other.promoteChildren), parent(nullptr), children()
+        name(other.name), enabled(other.enabled), locked(other.locked), promoteChildren(other.promoteChildren), parent(nullptr), children(),
+        m_version(nextVersion())
     {}
     virtual ~Node() { for (auto child : children) delete child; }
 
@@ -96,6 +100,13 @@ public:
 
     virtual void beforeChildren(Traversal &traversal);
     virtual void afterChildren(Traversal &traversal);
+
+    // Must be called after changing anything that affects how the node renders
+    void touch() { m_version = nextVersion(); }
+    virtual quint64 contentVersion() const { return m_version; }
+
+protected:
+    quint64 m_version;
 };
 
 class SpatialNode : public Node
@@ -159,6 +170,7 @@ public:
     ~BufferNode();
 
     static Node *createFromFile(const QString &filename);
+    static Node *createFromUpload(ImageUpload &upload, const Colour &transparent);
     static Node *createFromDialog(QWidget *const parentWindow);
     virtual BufferNode *clone() const override;
 
@@ -174,6 +186,8 @@ public:
     virtual void beforeChildren(Traversal &traversal) override;
     virtual void afterChildren(Traversal &traversal) override;
 
+    virtual quint64 contentVersion() const override { return std::max(m_version, buffer.version()); }
+
     Mat4 pixelAspectRatioTransform() const {
         Mat4 transform;
         transform.scale(pixelAspectRatio.width(), pixelAspectRatio.height());
@@ -186,6 +200,8 @@ public:
 
 private:
     void render(Traversal &traversal);
+
+    BufferPyramid pyramid;
 };
 
 class PaletteNode : public Node, public AbstractBufferNode {
@@ -195,6 +211,7 @@ public:
 
     static Node *create();
     static Node *createFromFile(const QString &filename);
+    static Node *createFromUpload(ImageUpload &upload, const Colour &transparent);
     virtual PaletteNode *clone() const override;
 
     virtual QString typeName() const override { return "Palette"; }
@@ -206,6 +223,8 @@ public:
 
     virtual void beforeChildren(Traversal &traversal) override;
     virtual void afterChildren(Traversal &traversal) override;
+
+    virtual quint64 contentVersion() const override { return std::max(m_version, buffer.version()); }
 };
 
 class SamplerNode : public SpatialNode, public AbstractBufferNode {
@@ -219,6 +238,8 @@ public:
         info += QString("%1x%2").arg(buffer.size().width()).arg(buffer.size().height());
         return info;
     }
+
+    virtual quint64 contentVersion() const override { return std::max(m_version, buffer.version()); }
 };
 
 } // namespace GfxPaint
@@ -2,6 +2,7 @@
 
 #include <QOffscreenSurface>
 #include <QOpenGLContext>
+#include <iterator>
 
 #include "application.h"
 
@@ -12,4 +13,240 @@ void OpenGL::initialize()
     OpenGLFunctions::initializeOpenGLFunctions();
 }
 
+thread_local OpenGLState *OpenGLState::currentState = nullptr;
+
+void (*ContextBinder::reclaim)(QOpenGLContext *const context) = nullptr;
+
+OpenGLState::OpenGLState(QOpenGLContext *const context) :
+    QObject(context), OpenGL(true),
+    context(context),
+    knownDeletionGeneration(deletionGeneration.load(std::memory_order_relaxed)),
+    drawFramebuffer(), readFramebuffer(),
+    m_viewport(), m_scissor(), m_scissorTest(),
+    activeUnit(), textures(),
+    program()
+{
+    Q_ASSERT(QOpenGLContext::currentContext() == context);
+}
+
+OpenGLState::~OpenGLState()
+{
+    if (currentState == this) currentState = nullptr;
+}
+
+OpenGLState &OpenGLState::current()
+{
+    QOpenGLContext *const context = QOpenGLContext::currentContext();
+    Q_ASSERT(context);
+    if (currentState && currentState->context == context) return *currentState;
+
+    OpenGLState *state = context->findChild<OpenGLState *>(QString(), Qt::FindDirectChildrenOnly);
+    if (!state) state = new OpenGLState(context);
+    currentState = state;
+    return *state;
+}
+
+void OpenGLState::report()
+{
+    static const char *const names[] = {"makeCurrent", "framebuffer", "viewport", "scissor", "scissor test", "active texture", "texture", "program"};
+    static_assert(std::size(names) == static_cast<std::size_t>(Call::Count));
+    QDebug debug = qDebug().nospace();
+    debug << "GL state calls skipped:";
+    for (int i = 0; i < static_cast<int>(Call::Count); ++i) {
+        const Call call = static_cast<Call>(i);
+        debug << " " << names[i] << " " << skippedCount(call) << "/" << (issuedCount(call) + skippedCount(call));
+    }
+}
+
+void OpenGLState::deleteTextures(const GLsizei n, const GLuint *const textures)
+{
+    deletionGeneration.fetch_add(1, std::memory_order_relaxed);
+    for (GLsizei i = 0; i < n; ++i) {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::Texture, textures[i]);
+    }
+    QOpenGLContext::currentContext()->extraFunctions()->glDeleteTextures(n, textures);
+}
+
+void OpenGLState::deleteFramebuffers(const GLsizei n, const GLuint *const framebuffers)
+{
+    deletionGeneration.fetch_add(1, std::memory_order_relaxed);
+    for (GLsizei i = 0; i < n; ++i) {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::Framebuffer, framebuffers[i]);
+    }
+    QOpenGLContext::currentContext()->extraFunctions()->glDeleteFramebuffers(n, framebuffers);
+}
+
+void OpenGLState::invalidate()
+{
+    drawFramebuffer.reset();
+    readFramebuffer.reset();
+    m_viewport.reset();
+    m_scissor.reset();
+    m_scissorTest.reset();
+    activeUnit.reset();
+    for (auto &unitTextures : textures) {
+        unitTextures.fill(std::nullopt);
+    }
+    program.reset();
+}
+
+GLuint OpenGLState::framebuffer(const GLenum target)
+{
+    Q_ASSERT(target == GL_DRAW_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER);
+    forgetDeleted();
+    std::optional<GLuint> &binding = (target == GL_DRAW_FRAMEBUFFER ? drawFramebuffer : readFramebuffer);
+    if (!binding) {
+        GLint value = 0;
+        glGetIntegerv(target == GL_DRAW_FRAMEBUFFER ? GL_DRAW_FRAMEBUFFER_BINDING : GL_READ_FRAMEBUFFER_BINDING, &value);
+        binding = static_cast<GLuint>(value);
+    }
+    return *binding;
+}
+
+void OpenGLState::bindFramebuffer(const GLenum target, const GLuint framebuffer)
+{
+    forgetDeleted();
+    const bool draw = (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER);
+    const bool read = (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER);
+    const bool skipped = (!draw || drawFramebuffer == framebuffer) && (!read || readFramebuffer == framebuffer);
+    count(Call::Framebuffer, skipped);
+    if (skipped) return;
+    glBindFramebuffer(target, framebuffer);
+    if (draw) drawFramebuffer = framebuffer;
+    if (read) readFramebuffer = framebuffer;
+}
+
+QRect OpenGLState::viewport()
+{
+    if (!m_viewport) {
+        GLint value[4];
+        glGetIntegerv(GL_VIEWPORT, value);
+        m_viewport = QRect(value[0], value[1], value[2], value[3]);
+    }
+    return *m_viewport;
+}
+
+void OpenGLState::setViewport(const QRect &viewport)
+{
+    const bool skipped = (m_viewport == viewport);
+    count(Call::Viewport, skipped);
+    if (skipped) return;
+    glViewport(viewport.x(), viewport.y(), viewport.width(), viewport.height());
+    m_viewport = viewport;
+}
+
+QRect OpenGLState::scissor()
+{
+    if (!m_scissor) {
+        GLint value[4];
+        glGetIntegerv(GL_SCISSOR_BOX, value);
+        m_scissor = QRect(value[0], value[1], value[2], value[3]);
+    }
+    return *m_scissor;
+}
+
+void OpenGLState::setScissor(const QRect &scissor)
+{
+    const bool skipped = (m_scissor == scissor);
+    count(Call::Scissor, skipped);
+    if (skipped) return;
+    glScissor(scissor.x(), scissor.y(), scissor.width(), scissor.height());
+    m_scissor = scissor;
+}
+
+bool OpenGLState::scissorTest()
+{
+    if (!m_scissorTest) m_scissorTest = glIsEnabled(GL_SCISSOR_TEST);
+    return *m_scissorTest;
+}
+
+void OpenGLState::setScissorTest(const bool enabled)
+{
+    const bool skipped = (m_scissorTest == enabled);
+    count(Call::ScissorTest, skipped);
+    if (skipped) return;
+    if (enabled) glEnable(GL_SCISSOR_TEST);
+    else glDisable(GL_SCISSOR_TEST);
+    m_scissorTest = enabled;
+}
+
+void OpenGLState::activeTexture(const GLuint unit)
+{
+    const bool skipped = (activeUnit == unit);
+    count(Call::ActiveTexture, skipped);
+    if (skipped) return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    activeUnit = unit;
+}
+
+GLuint OpenGLState::texture(const GLenum target)
+{
+    forgetDeleted();
+    const int targetIndex = textureTargetIndex(target);
+    if (!activeUnit) {
+        GLint value = 0;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &value);
+        activeUnit = static_cast<GLuint>(value - GL_TEXTURE0);
+    }
+    std::optional<GLuint> *const binding = (targetIndex >= 0 && *activeUnit < maxTextureUnits) ? &textures[*activeUnit][targetIndex] : nullptr;
+    if (binding && *binding) return **binding;
+
+    GLenum targetBinding;
+    switch (target) {
+    case GL_TEXTURE_2D: targetBinding = GL_TEXTURE_BINDING_2D; break;
+    case GL_TEXTURE_RECTANGLE: targetBinding = GL_TEXTURE_BINDING_RECTANGLE; break;
+    case GL_TEXTURE_2D_ARRAY: targetBinding = GL_TEXTURE_BINDING_2D_ARRAY; break;
+    default:
+        qDebug() << "unhandled texture target";
+        targetBinding = GL_TEXTURE_BINDING_2D;
+    }
+    GLint value = 0;
+    glGetIntegerv(targetBinding, &value);
+    if (binding) *binding = static_cast<GLuint>(value);
+    return static_cast<GLuint>(value);
+}
+
+void OpenGLState::bindTexture(const GLenum target, const GLuint texture)
+{
+    forgetDeleted();
+    const int targetIndex = textureTargetIndex(target);
+    std::optional<GLuint> *const binding = (targetIndex >= 0 && activeUnit && *activeUnit < maxTextureUnits) ? &textures[*activeUnit][targetIndex] : nullptr;
+    const bool skipped = (binding && *binding == texture);
+    count(Call::Texture, skipped);
+    if (skipped) return;
+    glBindTexture(target, texture);
+    if (binding) *binding = texture;
+}
+
+void OpenGLState::useProgram(const GLuint program)
+{
+    const bool skipped = (this->program == program);
+    count(Call::Program, skipped);
+    if (skipped) return;
+    glUseProgram(program);
+    this->program = program;
+}
+
+int OpenGLState::textureTargetIndex(const GLenum target)
+{
+    switch (target) {
+    case GL_TEXTURE_2D: return 0;
+    case GL_TEXTURE_RECTANGLE: return 1;
+    case GL_TEXTURE_2D_ARRAY: return 2;
+    default: return -1;
+    }
+}
+
+void OpenGLState::forgetDeleted()
+{
+    const quint64 generation = deletionGeneration.load(std::memory_order_relaxed);
+    if (generation == knownDeletionGeneration) return;
+    knownDeletionGeneration = generation;
+    drawFramebuffer.reset();
+    readFramebuffer.reset();
+    for (auto &unitTextures : textures) {
+        unitTextures.fill(std::nullopt);
+    }
+}
+
 } // namespace GfxPaint
@@ -6,6 +6,11 @@
 #include <QStringList>
 #include <QDebug>
 #include <QThread>
+#include <array>
+#include <atomic>
+#include <optional>
+
+#include "globjectregistry.h"
 
 namespace GfxPaint {
 
@@ -26,15 +31,104 @@ public:
     void initialize();
 };
 
+// Last known binding state of one context, so binds that would change nothing are skipped and previous
+// state is restored without querying the driver. State changed outside the tracker must be invalidated.
+class OpenGLState : public QObject, protected OpenGL
+{
+    Q_OBJECT
+
+public:
+    enum class Call {
+        MakeCurrent,
+        Framebuffer,
+        Viewport,
+        Scissor,
+        ScissorTest,
+        ActiveTexture,
+        Texture,
+        Program,
+        Count,
+    };
+    static constexpr int maxTextureUnits = 32;
+
+    // Tracker of the current context, made on first use and deleted with the context
+    static OpenGLState &current();
+
+    // Counts over all contexts
+    static void count(const Call call, const bool skipped) {
+        (skipped ? skippedCounts : issuedCounts)[static_cast<int>(call)].fetch_add(1, std::memory_order_relaxed);
+    }
+    static quint64 issuedCount(const Call call) { return issuedCounts[static_cast<int>(call)].load(std::memory_order_relaxed); }
+    static quint64 skippedCount(const Call call) { return skippedCounts[static_cast<int>(call)].load(std::memory_order_relaxed); }
+    static void report();
+
+    // Deleting unbinds in the current context only and frees the names for reuse by any context sharing them,
+    // so every tracker forgets its texture and framebuffer bindings
+    static void deleteTextures(const GLsizei n, const GLuint *const textures);
+    static void deleteFramebuffers(const GLsizei n, const GLuint *const framebuffers);
+
+    // For when something else, like QOpenGLWidget, changed state behind the tracker
+    void invalidate();
+
+    GLuint framebuffer(const GLenum target);
+    void bindFramebuffer(const GLenum target, const GLuint framebuffer);
+    QRect viewport();
+    void setViewport(const QRect &viewport);
+    QRect scissor();
+    void setScissor(const QRect &scissor);
+    bool scissorTest();
+    void setScissorTest(const bool enabled);
+    void activeTexture(const GLuint unit);
+    // On the active texture unit
+    GLuint texture(const GLenum target);
+    void bindTexture(const GLenum target, const GLuint texture);
+    void bindTextureUnit(const GLuint unit, const GLenum target, const GLuint texture) {
+        activeTexture(unit);
+        bindTexture(target, texture);
+    }
+    void useProgram(const GLuint program);
+
+protected:
+    explicit OpenGLState(QOpenGLContext *const context);
+    virtual ~OpenGLState() override;
+
+    // Index into the tracked texture targets, -1 for targets that are always bound
+    static int textureTargetIndex(const GLenum target);
+    void forgetDeleted();
+
+    static inline std::array<std::atomic<quint64>, static_cast<int>(Call::Count)> issuedCounts{};
+    static inline std::array<std::atomic<quint64>, static_cast<int>(Call::Count)> skippedCounts{};
+    static inline std::atomic<quint64> deletionGeneration{0};
+    static thread_local OpenGLState *currentState;
+
+    QOpenGLContext *const context;
+    quint64 knownDeletionGeneration;
+    std::optional<GLuint> drawFramebuffer;
+    std::optional<GLuint> readFramebuffer;
+    std::optional<QRect> m_viewport;
+    std::optional<QRect> m_scissor;
+    std::optional<bool> m_scissorTest;
+    std::optional<GLuint> activeUnit;
+    std::array<std::array<std::optional<GLuint>, 3>, maxTextureUnits> textures;
+    std::optional<GLuint> program;
+};
+
 class ContextBinder
 {
 public:
+    // Set by an owner that lends a context to another thread, waits until the context is back on the calling thread
+    static void (*reclaim)(QOpenGLContext *const context);
+
     explicit ContextBinder(QOpenGLContext *const context, QSurface *const surface)
-        : previousContext(QOpenGLContext::currentContext()), previousSurface(previousContext ? previousContext->surface() : nullptr)
+        : previousContext(QOpenGLContext::currentContext()), previousSurface(previousContext ? previousContext->surface() : nullptr),
+          switched(previousContext != context || previousSurface != surface)
     {
-        context->makeCurrent(surface);
         Q_ASSERT(surface && context);
+        if (reclaim && QThread::currentThread() != context->thread()) reclaim(context);
         Q_ASSERT(QThread::currentThread() == context->thread());
+        // Nested binders of the context already current leave it as it is
+        OpenGLState::count(OpenGLState::Call::MakeCurrent, !switched);
+        if (!switched) return;
         const bool makeCurrentSuccess = context->makeCurrent(surface);
         Q_ASSERT(makeCurrentSuccess);
     }
@@ -42,6 +136,7 @@ public:
         : ContextBinder(widget->context(), widget->context()->surface()) {}
     ~ContextBinder()
     {
+        if (!switched) return;
         QOpenGLContext::currentContext()->doneCurrent();
         if (previousContext) previousContext->makeCurrent(previousSurface);
     }
@@ -49,71 +144,68 @@ public:
 private:
     QOpenGLContext *const previousContext;
     QSurface *const previousSurface;
+    const bool switched;
 };
 
-class FramebufferBinder : private OpenGL
+class FramebufferBinder
 {
 public:
-    explicit FramebufferBinder(const GLenum target = GL_FRAMEBUFFER, const GLuint framebuffer = 0, const QRect &viewport = QRect()) : OpenGL(true), target(target)
+    explicit FramebufferBinder(const GLenum target = GL_FRAMEBUFFER, const GLuint framebuffer = 0, const QRect &viewport = QRect()) :
+        state(OpenGLState::current()), target(target),
+        previousReadFramebuffer(0), previousDrawFramebuffer(0)
     {
         if (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER)
-            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+            previousReadFramebuffer = state.framebuffer(GL_READ_FRAMEBUFFER);
         if (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER)
-            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
-        if (framebuffer) glBindFramebuffer(target, framebuffer);
-        glGetIntegerv(GL_VIEWPORT, previousViewport);
-        glGetIntegerv(GL_SCISSOR_BOX, previousScissorBox);
-        glGetBooleanv(GL_SCISSOR_TEST, &previousScissorTest);
+            previousDrawFramebuffer = state.framebuffer(GL_DRAW_FRAMEBUFFER);
+        if (framebuffer) state.bindFramebuffer(target, framebuffer);
+        previousViewport = state.viewport();
+        previousScissor = state.scissor();
+        previousScissorTest = state.scissorTest();
         if (!viewport.isNull()) {
-            glViewport(viewport.x(), viewport.y(), viewport.width(), viewport.height());
-            glEnable(GL_SCISSOR_TEST);
-            glScissor(viewport.x(), viewport.y(), viewport.width(), viewport.height());
+            state.setViewport(viewport);
+            state.setScissorTest(true);
+            state.setScissor(viewport);
         }
     }
-    virtual ~FramebufferBinder() override
+    ~FramebufferBinder()
     {
         if (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER)
-            glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(previousReadFramebuffer));
+            state.bindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
         if (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER)
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, static_cast<GLuint>(previousDrawFramebuffer));
-        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
-        if (previousScissorTest == GL_TRUE) glEnable(GL_SCISSOR_TEST);
-        else glDisable(GL_SCISSOR_TEST);
-        glScissor(previousScissorBox[0], previousScissorBox[1], previousScissorBox[2], previousScissorBox[3]);
+            state.bindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDrawFramebuffer);
+        state.setViewport(previousViewport);
+        state.setScissorTest(previousScissorTest);
+        state.setScissor(previousScissor);
     }
 
 private:
+    OpenGLState &state;
     GLenum target;
-    GLint previousReadFramebuffer;
-    GLint previousDrawFramebuffer;
-    GLint previousViewport[4];
-    GLint previousScissorBox[4];
-    GLboolean previousScissorTest;
+    GLuint previousReadFramebuffer;
+    GLuint previousDrawFramebuffer;
+    QRect previousViewport;
+    QRect previousScissor;
+    bool previousScissorTest;
 };
 
-class TextureBinder : private OpenGL
+class TextureBinder
 {
 public:
-    explicit TextureBinder(const GLenum target = GL_TEXTURE_2D, GLuint texture = 0) : OpenGL(true), target(target)
+    explicit TextureBinder(const GLenum target = GL_TEXTURE_2D, GLuint texture = 0) :
+        state(OpenGLState::current()), target(target),
+        previousTexture(state.texture(target))
     {
-        GLenum targetBinding;
-        switch (target) {
-        case GL_TEXTURE_2D: targetBinding = GL_TEXTURE_BINDING_2D; break;
-        case GL_TEXTURE_RECTANGLE: targetBinding = GL_TEXTURE_BINDING_RECTANGLE; break;
-        default:
-            qDebug() << "unhandled texture target";
-            targetBinding = GL_TEXTURE_BINDING_2D;
-        }
-        glGetIntegerv(targetBinding, &previousTexture);
-        if (texture) glBindTexture(target, texture);
+        if (texture) state.bindTexture(target, texture);
     }
-    virtual ~TextureBinder() override
+    ~TextureBinder()
     {
-        glBindTexture(target, static_cast<GLuint>(previousTexture));
+        state.bindTexture(target, previousTexture);
     }
 private:
+    OpenGLState &state;
     GLenum target;
-    GLint previousTexture;
+    GLuint previousTexture;
 };
 
 } // namespace GfxPaint
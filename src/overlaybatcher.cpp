@@ -0,0 +1,99 @@
+#include "overlaybatcher.h"
+
+#include <QPainterPath>
+
+#include "application.h"
+#include "buffer.h"
+#include "program.h"
+
+namespace GfxPaint {
+
+OverlayBatcher::OverlayBatcher() :
+    transform(), vertices()
+{
+}
+
+void OverlayBatcher::marker(const Marker marker, const Mat4 &markerTransform)
+{
+    static constexpr Rgba black = {0.0f, 0.0f, 0.0f, 1.0f};
+    static constexpr Rgba white = {1.0f, 1.0f, 1.0f, 1.0f};
+    const Mat4 previousTransform = transform;
+    transform = transform * markerTransform;
+    switch (marker) {
+    case Marker::Plane: {
+        triangle(Vec2(0.0f, 0.0f), Vec2(-1.0f, 0.0f), Vec2(0.0f, -1.0f), black);
+        triangle(Vec2(0.0f, 0.0f), Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f), white);
+    }break;
+    case Marker::Slider: {
+        triangle(Vec2(0.0f, 0.0f), Vec2(0.0f, -1.0f), Vec2(-1.0f, -1.0f), black);
+        triangle(Vec2(0.0f, 0.0f), Vec2(1.0f, 1.0f), Vec2(0.0f, 1.0f), white);
+    }break;
+    case Marker::PaletteMouse: {
+        triangle(Vec2(0.0f, 0.0f), Vec2(0.5f, 0.0f), Vec2(0.0f, 0.5f), black);
+        triangle(Vec2(0.0f, 0.5f), Vec2(0.5f, 1.0f), Vec2(0.0f, 1.0f), white);
+    }break;
+    }
+    transform = previousTransform;
+}
+
+void OverlayBatcher::line(const Vec2 &from, const Vec2 &to, const float width, const Rgba &colour)
+{
+    const Vec2 direction = to - from;
+    if (direction.isNull()) return;
+    const Vec2 normal = Vec2(-direction.y(), direction.x()).normalized() * (width / 2.0f);
+    triangle(from - normal, to - normal, from + normal, colour);
+    triangle(from + normal, to - normal, to + normal, colour);
+}
+
+void OverlayBatcher::rect(const QRectF &rect, const Rgba &colour)
+{
+    const Vec2 topLeft(rect.topLeft()), topRight(rect.topRight()), bottomLeft(rect.bottomLeft()), bottomRight(rect.bottomRight());
+    triangle(topLeft, topRight, bottomLeft, colour);
+    triangle(bottomLeft, topRight, bottomRight, colour);
+}
+
+void OverlayBatcher::rectOutline(const QRectF &rect, const float width, const Rgba &colour)
+{
+    const Vec2 topLeft(rect.topLeft()), topRight(rect.topRight()), bottomLeft(rect.bottomLeft()), bottomRight(rect.bottomRight());
+    line(topLeft, topRight, width, colour);
+    line(topRight, bottomRight, width, colour);
+    line(bottomRight, bottomLeft, width, colour);
+    line(bottomLeft, topLeft, width, colour);
+}
+
+void OverlayBatcher::text(const Vec2 &pos, const QString &text, const QFont &font, const float width, const Rgba &colour)
+{
+    QPainterPath path;
+    path.addText(pos.toPointF(), font, text);
+    for (const QPolygonF &polygon : path.toSubpathPolygons()) {
+        for (int i = 1; i < polygon.size(); ++i) {
+            line(Vec2(polygon[i - 1]), Vec2(polygon[i]), width, colour);
+        }
+    }
+}
+
+void OverlayBatcher::flush(Buffer *const dest)
+{
+    if (vertices.empty()) return;
+
+    dest->bindFramebuffer();
+    VertexColourModelProgram *const program = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
+    // Vertices are already in clip space
+    program->render(GL_TRIANGLES, vertices, Mat4(), dest, nullptr);
+    vertices.clear();
+}
+
+void OverlayBatcher::triangle(const Vec2 &a, const Vec2 &b, const Vec2 &c, const Rgba &colour)
+{
+    vertex(a, colour);
+    vertex(b, colour);
+    vertex(c, colour);
+}
+
+void OverlayBatcher::vertex(const Vec2 &pos, const Rgba &colour)
+{
+    const Vec2 clipPos = transform.map(pos);
+    vertices.insert(vertices.end(), {clipPos.x(), clipPos.y(), colour[0], colour[1], colour[2], colour[3]});
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,58 @@
+#ifndef OVERLAYBATCHER_H
+#define OVERLAYBATCHER_H
+
+#include <QFont>
+#include <QRectF>
+#include <vector>
+
+#include "opengl.h"
+#include "types.h"
+
+namespace GfxPaint {
+
+class Buffer;
+
+// Canvas-like collector of 2D overlay primitives for one widget frame. Primitives are transformed to clip space
+// as they are added and flushed as one vertex stream with a single draw, so tool previews and widget markers
+// never bind programs or make draw calls of their own.
+class OverlayBatcher
+{
+public:
+    enum class Marker {
+        Plane,
+        Slider,
+        PaletteMouse,
+    };
+
+    explicit OverlayBatcher();
+
+    // Applies to primitives added after it is set, maps primitive coordinates to clip space
+    void setTransform(const Mat4 &transform) { this->transform = transform; }
+    const Mat4 &getTransform() const { return transform; }
+
+    // Marker shapes span -1 to 1, placed by the marker transform followed by the current transform
+    void marker(const Marker marker, const Mat4 &markerTransform = Mat4());
+    void line(const Vec2 &from, const Vec2 &to, const float width, const Rgba &colour);
+    void rect(const QRectF &rect, const Rgba &colour);
+    void rectOutline(const QRectF &rect, const float width, const Rgba &colour);
+    // Glyph outlines of the text with its baseline starting at pos
+    void text(const Vec2 &pos, const QString &text, const QFont &font, const float width, const Rgba &colour);
+
+    bool isEmpty() const { return vertices.empty(); }
+    // Draws everything added since the last flush into dest, needs the render context current
+    void flush(Buffer *const dest);
+    void clear() { vertices.clear(); }
+
+protected:
+    static constexpr int vertexSize = 6;
+
+    void triangle(const Vec2 &a, const Vec2 &b, const Vec2 &c, const Rgba &colour);
+    void vertex(const Vec2 &pos, const Rgba &colour);
+
+    Mat4 transform;
+    std::vector<GLfloat> vertices;
+};
+
+} // namespace GfxPaint
+
+#endif // OVERLAYBATCHER_H
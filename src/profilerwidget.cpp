@@ -0,0 +1,79 @@
+#include "profilerwidget.h"
+
+#include <QHeaderView>
+#include <QVBoxLayout>
+
+#include "application.h"
+
+namespace GfxPaint {
+
+ProfilerWidget::ProfilerWidget(QWidget *const parent) :
+    QWidget(parent),
+    summaryLabel(new QLabel(this)), table(new QTableWidget(0, 4, this)),
+    refreshTimer(), shown(false)
+{
+    QVBoxLayout *const layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(summaryLabel);
+    layout->addWidget(table);
+
+    summaryLabel->setWordWrap(true);
+    table->setHorizontalHeaderLabels({"Pass", "Calls", "CPU ms", "GPU ms"});
+    table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    table->verticalHeader()->hide();
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionMode(QAbstractItemView::NoSelection);
+    table->setAlternatingRowColors(true);
+
+    QObject::connect(&qApp->renderManager.profiler, &FrameProfiler::frameProfiled, this, [this](){
+        if (!refreshTimer.isValid() || refreshTimer.elapsed() >= refreshInterval) refresh();
+    }, Qt::QueuedConnection);
+}
+
+ProfilerWidget::~ProfilerWidget()
+{
+    if (shown) qApp->renderManager.profiler.removeClient();
+}
+
+void ProfilerWidget::showEvent(QShowEvent *const event)
+{
+    QWidget::showEvent(event);
+    if (!shown) qApp->renderManager.profiler.addClient();
+    shown = true;
+}
+
+void ProfilerWidget::hideEvent(QHideEvent *const event)
+{
+    QWidget::hideEvent(event);
+    if (shown) qApp->renderManager.profiler.removeClient();
+    shown = false;
+}
+
+void ProfilerWidget::refresh()
+{
+    refreshTimer.start();
+    const FrameProfiler::Frame frame = qApp->renderManager.profiler.lastFrame();
+    summaryLabel->setText(QString("Frame interval %1 ms, %2 state calls, %3 program binds, %4 texture copies, %5 KiB moved")
+                          .arg(frame.intervalMs, 0, 'f', 2).arg(frame.stateCalls).arg(frame.programBinds)
+                          .arg(frame.textureCopies).arg(frame.bytesMoved / 1024));
+    table->setRowCount(static_cast<int>(frame.passes.size()));
+    for (int row = 0; row < static_cast<int>(frame.passes.size()); ++row) {
+        const FrameProfiler::Pass &pass = frame.passes[row];
+        const QStringList columns = {
+            pass.name,
+            QString::number(pass.calls),
+            QString::number(pass.cpuMs, 'f', 3),
+            pass.gpuMs < 0.0 ? QString("-") : QString::number(pass.gpuMs, 'f', 3),
+        };
+        for (int column = 0; column < columns.size(); ++column) {
+            QTableWidgetItem *item = table->item(row, column);
+            if (!item) {
+                item = new QTableWidgetItem();
+                table->setItem(row, column, item);
+            }
+            item->setText(columns[column]);
+        }
+    }
+}
+
+} // namespace GfxPaint
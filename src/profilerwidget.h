@@ -0,0 +1,37 @@
+#ifndef PROFILERWIDGET_H
+#define PROFILERWIDGET_H
+
+#include <QElapsedTimer>
+#include <QLabel>
+#include <QTableWidget>
+#include <QWidget>
+
+namespace GfxPaint {
+
+// Table of the passes of the last profiled frame, profiling runs while it is shown
+class ProfilerWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    // Limits table rebuilds while frames render continuously
+    static constexpr int refreshInterval = 250;
+
+    explicit ProfilerWidget(QWidget *const parent = nullptr);
+    virtual ~ProfilerWidget() override;
+
+protected:
+    virtual void showEvent(QShowEvent *const event) override;
+    virtual void hideEvent(QHideEvent *const event) override;
+
+    void refresh();
+
+    QLabel *summaryLabel;
+    QTableWidget *table;
+    QElapsedTimer refreshTimer;
+    bool shown;
+};
+
+} // namespace GfxPaint
+
+#endif // PROFILERWIDGET_H
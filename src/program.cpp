@@ -1,12 +1,50 @@
 #include "program.h"
 
 #include <functional>
+#include <limits>
 #include "application.h"
 #include "rendermanager.h"
 #include "utils.h"
 
 namespace GfxPaint {
 
+ProgramReflection::ProgramReflection(const GLuint program) :
+    uniforms(), uniformBlocks()
+{
+    OpenGLFunctions gl;
+    gl.initializeOpenGLFunctions();
+
+    GLint count = 0;
+    GLint maxLength = 0;
+    gl.glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    gl.glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    QByteArray name(std::max(maxLength, 1), '\0');
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        gl.glGetActiveUniform(program, static_cast<GLuint>(i), name.size(), &length, &size, &type, name.data());
+        const GLint location = gl.glGetUniformLocation(program, name.constData());
+        // Uniform block members have no location
+        if (location < 0) continue;
+        const QString uniformName = QString::fromLatin1(name.constData(), length);
+        uniforms[uniformName] = {location, type, size};
+        // Arrays are reported by their first element
+        if (uniformName.endsWith("[0]")) uniforms[uniformName.chopped(3)] = {location, type, size};
+    }
+
+    gl.glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    gl.glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+    name.fill('\0', std::max(maxLength, 1));
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint dataSize = 0;
+        gl.glGetActiveUniformBlockName(program, static_cast<GLuint>(i), name.size(), &length, name.data());
+        gl.glGetActiveUniformBlockiv(program, static_cast<GLuint>(i), GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+        uniformBlocks[QString::fromLatin1(name.constData(), length)] = {static_cast<GLuint>(i), dataSize};
+    }
+}
+
 Program::Program() :
     OpenGL(true),
     key(typeid(Program), {}),
@@ -19,28 +57,105 @@ Program::~Program() {
 }
 
 QOpenGLShaderProgram &Program::program() {
-    if (!m_program) m_program = qApp->renderManager.programManager.grab(key, [this](){return createProgram();});
+    if (!m_program) {
+        qApp->renderManager.programManager.adoptPrewarmed(key, [this](){return sources();});
+        m_program = qApp->renderManager.programManager.grab(key, [this](){return createProgram();});
+    }
     return *m_program;
 }
 
-QOpenGLShaderProgram *Program::createProgram() const
-{
-    ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-    QOpenGLShaderProgram *program = new QOpenGLShaderProgram();
+const ProgramReflection &Program::reflection() {
+    return qApp->renderManager.programManager.reflection(&program());
+}
+
+bool Program::isReady() {
+    if (m_program) return true;
+    ProgramManager &programManager = qApp->renderManager.programManager;
+    if (programManager.adoptPrewarmed(key, [this](){return sources();}) || !qApp->renderManager.programCompiler.isRunning()) {
+        program();
+        return true;
+    }
+    if (!programManager.isPending(key)) programManager.request(key, sources());
+    return false;
+}
 
+void Program::prepare() {
+    ProgramManager &programManager = qApp->renderManager.programManager;
+    if (m_program || programManager.adoptPrewarmed(key, [this](){return sources();}) || programManager.isPending(key) || !qApp->renderManager.programCompiler.isRunning()) return;
+    programManager.request(key, sources());
+}
+
+ProgramSources Program::sources() const
+{
+    ProgramSources sources;
     for (auto stage : programStages) {
         const QString src = generateSource(stage);
-        if (!src.isEmpty()) {
-            program->addCacheableShaderFromSourceCode(stage, src);
-        }
+        if (!src.isEmpty()) sources.push_back({stage, src});
     }
+    return sources;
+}
 
-    program->link();
+QOpenGLShaderProgram *Program::createProgram() const
+{
+    ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    ProgramCache &programCache = qApp->renderManager.programCache;
+    const ProgramSources sources = this->sources();
+    const QByteArray hash = programCache.hash(sources);
+    programCache.recordUsage(key, hash);
+    QOpenGLShaderProgram *program = programCache.link(sources, hash);
     Q_ASSERT_X(program->isLinked(), typeid(*this).name(), "Program linking failed.");
+    // Linked by a frame on the render thread, programs are owned by the main thread
+    if (program->thread() != qApp->thread()) program->moveToThread(qApp->thread());
 
     return program;
 }
 
+void ProgramManager::request(const Program::Key &key, const ProgramSources &sources)
+{
+    Q_ASSERT(!contains(key) && !isPending(key));
+    pending.insert(key);
+    ProgramCache &programCache = qApp->renderManager.programCache;
+    const QByteArray hash = programCache.hash(sources);
+    programCache.recordUsage(key, hash);
+    qApp->renderManager.programCompiler.compile(key, sources, hash);
+}
+
+const ProgramReflection &ProgramManager::reflection(const QOpenGLShaderProgram *const program)
+{
+    // Widgets look up their present programs on the main thread while frames render on the render thread
+    {
+        QMutexLocker locker(&reflectionsMutex);
+        const auto found = reflections.find(program);
+        if (found != reflections.end()) return found->second;
+    }
+    ProgramReflection reflection = [&](){
+        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+        return ProgramReflection(program->programId());
+    }();
+    QMutexLocker locker(&reflectionsMutex);
+    return reflections.emplace(program, std::move(reflection)).first->second;
+}
+
+bool ProgramManager::adoptPrewarmed(const Program::Key &key, const std::function<ProgramSources()> &sourcesFunc)
+{
+    if (contains(key)) return true;
+    if (prewarmed.empty()) return false;
+    const auto found = prewarmed.find(ProgramCache::keyString(key));
+    if (found == prewarmed.end()) return false;
+
+    const auto [hash, program] = found->second;
+    prewarmed.erase(found);
+    ProgramCache &programCache = qApp->renderManager.programCache;
+    // Shader files may have changed since the program was logged
+    if (programCache.hash(sourcesFunc()) != hash) {
+        deleteProgram(program);
+        return false;
+    }
+    programCache.recordUsage(key, hash);
+    programs[key] = std::make_pair(program, 0);
+    return true;
+}
+
 QString RenderedWidgetProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
 {
     QString src;
@@ -65,15 +180,16 @@ QString RenderedWidgetProgram::generateSource(QOpenGLShader::ShaderTypeBit stage
 
 void RenderedWidgetProgram::render(Buffer *const src, const Mat4 &worldToClip)
 {
+    FrameProfiler::Scope profileScope("RenderedWidgetProgram::render");
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
     Mat4 objectMatrix;
     objectMatrix.scale(src->width(), src->height());
-    glUniformMatrix4fv(program.uniformLocation("object"), 1, false, objectMatrix.constData());
+    glUniformMatrix4fv(uniformLocation("object"), 1, false, objectMatrix.constData());
 
     Mat4 widgetMatrix = qApp->renderManager.flipTransform * qApp->renderManager.unitToClipTransform * objectMatrix.inverted();
-    glUniformMatrix4fv(program.uniformLocation("transform"), 1, false, widgetMatrix.constData());
+    glUniformMatrix4fv(uniformLocation("transform"), 1, false, widgetMatrix.constData());
 
     qApp->renderManager.bindBufferShaderPart(program, "srcBuffer", 0, src);
 
@@ -90,13 +206,19 @@ QString BufferProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
     case QOpenGLShader::Vertex: {
         src += RenderManager::headerShaderPart();
         src += RenderManager::attributelessShaderPart(AttributelessModel::UnitQuad);
-        src += RenderManager::vertexMainShaderPart();
+        src += drawDataSrc(drawDataBinding);
+        src += instanced ? RenderManager::instancedVertexMainShaderPart(1) : RenderManager::drawDataVertexMainShaderPart();
     }break;
     case QOpenGLShader::Fragment: {
         src += RenderManager::headerShaderPart();
-        src += RenderManager::bufferShaderPart("srcBuffer", 0, 0, srcFormat, srcIndexed, 1, srcPaletteFormat);
-        src += RenderManager::standardInputFragmentShaderPart("srcBuffer");
-        src += RenderManager::bufferShaderPart("dest", 2, 2, destFormat, destIndexed, 3, destPaletteFormat);
+        src += drawDataSrc(drawDataBinding);
+        src += RenderManager::bufferShaderPart("srcBuffer", 0, 0, srcFormat, srcIndexed, 1, srcPaletteFormat, true);
+        if (srcPyramid) {
+            src += RenderManager::bufferPyramidShaderPart("srcBuffer", 4, true);
+            src += RenderManager::standardInputFragmentShaderPart("srcBufferPyramid");
+        }
+        else src += RenderManager::standardInputFragmentShaderPart("srcBuffer");
+        src += RenderManager::bufferShaderPart("dest", 2, 2, destFormat, destIndexed, 3, destPaletteFormat, true);
         src += RenderManager::standardFragmentMainShaderPart(destFormat, destIndexed, 3, destPaletteFormat, blendMode, composeMode);
     }break;
     default: break;
@@ -105,31 +227,60 @@ QString BufferProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
     return src;
 }
 
-void BufferProgram::render(Buffer *const src, const Buffer *const srcPalette, const Colour &srcTransparent, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette, const Colour &destTransparent)
+void BufferProgram::render(Buffer *const src, const Buffer *const srcPalette, const Colour &srcTransparent, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette, const Colour &destTransparent, const GLuint srcPyramidTexture, const int srcPyramidLevel)
 {
+    FrameProfiler::Scope profileScope("BufferProgram::render");
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
     Mat4 objectMatrix;
     objectMatrix.scale(src->width(), src->height());
-    glUniformMatrix4fv(program.uniformLocation("object"), 1, false, objectMatrix.constData());
+    DrawData drawData{};
+    drawData.transform = worldToClip.mat4();
+    drawData.object = objectMatrix.mat4();
+    drawData.srcTransparent = srcTransparent;
+    drawData.destTransparent = destTransparent;
+    drawData.srcBufferOrigin[0] = src->origin().x();
+    drawData.srcBufferOrigin[1] = src->origin().y();
+    if (dest) {
+        drawData.destOrigin[0] = dest->origin().x();
+        drawData.destOrigin[1] = dest->origin().y();
+    }
+    drawData.srcBufferPyramidLevel = srcPyramidTexture ? srcPyramidLevel : 0;
+    updateDrawData(drawData);
+
+    qApp->renderManager.bindIndexedBufferShaderPart(program, "srcBuffer", 0, src, srcIndexed, 1, srcPalette);
+    if (srcPyramid) {
+        qApp->renderManager.bindBufferPyramidShaderPart(program, "srcBuffer", 4, srcPyramidTexture, srcPyramidTexture ? srcPyramidLevel : 0);
+    }
 
-    glUniformMatrix4fv(program.uniformLocation("transform"), 1, false, worldToClip.constData());
+    if (dest) {
+        qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 2, dest, destIndexed, 3, destPalette);
+    }
 
-    glUniform4fv(program.uniformLocation("srcTransparent.colour"), 1, srcTransparent.rgba.data());
-    glUniform1ui(program.uniformLocation("srcTransparent.index"), srcTransparent.index);
-    glUniform4fv(program.uniformLocation("destTransparent.colour"), 1, destTransparent.rgba.data());
-    glUniform1ui(program.uniformLocation("destTransparent.index"), destTransparent.index);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-//    UniformData uniformData;
-//    memcpy(&uniformData.matrix, matrix.constData(), sizeof(uniformData.matrix));
-//    uniformData.transparent = srcTransparent;
+    //glTextureBarrier();
+}
+
+void BufferProgram::renderInstances(const std::vector<InstanceData> &instances, const Buffer *const src, const Buffer *const srcPalette, const Colour &srcTransparent, Buffer *const dest, const Buffer *const destPalette, const Colour &destTransparent)
+{
+    FrameProfiler::Scope profileScope("BufferProgram::renderInstances");
+    Q_ASSERT(instanced && !srcPyramid);
+    if (instances.empty()) return;
 
-//    const GLuint blockIndex = glGetUniformBlockIndex(program.programId(), "srcUniformData");
-//    const GLuint bindingPoint = 2;
-//    glUniformBlockBinding(program.programId(), blockIndex, bindingPoint);
-//    glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, uniformBuffer);
-//    glBufferData(GL_UNIFORM_BUFFER, sizeof(uniformData), &uniformData, GL_DYNAMIC_DRAW);
+    QOpenGLShaderProgram &program = this->program();
+    OpenGLState::current().useProgram(program.programId());
+
+    // Positions from the vertex stage already include each instance's origin, so srcBufferOrigin stays zero
+    DrawData drawData{};
+    drawData.srcTransparent = srcTransparent;
+    drawData.destTransparent = destTransparent;
+    if (dest) {
+        drawData.destOrigin[0] = dest->origin().x();
+        drawData.destOrigin[1] = dest->origin().y();
+    }
+    updateDrawData(drawData);
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "srcBuffer", 0, src, srcIndexed, 1, srcPalette);
 
@@ -137,9 +288,345 @@ void BufferProgram::render(Buffer *const src, const Buffer *const srcPalette, co
         qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 2, dest, destIndexed, 3, destPalette);
     }
 
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 1, instances.data(), static_cast<GLsizeiptr>(instances.size() * sizeof(InstanceData)));
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances.size()));
+}
+
+void BufferProgram::updateDrawData(const DrawData &drawData)
+{
+    qApp->renderManager.streamBuffer.bind(GL_UNIFORM_BUFFER, drawDataBinding, &drawData, sizeof(DrawData));
+}
+
+QString BufferUberProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
+{
+    QString src;
+
+    switch(stage) {
+    case QOpenGLShader::Vertex: {
+        src += RenderManager::headerShaderPart();
+        src += RenderManager::attributelessShaderPart(AttributelessModel::UnitQuad);
+        src += instanced ? RenderManager::instancedVertexMainShaderPart(1) : RenderManager::vertexMainShaderPart();
+    }break;
+    case QOpenGLShader::Fragment: {
+        src += RenderManager::headerShaderPart();
+        src += RenderManager::uberBufferShaderPart("srcBuffer", 0, 0, srcFormat, 1, srcPaletteFormat);
+        if (srcPyramid) {
+            src += RenderManager::bufferPyramidShaderPart("srcBuffer", 4);
+            src += RenderManager::standardInputFragmentShaderPart("srcBufferPyramid");
+        }
+        else src += RenderManager::standardInputFragmentShaderPart("srcBuffer");
+        src += RenderManager::uberBufferShaderPart("dest", 2, 2, destFormat, 3, destPaletteFormat);
+        src += RenderManager::uberFragmentMainShaderPart(destFormat);
+    }break;
+    default: break;
+    }
+
+    return src;
+}
+
+QOpenGLShaderProgram &BufferUberProgram::bind(const Buffer *const src, const bool srcIndexed, const Buffer *const srcPalette, const Colour &srcTransparent, Buffer *const dest, const bool destIndexed, const Buffer *const destPalette, const Colour &destTransparent, const int blendMode, const int composeMode)
+{
+    QOpenGLShaderProgram &program = this->program();
+    OpenGLState::current().useProgram(program.programId());
+
+    setUniform(uniforms.blendModeIndex, static_cast<GLint>(blendMode));
+    setUniform(uniforms.composeModeIndex, static_cast<GLint>(composeMode));
+    setUniform(uniforms.srcTransparentColour, srcTransparent.rgba);
+    setUniform(uniforms.srcTransparentIndex, srcTransparent.index);
+    setUniform(uniforms.destTransparentColour, destTransparent.rgba);
+    setUniform(uniforms.destTransparentIndex, destTransparent.index);
+
+    qApp->renderManager.bindUberBufferShaderPart(program, "srcBuffer", 0, src, srcIndexed, 1, srcPalette);
+    if (dest) {
+        qApp->renderManager.bindUberBufferShaderPart(program, "dest", 2, dest, destIndexed, 3, destPalette);
+    }
+    return program;
+}
+
+void BufferUberProgram::render(Buffer *const src, const bool srcIndexed, const Buffer *const srcPalette, const Colour &srcTransparent, const Mat4 &worldToClip, Buffer *const dest, const bool destIndexed, const Buffer *const destPalette, const Colour &destTransparent, const int blendMode, const int composeMode, const GLuint srcPyramidTexture, const int srcPyramidLevel)
+{
+    FrameProfiler::Scope profileScope("BufferUberProgram::render");
+    Q_ASSERT(!instanced);
+    QOpenGLShaderProgram &program = bind(src, srcIndexed, srcPalette, srcTransparent, dest, destIndexed, destPalette, destTransparent, blendMode, composeMode);
+
+    Mat4 objectMatrix;
+    objectMatrix.scale(src->width(), src->height());
+    setUniform(uniforms.object, objectMatrix);
+    setUniform(uniforms.transform, worldToClip);
+    if (srcPyramid) {
+        qApp->renderManager.bindBufferPyramidShaderPart(program, "srcBuffer", 4, srcPyramidTexture, srcPyramidTexture ? srcPyramidLevel : 0);
+    }
+
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
 
-    //glTextureBarrier();
+void BufferUberProgram::renderInstances(const std::vector<BufferProgram::InstanceData> &instances, const Buffer *const src, const bool srcIndexed, const Buffer *const srcPalette, const Colour &srcTransparent, Buffer *const dest, const bool destIndexed, const Buffer *const destPalette, const Colour &destTransparent, const int blendMode, const int composeMode)
+{
+    FrameProfiler::Scope profileScope("BufferUberProgram::renderInstances");
+    Q_ASSERT(instanced && !srcPyramid);
+    if (instances.empty()) return;
+
+    QOpenGLShaderProgram &program = bind(src, srcIndexed, srcPalette, srcTransparent, dest, destIndexed, destPalette, destTransparent, blendMode, composeMode);
+    // Positions from the vertex stage already include each instance's origin
+    setUniform(uniforms.srcBufferOrigin, QPoint(0, 0));
+
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 1, instances.data(), static_cast<GLsizeiptr>(instances.size() * sizeof(BufferProgram::InstanceData)));
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances.size()));
+}
+
+QString BufferPyramidProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
+{
+    QString src;
+
+    switch(stage) {
+    case QOpenGLShader::Vertex: {
+        src += RenderManager::headerShaderPart();
+        src += RenderManager::attributelessShaderPart(AttributelessModel::ClipQuad);
+        src += R"(
+void main(void) {
+    gl_Position = vec4(vertices[gl_VertexID], 0.0, 1.0);
+}
+)";
+    }break;
+    case QOpenGLShader::Fragment: {
+        src += RenderManager::headerShaderPart();
+        src += R"(
+uniform layout(location = 0) $SAMPLER_TYPE srcTexture;
+uniform int srcLevel;
+uniform ivec2 srcSize;
+
+out layout(location = 0) vec4 fragment;
+
+vec4 srcTexel(const ivec2 pos) {
+    return toUnit(vec4(texelFetch(srcTexture, min(pos, srcSize - 1), srcLevel)), $SCALAR_VALUE_TYPE($FORMAT_SCALE));
+}
+
+void main(void) {
+    ivec2 destPos = ivec2(floor(gl_FragCoord.xy));
+    vec4 sum = vec4(0.0);
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            vec4 texel = srcTexel(destPos * 2 + ivec2(x, y));
+            // Premultiplied so transparent texels don't bleed their colour
+            sum += vec4(texel.rgb * texel.a, texel.a);
+        }
+    }
+    fragment = (sum.a > 0.0 ? vec4(sum.rgb / sum.a, sum.a / 4.0) : vec4(0.0));
+}
+)";
+        stringMultiReplace(src, {
+            {"$SAMPLER_TYPE", srcFormat.shaderSamplerType()},
+            {"$FORMAT_SCALE", QString::number(srcFormat.scale())},
+            {"$SCALAR_VALUE_TYPE", srcFormat.shaderScalarValueType()},
+        });
+    }break;
+    default: break;
+    }
+
+    return src;
+}
+
+void BufferPyramidProgram::render(const GLuint srcTexture, const int srcLevel, const QSize &srcSize)
+{
+    FrameProfiler::Scope profileScope("BufferPyramidProgram::render");
+    QOpenGLShaderProgram &program = this->program();
+    OpenGLState::current().useProgram(program.programId());
+
+    OpenGLState::current().bindTextureUnit(0, GL_TEXTURE_2D, srcTexture);
+    glUniform1i(uniformLocation("srcTexture"), 0);
+    glUniform1i(uniformLocation("srcLevel"), srcLevel);
+    glUniform2i(uniformLocation("srcSize"), srcSize.width(), srcSize.height());
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+QString CompositorProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
+{
+    QString src;
+
+    switch(stage) {
+    case QOpenGLShader::Compute: {
+        src += RenderManager::headerShaderPart();
+        src += RenderManager::resourceShaderPart("compositing.glsl");
+        src += RenderManager::resourceShaderPart("blending.glsl");
+        src += R"(
+layout(local_size_x = $TILE_SIZE, local_size_y = $TILE_SIZE) in;
+
+layout($DEST_IMAGE_FORMAT, binding = 0) uniform $DEST_IMAGE_TYPE dest;
+$LAYER_SAMPLERS
+
+layout(std140, binding = $DISPATCH_DATA_BINDING) uniform CompositorDispatchData {
+    ivec4 scissor;
+    ivec2 origin;
+    ivec2 destSize;
+    int layerCount;
+} dispatchData;
+
+struct Layer {
+    mat4 clipToBuffer;
+    ivec4 bounds;
+    ivec2 size;
+    float scale;
+    int blendMode;
+    int composeMode;
+    int arrayLayer;
+    ivec2 origin;
+};
+
+layout(std430, binding = 0) readonly buffer layerData {
+    Layer layers[];
+};
+
+vec3 blendLayer(const int mode, const vec3 dest, const vec3 src) {
+    switch (mode) {
+$BLEND_CASES
+    }
+    return src;
+}
+
+vec4 composeLayer(const int mode, const vec4 dest, const vec4 src) {
+    switch (mode) {
+$COMPOSE_CASES
+    }
+    return src;
+}
+
+void main(void) {
+    ivec2 tileMin = dispatchData.origin + ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy);
+    ivec2 tileMax = tileMin + ivec2(gl_WorkGroupSize.xy);
+    ivec2 pixel = dispatchData.origin + ivec2(gl_GlobalInvocationID.xy);
+    bool inside = all(greaterThanEqual(pixel, dispatchData.scissor.xy)) && all(lessThan(pixel, dispatchData.scissor.zw));
+
+    vec4 colour = (inside ? toUnit(vec4(imageLoad(dest, pixel)), float($DEST_FORMAT_SCALE)) : vec4(0.0));
+    vec2 clipPos = (vec2(pixel) + 0.5) / vec2(dispatchData.destSize) * 2.0 - 1.0;
+    for (int i = 0; i < dispatchData.layerCount; ++i) {
+        // Whole work group skips layers that don't overlap its tile
+        if (any(greaterThanEqual(tileMin, layers[i].bounds.zw)) || any(lessThanEqual(tileMax, layers[i].bounds.xy))) continue;
+        vec2 pos = (layers[i].clipToBuffer * vec4(clipPos, 0.0, 1.0)).xy;
+        if (!inside || any(lessThan(pos, vec2(0.0))) || any(greaterThanEqual(pos, vec2(layers[i].size)))) continue;
+        vec4 src = toUnit(vec4($LAYER_FETCH), layers[i].scale);
+        vec4 blended = vec4(blendLayer(layers[i].blendMode, colour.rgb, src.rgb), src.a);
+        colour = unpremultiply(composeLayer(layers[i].composeMode, colour, blended));
+    }
+
+    if (inside) imageStore(dest, pixel, $DEST_STORE_TYPE(fromUnit(colour, $DEST_SCALAR_VALUE_TYPE($DEST_FORMAT_SCALE))));
+}
+)";
+        QString blendCases;
+        for (int i = 0; i < RenderManager::blendModes.size(); ++i) {
+            blendCases += QString("    case %1: return %2(dest, src);\n").arg(i).arg(RenderManager::blendModes[i].functionName);
+        }
+        QString composeCases;
+        for (int i = 0; i < RenderManager::composeModes.size(); ++i) {
+            composeCases += QString("    case %1: return %2(dest, src);\n").arg(i).arg(RenderManager::composeModes[i].functionName);
+        }
+        // Image stores always take four components
+        const QString destStoreType = destFormat.shaderScalarValueType() == "float" ? "vec4" : destFormat.shaderScalarValueType().left(1) + "vec4";
+        // Units are fixed by binding so no sampler uniform is set per dispatch, array elements take consecutive units
+        const QString layerSamplers = layerArray ?
+            QString("uniform layout(binding = 0) %1Array layerArray;").arg(layerFormat.shaderSamplerType()) :
+            QString("uniform layout(binding = 0) %1 layerTextures[%2];").arg(layerFormat.shaderSamplerType()).arg(maxLayers);
+        const QString layerFetch = layerArray ?
+            "texelFetch(layerArray, ivec3(floor(pos), layers[i].arrayLayer), 0)" :
+            "texelFetch(layerTextures[i], ivec2(floor(pos)) + layers[i].origin, 0)";
+        stringMultiReplace(src, {
+            {"$TILE_SIZE", QString::number(tileSize)},
+            {"$DISPATCH_DATA_BINDING", QString::number(dispatchDataBinding)},
+            {"$LAYER_SAMPLERS", layerSamplers},
+            {"$LAYER_FETCH", layerFetch},
+            {"$DEST_IMAGE_FORMAT", destFormat.shaderImageFormat()},
+            {"$DEST_IMAGE_TYPE", destFormat.shaderImageType()},
+            {"$DEST_FORMAT_SCALE", QString::number(destFormat.scale())},
+            {"$DEST_SCALAR_VALUE_TYPE", destFormat.shaderScalarValueType()},
+            {"$DEST_STORE_TYPE", destStoreType},
+            {"$BLEND_CASES", blendCases},
+            {"$COMPOSE_CASES", composeCases},
+        });
+    }break;
+    default: break;
+    }
+
+    return src;
+}
+
+void CompositorProgram::render(const std::vector<Layer> &layers, Buffer *const dest, const QRect &scissor)
+{
+    FrameProfiler::Scope profileScope("CompositorProgram::render");
+    Q_ASSERT(layerArray || layers.size() <= maxLayers);
+
+    const QRect destRect = scissor.isNull() ? dest->rect() : scissor.intersected(dest->rect());
+    const Mat4 clipToViewport = viewportToClipTransform(dest->size()).inverted();
+
+    std::vector<LayerData> layerData;
+    layerData.reserve(layers.size());
+    QRect dispatchRect;
+    for (const Layer &layer : layers) {
+        // Bounds of the transformed buffer quad in dest pixels
+        const Mat4 bufferToViewport = clipToViewport * layer.worldToClip;
+        Vec2 boundsMin(std::numeric_limits<float>::infinity());
+        Vec2 boundsMax(-std::numeric_limits<float>::infinity());
+        for (const Vec2 &corner : {Vec2(0.0f, 0.0f), Vec2(layer.buffer->width(), 0.0f), Vec2(0.0f, layer.buffer->height()), Vec2(layer.buffer->width(), layer.buffer->height())}) {
+            const Vec2 point = bufferToViewport.map(corner);
+            boundsMin = GfxPaint::min(boundsMin, point);
+            boundsMax = GfxPaint::max(boundsMax, point);
+        }
+        const QRect pixelBounds = QRect(QPoint(std::floor(boundsMin.x()) - 1, std::floor(boundsMin.y()) - 1), QPoint(std::ceil(boundsMax.x()) + 1, std::ceil(boundsMax.y()) + 1)).intersected(destRect);
+        if (pixelBounds.isEmpty()) continue;
+        dispatchRect = dispatchRect.united(pixelBounds);
+
+        LayerData data{};
+        const Mat4 clipToBuffer = layer.worldToClip.inverted();
+        memcpy(data.clipToBuffer, clipToBuffer.constData(), sizeof(data.clipToBuffer));
+        data.bounds[0] = pixelBounds.left();
+        data.bounds[1] = pixelBounds.top();
+        data.bounds[2] = pixelBounds.right() + 1;
+        data.bounds[3] = pixelBounds.bottom() + 1;
+        data.size[0] = layer.buffer->width();
+        data.size[1] = layer.buffer->height();
+        data.scale = static_cast<GLfloat>(layer.buffer->format().scale());
+        data.blendMode = layer.blendMode;
+        data.composeMode = layer.composeMode;
+        data.arrayLayer = layer.buffer->arrayLayer();
+        data.origin[0] = layer.buffer->origin().x();
+        data.origin[1] = layer.buffer->origin().y();
+
+        if (layerArray) {
+            Q_ASSERT(layer.buffer->array() == layers.front().buffer->array());
+        }
+        else {
+            const GLint unit = static_cast<GLint>(layerData.size());
+            layer.buffer->bindTextureUnit(unit);
+        }
+        layerData.push_back(data);
+    }
+    if (layerData.empty()) return;
+
+    QOpenGLShaderProgram &program = this->program();
+    OpenGLState::current().useProgram(program.programId());
+
+    if (layerArray) {
+        OpenGLState::current().bindTextureUnit(0, GL_TEXTURE_2D_ARRAY, layers.front().buffer->array()->texture);
+    }
+
+    const DispatchData dispatchData{
+        {destRect.left(), destRect.top(), destRect.right() + 1, destRect.bottom() + 1},
+        {dispatchRect.x(), dispatchRect.y()},
+        {dest->width(), dest->height()},
+        static_cast<GLint>(layerData.size()),
+    };
+    qApp->renderManager.streamBuffer.bind(GL_UNIFORM_BUFFER, dispatchDataBinding, &dispatchData, sizeof(DispatchData));
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 0, layerData.data(), static_cast<GLsizeiptr>(layerData.size() * sizeof(LayerData)));
+
+    // Image stores bypass copy on write
+    dest->detach();
+    dest->bindImageUnit(0);
+
+    glDispatchCompute((dispatchRect.width() + tileSize - 1) / tileSize, (dispatchRect.height() + tileSize - 1) / tileSize, 1);
+
+    // Later draws sample or attach dest
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
 }
 
 QString SingleColourModelProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
@@ -189,17 +676,27 @@ Colour src(void) {
 }
 
 void SingleColourModelProgram::render(Model *const model, const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette) {
+    FrameProfiler::Scope profileScope("SingleColourModelProgram::render");
+    bind(colour, worldToClip, dest, destPalette);
+    model->render();
+}
+
+void SingleColourModelProgram::render(const GLenum primitive, const std::vector<vec2> &vertices, const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette) {
+    FrameProfiler::Scope profileScope("SingleColourModelProgram::render");
+    bind(colour, worldToClip, dest, destPalette);
+    qApp->renderManager.drawTransient(primitive, {2}, vertices.front().data(), static_cast<GLsizei>(vertices.size()));
+}
+
+void SingleColourModelProgram::bind(const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette) {
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniform4fv(program.uniformLocation("colour"), 1, colour.rgba.data());
-    glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, worldToClip.constData());
+    setUniform(colourUniform, colour.rgba);
+    setUniform(worldToClipUniform, worldToClip);
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
-
-    model->render();
 }
 
 QString VertexColourModelProgram::generateSource(QOpenGLShader::ShaderTypeBit stage) const
@@ -247,24 +744,35 @@ Colour src(void) {
 }
 
 void VertexColourModelProgram::render(Model *const model, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette) {
+    FrameProfiler::Scope profileScope("VertexColourModelProgram::render");
+    bind(worldToClip, dest, destPalette);
+    model->render();
+}
+
+void VertexColourModelProgram::render(const GLenum primitive, const std::vector<GLfloat> &vertices, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette) {
+    FrameProfiler::Scope profileScope("VertexColourModelProgram::render");
+    bind(worldToClip, dest, destPalette);
+    qApp->renderManager.drawTransient(primitive, {2, 4}, vertices.data(), static_cast<GLsizei>(vertices.size() / 6));
+}
+
+void VertexColourModelProgram::bind(const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette) {
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, worldToClip.constData());
+    glUniformMatrix4fv(uniformLocation("worldToClip"), 1, false, worldToClip.constData());
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
-
-    model->render();
 }
 
 void BoundedPrimitiveProgram::render(const std::array<Vec2, 2> &points, const Colour &colour, const Mat4 &toolSpaceTransform, const Mat4 &worldToClip, Buffer * const dest, const Buffer * const destPalette)
 {
+    FrameProfiler::Scope profileScope("BoundedPrimitiveProgram::render");
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
     // TODO: Do geometry transform in different spaces then final transform? Like with dabs.
     bool snap = false;
@@ -286,14 +794,14 @@ void BoundedPrimitiveProgram::render(const std::array<Vec2, 2> &points, const Co
     // worldToTool -> toolToBuffer -> bufferToClip ?
     // or
     // worldToBuffer -> bufferToTool -> toolToBuffer (inverted) -> BufferToClip ? When no tool space can still use same other matrices
-    glUniformMatrix4fv(program.uniformLocation("worldToBuffer"), 1, false, Mat4().constData());
-    glUniformMatrix4fv(program.uniformLocation("bufferToTool"), 1, false, Mat4().constData());
-    glUniformMatrix4fv(program.uniformLocation("BufferToClip"), 1, false, Mat4().constData());
+    glUniformMatrix4fv(uniformLocation("worldToBuffer"), 1, false, Mat4().constData());
+    glUniformMatrix4fv(uniformLocation("bufferToTool"), 1, false, Mat4().constData());
+    glUniformMatrix4fv(uniformLocation("BufferToClip"), 1, false, Mat4().constData());
 
-    glUniformMatrix4fv(program.uniformLocation("matrix"), 1, false, (worldToClip * toolSpaceTransform.inverted() *  pointsMatrix).constData());
+    glUniformMatrix4fv(uniformLocation("matrix"), 1, false, (worldToClip * toolSpaceTransform.inverted() *  pointsMatrix).constData());
 
-    glUniform4fv(program.uniformLocation("rgba"), 1, colour.rgba.data());
-    glUniform1ui(program.uniformLocation("index"), colour.index);
+    glUniform4fv(uniformLocation("rgba"), 1, colour.rgba.data());
+    glUniform1ui(uniformLocation("index"), colour.index);
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
 
@@ -455,6 +963,7 @@ void main(void)
 
 void ContourStencilProgram::render(const std::vector<Stroke::Point> &points, const Mat4 &worldToClip, Buffer *const dest)
 {
+    FrameProfiler::Scope profileScope("ContourStencilProgram::render");
     if (points.size() < 2) return;
 
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
@@ -467,13 +976,12 @@ void ContourStencilProgram::render(const std::vector<Stroke::Point> &points, con
     glClear(GL_STENCIL_BUFFER_BIT);
 
     // Draw stencil
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, storageBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, points.size() * sizeof(Stroke::Point), points.data(), GL_STATIC_DRAW);
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 0, points.data(), static_cast<GLsizeiptr>(points.size() * sizeof(Stroke::Point)));
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, worldToClip.constData());
+    glUniformMatrix4fv(uniformLocation("worldToClip"), 1, false, worldToClip.constData());
 
     glDrawArraysInstanced(GL_LINES, 1, 2, points.size() - 2);
 
@@ -567,20 +1075,20 @@ Colour src(void) {
 
 void SmoothQuadProgram::render(const std::vector<vec2> &points, const Mat4 &worldToClip, Buffer * const dest, const Buffer * const destPalette)
 {
+    FrameProfiler::Scope profileScope("SmoothQuadProgram::render");
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, worldToClip.constData());
+    glUniformMatrix4fv(uniformLocation("worldToClip"), 1, false, worldToClip.constData());
 
     Mat4 clipToWindow = viewportToClipTransform(dest->size()).inverted();
-    glUniformMatrix4fv(program.uniformLocation("clipToWindow"), 1, false, clipToWindow.constData());
+    glUniformMatrix4fv(uniformLocation("clipToWindow"), 1, false, clipToWindow.constData());
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, storageBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, points.size() * sizeof(Stroke::Point), points.data(), GL_STATIC_DRAW);
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 0, points.data(), static_cast<GLsizeiptr>(points.size() * sizeof(vec2)));
 
     glDrawArrays(GL_LINES_ADJACENCY, 0, 4);
 }
@@ -765,17 +1273,17 @@ Colour src(void) {
 
 void LineProgram::render(const std::vector<LineProgram::Point> &points, const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette)
 {
+    FrameProfiler::Scope profileScope("LineProgram::render");
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, worldToClip.constData());
+    glUniformMatrix4fv(uniformLocation("worldToClip"), 1, false, worldToClip.constData());
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, storageBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, points.size() * sizeof(LineProgram::Point), points.data(), GL_STATIC_DRAW);
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 0, points.data(), static_cast<GLsizeiptr>(points.size() * sizeof(LineProgram::Point)));
 
     glDrawArraysInstanced(GL_LINES_ADJACENCY, 0, 4, points.size() - 3);
 }
@@ -835,20 +1343,20 @@ Colour src(void) {
 
 void PixelLineProgram::render(const std::vector<Stroke::Point> &points, const Colour &colour, const Mat4 &worldToBuffer, const Mat4 &bufferToClip, Buffer *const dest, const Buffer *const destPalette)
 {
+    FrameProfiler::Scope profileScope("PixelLineProgram::render");
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniformMatrix4fv(program.uniformLocation("worldToBuffer"), 1, false, worldToBuffer.constData());
-    glUniformMatrix4fv(program.uniformLocation("bufferToClip"), 1, false, bufferToClip.constData());
-    glUniform4fv(program.uniformLocation("colour.rgba"), 1, colour.rgba.data());
-    glUniform1ui(program.uniformLocation("colour.index"), colour.index);
+    setUniform(worldToBufferUniform, worldToBuffer);
+    setUniform(bufferToClipUniform, bufferToClip);
+    setUniform(colourRgbaUniform, colour.rgba);
+    setUniform(colourIndexUniform, colour.index);
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, storageBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, points.size() * sizeof(Stroke::Point), points.data(), GL_STATIC_DRAW);
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 0, points.data(), static_cast<GLsizeiptr>(points.size() * sizeof(Stroke::Point)));
 
     glDrawArraysInstanced(GL_LINES, 0, 2, points.size() - 1);
     glDrawArrays(GL_POINTS, points.size() - 1, 1);
@@ -1013,10 +1521,11 @@ Colour src(void) {
 
 void BrushDabProgram::render(const std::vector<Stroke::Point> &points, const Brush::Dab &dab, const Colour &colour, const Mat4 &worldToBuffer, const Mat4 &bufferToClip, Buffer *const dest, const Buffer *const destPalette)
 {
+    FrameProfiler::Scope profileScope("BrushDabProgram::render");
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
@@ -1045,11 +1554,8 @@ void BrushDabProgram::render(const std::vector<Stroke::Point> &points, const Bru
              dab.opacity,
         },
     };
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBuffer);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformData), &uniformData, GL_STATIC_DRAW);
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, storageBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, points.size() * sizeof(Stroke::Point), points.data(), GL_STATIC_DRAW);
+    qApp->renderManager.streamBuffer.bind(GL_UNIFORM_BUFFER, 0, &uniformData, sizeof(UniformData));
+    qApp->renderManager.streamBuffer.bind(GL_SHADER_STORAGE_BUFFER, 0, points.data(), static_cast<GLsizeiptr>(points.size() * sizeof(Stroke::Point)));
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "dest", 0, dest, destIndexed, 1, destPalette);
 
@@ -1098,9 +1604,10 @@ void main(void) {
 
 void BackgroundCheckersProgram::render(const Mat4 &transform)
 {
+    FrameProfiler::Scope profileScope("BackgroundCheckersProgram::render");
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
-    glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, transform.inverted().constData());
+    OpenGLState::current().useProgram(program.programId());
+    glUniformMatrix4fv(uniformLocation("worldToClip"), 1, false, transform.inverted().constData());
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
@@ -1136,20 +1643,20 @@ Colour src(void) {
 
 void ColourPlaneProgram::render(const Colour &colour, const int xComponent, const int yComponent, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const quantisePalette)
 {
+    FrameProfiler::Scope profileScope("ColourPlaneProgram::render");
     Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    UniformData uniformData = {colour, {xComponent, yComponent}};
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBuffer);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(uniformData), &uniformData, GL_DYNAMIC_DRAW);
+    const UniformData uniformData = {colour, {xComponent, yComponent}};
+    qApp->renderManager.streamBuffer.bind(GL_UNIFORM_BUFFER, 0, &uniformData, sizeof(UniformData));
 
     Mat4 objectMatrix;
     objectMatrix.scale(1.0, 1.0);
-    glUniformMatrix4fv(program.uniformLocation("object"), 1, false, objectMatrix.constData());
+    glUniformMatrix4fv(uniformLocation("object"), 1, false, objectMatrix.constData());
 
-    glUniformMatrix4fv(program.uniformLocation("transform"), 1, false, worldToClip.constData());
+    glUniformMatrix4fv(uniformLocation("transform"), 1, false, worldToClip.constData());
 
     qApp->renderManager.bindBufferShaderPart(program, "dest", 0, dest);
     if (quantise && quantisePalette) {
@@ -1198,14 +1705,15 @@ void main(void) {
 
 void ColourPaletteProgram::render(const Buffer *const palette, const QSize &cells, const Mat4 &worldToClip, Buffer *const dest)
 {
+    FrameProfiler::Scope profileScope("ColourPaletteProgram::render");
     if (palette) {
         Q_ASSERT(QOpenGLContext::currentContext() == &qApp->renderManager.context);
 
         QOpenGLShaderProgram &program = this->program();
-        program.bind();
+        OpenGLState::current().useProgram(program.programId());
 
-        glUniformMatrix4fv(program.uniformLocation("worldToClip"), 1, false, RenderManager::unitToClipTransform.constData());
-        glUniform2i(program.uniformLocation("cells"), cells.width(), cells.height());
+        glUniformMatrix4fv(uniformLocation("worldToClip"), 1, false, RenderManager::unitToClipTransform.constData());
+        glUniform2i(uniformLocation("cells"), cells.width(), cells.height());
 
         qApp->renderManager.bindBufferShaderPart(program, "srcPalPalette", 0, palette);
         qApp->renderManager.bindBufferShaderPart(program, "dest", 1, dest);
@@ -1247,14 +1755,14 @@ void main() {
 Colour ColourPalettePickProgram::pick(const Buffer *const palette, const QSize &cells, const Vec2 &pos)
 {
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniform2i(program.uniformLocation("cells"), cells.width(), cells.height());
+    glUniform2i(uniformLocation("cells"), cells.width(), cells.height());
 
     qApp->renderManager.bindBufferShaderPart(program, "srcPalPalette", 0, palette);
 
-    glUniform2fv(program.uniformLocation("pos"), 1, (GLfloat *)&pos);
-//    glUniform2f(program.uniformLocation("pos"), pos.x(), pos.y());
+    glUniform2fv(uniformLocation("pos"), 1, (GLfloat *)&pos);
+//    glUniform2f(uniformLocation("pos"), pos.x(), pos.y());
 
     Colour colour;
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, storageBuffer);
@@ -1303,7 +1811,7 @@ void main() {
 
 Colour ColourConversionProgram::convert(const Colour &colour) {
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
     Colour convert;
     convert = colour;
@@ -1353,10 +1861,10 @@ void main() {
 Colour ColourPickProgram::pick(const Buffer *const src, const Buffer *const srcPalette, const Vec2 &pos)
 {
     QOpenGLShaderProgram &program = this->program();
-    program.bind();
+    OpenGLState::current().useProgram(program.programId());
 
-    glUniform2fv(program.uniformLocation("pos"), 1, (GLfloat *)&pos);
-//    glUniform2f(program.uniformLocation("pos"), pos.x(), pos.y());
+    glUniform2fv(uniformLocation("pos"), 1, (GLfloat *)&pos);
+//    glUniform2f(uniformLocation("pos"), pos.x(), pos.y());
 
     qApp->renderManager.bindIndexedBufferShaderPart(program, "srcBuffer", 0, src, indexed, 1, srcPalette);
 
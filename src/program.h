@@ -5,7 +5,13 @@
 
 #include <typeindex>
 #include <QOpenGLShaderProgram>
+#include <QMutex>
+#include <cstddef>
 #include <deque>
+#include <type_traits>
+#include <unordered_map>
+#include <set>
+#include <vector>
 #include <functional>
 
 #include "types.h"
@@ -13,6 +19,7 @@
 #include "stroke.h"
 #include "brush.h"
 #include "model.h"
+#include "tracer.h"
 #include "utils.h"
 
 namespace GfxPaint {
@@ -191,6 +198,61 @@ struct ComponentProgram {
     }
 };
 
+// Generated source per stage, for compiling away from the program that generated it
+typedef std::vector<std::pair<QOpenGLShader::ShaderTypeBit, QString>> ProgramSources;
+
+// Active uniforms and uniform blocks of a linked program, read once so draws find locations without GL calls
+class ProgramReflection {
+public:
+    struct Uniform {
+        GLint location;
+        GLenum type;
+        GLint size;
+    };
+    struct UniformBlock {
+        GLuint index;
+        GLint dataSize;
+    };
+
+    // Needs a current context sharing with the one the program was linked in
+    explicit ProgramReflection(const GLuint program);
+
+    // -1 for inactive uniforms, like glGetUniformLocation
+    GLint uniformLocation(const QString &name) const {
+        const auto found = uniforms.find(name);
+        return found != uniforms.end() ? found->second.location : -1;
+    }
+    const Uniform *uniform(const QString &name) const {
+        const auto found = uniforms.find(name);
+        return found != uniforms.end() ? &found->second : nullptr;
+    }
+    const UniformBlock *uniformBlock(const QString &name) const {
+        const auto found = uniformBlocks.find(name);
+        return found != uniformBlocks.end() ? &found->second : nullptr;
+    }
+
+protected:
+    std::unordered_map<QString, Uniform> uniforms;
+    std::unordered_map<QString, UniformBlock> uniformBlocks;
+};
+
+// Uniform located once per linked program, its type picks the glUniform call in Program::setUniform
+template <typename T>
+class UniformHandle {
+public:
+    explicit UniformHandle(const QString &name) :
+        name(name), program(0), location(-1)
+    {}
+
+    const QString name;
+
+private:
+    friend class Program;
+
+    GLuint program;
+    GLint location;
+};
+
 class Program : protected OpenGL {
 public:
     typedef std::pair<std::type_index, std::list<int>> Key;
@@ -203,8 +265,33 @@ public:
     virtual ~Program();
 
     QOpenGLShaderProgram &program();
+    // Requests a background compile if needed and returns false until the program is linked,
+    // callers draw with a fallback or skip their draw meanwhile instead of waiting on program()
+    bool isReady();
+    // Starts a background compile ahead of first use
+    void prepare();
+    ProgramSources sources() const;
 
 protected:
+    // Table of the linked program, available after program()
+    const ProgramReflection &reflection();
+    GLint uniformLocation(const QString &name) { return reflection().uniformLocation(name); }
+    template <typename T>
+    void setUniform(UniformHandle<T> &uniform, const T &value) {
+        const GLuint programId = program().programId();
+        if (uniform.program != programId) {
+            uniform.program = programId;
+            uniform.location = reflection().uniformLocation(uniform.name);
+        }
+        if constexpr (std::is_same_v<T, GLint>) glUniform1i(uniform.location, value);
+        else if constexpr (std::is_same_v<T, GLuint>) glUniform1ui(uniform.location, value);
+        else if constexpr (std::is_same_v<T, GLfloat>) glUniform1f(uniform.location, value);
+        else if constexpr (std::is_same_v<T, QPoint>) glUniform2i(uniform.location, value.x(), value.y());
+        else if constexpr (std::is_same_v<T, Rgba>) glUniform4fv(uniform.location, 1, value.data());
+        else if constexpr (std::is_same_v<T, Mat4>) glUniformMatrix4fv(uniform.location, 1, false, value.constData());
+        else static_assert(!sizeof(T), "No glUniform call for this type");
+    }
+
     void updateKey(const std::type_index type, const std::list<int> &values) {
         key.first = type;
         std::list<int> &list = key.second;
@@ -227,14 +314,17 @@ public:
         updateKey(typeid(this), {});
 
         glGenBuffers(1, &storageBuffer);
+        GLObjectRegistry::add(GLObjectRegistry::Type::StorageBuffer, storageBuffer);
     }
     ToolProgram(const ToolProgram &other) :
         Program(other),
         storageBuffer(0)
     {
         glGenBuffers(1, &storageBuffer);
+        GLObjectRegistry::add(GLObjectRegistry::Type::StorageBuffer, storageBuffer);
     }
     virtual ~ToolProgram() override {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::StorageBuffer, storageBuffer);
         glDeleteBuffers(1, &storageBuffer);
     }
 
@@ -253,6 +343,7 @@ public:
         updateKey(typeid(this), {static_cast<int>(destFormat.componentType), destFormat.componentSize, destFormat.componentCount, static_cast<int>(destIndexed), static_cast<int>(destPaletteFormat.componentType), destPaletteFormat.componentSize, destPaletteFormat.componentCount, blendMode, composeMode});
 
         glGenBuffers(1, &uniformBuffer);
+        GLObjectRegistry::add(GLObjectRegistry::Type::UniformBuffer, uniformBuffer);
     }
     RenderProgram(const RenderProgram &other) :
         Program(other),
@@ -261,8 +352,10 @@ public:
         uniformBuffer(0)
     {
         glGenBuffers(1, &uniformBuffer);
+        GLObjectRegistry::add(GLObjectRegistry::Type::UniformBuffer, uniformBuffer);
     }
     virtual ~RenderProgram() override {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::UniformBuffer, uniformBuffer);
         glDeleteBuffers(1, &uniformBuffer);
     }
 
@@ -301,63 +394,237 @@ protected:
 
 class BufferProgram : public RenderProgram {
 public:
-    BufferProgram(const Buffer::Format srcFormat, const bool srcIndexed, const Buffer::Format srcPaletteFormat, const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
+    // Instanced programs draw many buffers sharing one texture, each placed by its own instance data
+    struct InstanceData {
+        GLfloat worldToClip[16];
+        GLfloat origin[2];
+        GLfloat size[2];
+    };
+    static_assert(sizeof(InstanceData) == 80, "InstanceData must match the std430 layout");
+
+    BufferProgram(const Buffer::Format srcFormat, const bool srcIndexed, const Buffer::Format srcPaletteFormat, const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode, const bool srcPyramid = false, const bool instanced = false) :
         RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
-        srcFormat(srcFormat), srcIndexed(srcIndexed), srcPaletteFormat(srcPaletteFormat)
+        srcFormat(srcFormat), srcIndexed(srcIndexed), srcPaletteFormat(srcPaletteFormat), srcPyramid(srcPyramid), instanced(instanced)
     {
-        updateKey(typeid(this), {static_cast<int>(srcFormat.componentType), srcFormat.componentSize, srcFormat.componentCount, static_cast<int>(srcIndexed), static_cast<int>(srcPaletteFormat.componentType), srcPaletteFormat.componentSize, srcPaletteFormat.componentCount});
+        updateKey(typeid(this), {static_cast<int>(srcFormat.componentType), srcFormat.componentSize, srcFormat.componentCount, static_cast<int>(srcIndexed), static_cast<int>(srcPaletteFormat.componentType), srcPaletteFormat.componentSize, srcPaletteFormat.componentCount, static_cast<int>(srcPyramid), static_cast<int>(instanced)});
     }
     BufferProgram(const BufferProgram &other) :
         RenderProgram(other),
-        srcFormat(other.srcFormat), srcIndexed(other.srcIndexed), srcPaletteFormat(other.srcPaletteFormat)
+        srcFormat(other.srcFormat), srcIndexed(other.srcIndexed), srcPaletteFormat(other.srcPaletteFormat), srcPyramid(other.srcPyramid), instanced(other.instanced)
     {}
 
-    void render(Buffer *const src, const Buffer *const srcPalette, const Colour &srcTransparent, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette, const Colour &destTransparent);
+    // Level 0 samples src directly, higher levels sample the src pyramid texture
+    void render(Buffer *const src, const Buffer *const srcPalette, const Colour &srcTransparent, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette, const Colour &destTransparent, const GLuint srcPyramidTexture = 0, const int srcPyramidLevel = 0);
+    // Instance origins are in src texture texels, so src only provides the texture
+    void renderInstances(const std::vector<InstanceData> &instances, const Buffer *const src, const Buffer *const srcPalette, const Colour &srcTransparent, Buffer *const dest, const Buffer *const destPalette, const Colour &destTransparent);
 
 protected:
-    struct UniformData {
-        mat4 matrix alignas(64);
-        Colour transparent alignas(16);
+    static constexpr GLuint drawDataBinding = 4;
+
+    // Every per-draw parameter, written to the stream buffer before each draw
+    struct DrawData {
+        mat4 transform alignas(64);
+        mat4 object alignas(64);
+        Colour srcTransparent alignas(16);
+        Colour destTransparent alignas(16);
+        GLint srcBufferOrigin[2] alignas(8);
+        GLint destOrigin[2] alignas(8);
+        GLint srcBufferPyramidLevel;
     };
+    static_assert(offsetof(DrawData, srcBufferPyramidLevel) == 208, "DrawData must match the std140 layout");
 
-    static QString uniformDataSrc(const QString &name, const GLint binding) {
+    static QString drawDataSrc(const GLuint binding) {
         QString src;
         src +=
 R"(
-layout(std140, binding = $BINDING) uniform $NAMEBufferUniformData {
-    mat4 matrix;
-    Colour transparent;
-} $NAMEBufferData;
+layout(std140, binding = $BINDING) uniform BufferDrawData {
+    mat4 transform;
+    mat4 object;
+    Colour srcTransparent;
+    Colour destTransparent;
+    ivec2 srcBufferOrigin;
+    ivec2 destOrigin;
+    int srcBufferPyramidLevel;
+} drawData;
 )";
         stringMultiReplace(src, {
-            {"$NAME", name},
             {"$BINDING", QString::number(binding)},
         });
         return src;
     }
 
+    void updateDrawData(const DrawData &drawData);
+
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
 
     const Buffer::Format srcFormat;
     const bool srcIndexed;
     const Buffer::Format srcPaletteFormat;
+    const bool srcPyramid;
+    const bool instanced;
+};
+
+// Draws like BufferProgram with format scales, palettes and modes set by uniforms, so one program per combination
+// of sampler types covers every permutation. Used while the specialised program compiles in the background
+class BufferUberProgram : public Program {
+public:
+    BufferUberProgram(const Buffer::Format srcFormat, const Buffer::Format srcPaletteFormat, const Buffer::Format destFormat, const Buffer::Format destPaletteFormat, const bool srcPyramid = false, const bool instanced = false) :
+        Program(),
+        srcFormat(srcFormat), srcPaletteFormat(srcPaletteFormat), destFormat(destFormat), destPaletteFormat(destPaletteFormat), srcPyramid(srcPyramid), instanced(instanced)
+    {
+        updateKey(typeid(this), {samplerKey(srcFormat), samplerKey(srcPaletteFormat), samplerKey(destFormat), samplerKey(destPaletteFormat), static_cast<int>(srcPyramid), static_cast<int>(instanced)});
+    }
+    BufferUberProgram(const BufferUberProgram &other) :
+        Program(other),
+        srcFormat(other.srcFormat), srcPaletteFormat(other.srcPaletteFormat), destFormat(other.destFormat), destPaletteFormat(other.destPaletteFormat), srcPyramid(other.srcPyramid), instanced(other.instanced)
+    {}
+
+    // Formats only differing in what is set by uniforms share a program
+    static int samplerKey(const Buffer::Format &format) {
+        switch (format.componentType) {
+        case Buffer::Format::ComponentType::UInt: return 1;
+        case Buffer::Format::ComponentType::SInt: return 2;
+        default: return 0;
+        }
+    }
+
+    void render(Buffer *const src, const bool srcIndexed, const Buffer *const srcPalette, const Colour &srcTransparent, const Mat4 &worldToClip, Buffer *const dest, const bool destIndexed, const Buffer *const destPalette, const Colour &destTransparent, const int blendMode, const int composeMode, const GLuint srcPyramidTexture = 0, const int srcPyramidLevel = 0);
+    void renderInstances(const std::vector<BufferProgram::InstanceData> &instances, const Buffer *const src, const bool srcIndexed, const Buffer *const srcPalette, const Colour &srcTransparent, Buffer *const dest, const bool destIndexed, const Buffer *const destPalette, const Colour &destTransparent, const int blendMode, const int composeMode);
+
+protected:
+    virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
+    QOpenGLShaderProgram &bind(const Buffer *const src, const bool srcIndexed, const Buffer *const srcPalette, const Colour &srcTransparent, Buffer *const dest, const bool destIndexed, const Buffer *const destPalette, const Colour &destTransparent, const int blendMode, const int composeMode);
+
+    const Buffer::Format srcFormat;
+    const Buffer::Format srcPaletteFormat;
+    const Buffer::Format destFormat;
+    const Buffer::Format destPaletteFormat;
+    const bool srcPyramid;
+    const bool instanced;
+
+    // Mode and per-draw uniforms set on every draw
+    struct Uniforms {
+        UniformHandle<GLint> blendModeIndex{"blendModeIndex"};
+        UniformHandle<GLint> composeModeIndex{"composeModeIndex"};
+        UniformHandle<Rgba> srcTransparentColour{"srcTransparent.colour"};
+        UniformHandle<GLuint> srcTransparentIndex{"srcTransparent.index"};
+        UniformHandle<Rgba> destTransparentColour{"destTransparent.colour"};
+        UniformHandle<GLuint> destTransparentIndex{"destTransparent.index"};
+        UniformHandle<Mat4> object{"object"};
+        UniformHandle<Mat4> transform{"transform"};
+        UniformHandle<QPoint> srcBufferOrigin{"srcBufferOrigin"};
+    } uniforms;
+};
+
+// Averages each 2x2 block of source texels into one texel of the bound framebuffer
+class BufferPyramidProgram : public Program {
+public:
+    BufferPyramidProgram(const Buffer::Format srcFormat) :
+        Program(),
+        srcFormat(srcFormat)
+    {
+        updateKey(typeid(this), {static_cast<int>(srcFormat.componentType), srcFormat.componentSize, srcFormat.componentCount});
+    }
+    BufferPyramidProgram(const BufferPyramidProgram &other) :
+        Program(other),
+        srcFormat(other.srcFormat)
+    {}
+
+    void render(const GLuint srcTexture, const int srcLevel, const QSize &srcSize);
+
+protected:
+    virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
+
+    const Buffer::Format srcFormat;
+};
+
+// Composites a batch of layers sharing a sampler type into dest in one compute dispatch,
+// each invocation blends every layer covering its pixel before a single image store
+class CompositorProgram : public Program {
+public:
+    static constexpr int maxLayers = 16;
+    static constexpr int tileSize = 16;
+
+    struct Layer {
+        const Buffer *buffer;
+        Mat4 worldToClip;
+        int blendMode;
+        int composeMode;
+    };
+
+    // Layers of a texture array batch are sampled by layer index from the array texture with no limit on their count
+    CompositorProgram(const Buffer::Format layerFormat, const bool layerArray, const Buffer::Format destFormat) :
+        Program(),
+        layerFormat(layerFormat), layerArray(layerArray), destFormat(destFormat)
+    {
+        updateKey(typeid(this), {static_cast<int>(layerFormat.componentType), layerArray, static_cast<int>(destFormat.componentType), destFormat.componentSize, destFormat.componentCount});
+    }
+    CompositorProgram(const CompositorProgram &other) :
+        Program(other),
+        layerFormat(other.layerFormat), layerArray(other.layerArray), destFormat(other.destFormat)
+    {}
+
+    // Layers sharing one sampler type can be batched together
+    static bool compatible(const Buffer::Format &a, const Buffer::Format &b) {
+        return a.shaderSamplerType() == b.shaderSamplerType();
+    }
+
+    void render(const std::vector<Layer> &layers, Buffer *const dest, const QRect &scissor);
+
+protected:
+    static constexpr GLuint dispatchDataBinding = 1;
+
+    // Every per-dispatch parameter, written to the stream buffer before each dispatch
+    struct DispatchData {
+        GLint scissor[4] alignas(16);
+        GLint origin[2] alignas(8);
+        GLint destSize[2] alignas(8);
+        GLint layerCount;
+    };
+    static_assert(offsetof(DispatchData, layerCount) == 32, "DispatchData must match the std140 layout");
+
+    struct LayerData {
+        GLfloat clipToBuffer[16];
+        GLint bounds[4];
+        GLint size[2];
+        GLfloat scale;
+        GLint blendMode;
+        GLint composeMode;
+        GLint arrayLayer;
+        GLint origin[2];
+    };
+    static_assert(sizeof(LayerData) == 112, "LayerData must match the std430 layout");
+
+    virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
+
+    const Buffer::Format layerFormat;
+    const bool layerArray;
+    const Buffer::Format destFormat;
 };
 
 class SingleColourModelProgram : public RenderProgram {
 public:
     SingleColourModelProgram(const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
-        RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode)
+        RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
+        colourUniform("colour"), worldToClipUniform("worldToClip")
     {
         updateKey(typeid(this), {});
     }
     SingleColourModelProgram(const SingleColourModelProgram &other) :
-        RenderProgram(other)
+        RenderProgram(other),
+        colourUniform("colour"), worldToClipUniform("worldToClip")
     {}
 
     void render(Model *const model, const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
+    // Transient geometry, streamed for this draw only
+    void render(const GLenum primitive, const std::vector<vec2> &vertices, const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
 
 protected:
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
+    void bind(const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
+
+    UniformHandle<Rgba> colourUniform;
+    UniformHandle<Mat4> worldToClipUniform;
 };
 
 class VertexColourModelProgram : public RenderProgram {
@@ -372,8 +639,12 @@ public:
     {}
 
     void render(Model *const model, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
+    // Interleaved position and colour vertices, drawn from the stream buffer
+    void render(const GLenum primitive, const std::vector<GLfloat> &vertices, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
 
 protected:
+    void bind(const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
+
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
 };
 
@@ -447,27 +718,19 @@ class ContourStencilProgram : public RenderProgram {
 public:
     ContourStencilProgram(const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
         RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
-        storageBuffer(0), stencilTexture(0)
+        stencilTexture(0)
     {
         updateKey(typeid(this), {});
-
-        glGenBuffers(1, &storageBuffer);
     }
     ContourStencilProgram(const ContourStencilProgram &other) :
         RenderProgram(other),
-        storageBuffer(0), stencilTexture(0)
-    {
-        glGenBuffers(1, &storageBuffer);
-    }
+        stencilTexture(0)
+    {}
 
-    virtual ~ContourStencilProgram() override {
-        glDeleteBuffers(1, &storageBuffer);
-    }
     void render(const std::vector<Stroke::Point> &points, const Mat4 &worldToClip, Buffer *const dest);
     void postRender();
 
 protected:
-    GLuint storageBuffer;
     GLuint stencilTexture;
 
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
@@ -476,29 +739,17 @@ protected:
 class SmoothQuadProgram : public RenderProgram {
 public:
     SmoothQuadProgram(const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
-        RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
-        storageBuffer(0)
+        RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode)
     {
         updateKey(typeid(this), {});
-
-        glGenBuffers(1, &storageBuffer);
     }
     SmoothQuadProgram(const SmoothQuadProgram &other) :
-        RenderProgram(other),
-        storageBuffer(0)
-    {
-        glGenBuffers(1, &storageBuffer);
-    }
-
-    virtual ~SmoothQuadProgram() override {
-        glDeleteBuffers(1, &storageBuffer);
-    }
+        RenderProgram(other)
+    {}
 
     void render(const std::vector<vec2> &points, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
 
 protected:
-    GLuint storageBuffer;
-
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
 };
 
@@ -512,29 +763,17 @@ public:
     };
 
     LineProgram(const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
-        RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
-        storageBuffer(0)
+        RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode)
     {
         updateKey(typeid(this), {});
-
-        glGenBuffers(1, &storageBuffer);
     }
     LineProgram(const LineProgram &other) :
-        RenderProgram(other),
-        storageBuffer(0)
-    {
-        glGenBuffers(1, &storageBuffer);
-    }
-
-    virtual ~LineProgram() override {
-        glDeleteBuffers(1, &storageBuffer);
-    }
+        RenderProgram(other)
+    {}
 
     void render(const std::vector<Point> &points, const Colour &colour, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const destPalette);
 
 protected:
-    GLuint storageBuffer;
-
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
 };
 
@@ -566,27 +805,22 @@ class PixelLineProgram : public RenderProgram {
 public:
     PixelLineProgram(const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
         RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
-        storageBuffer(0)
+        worldToBufferUniform("worldToBuffer"), bufferToClipUniform("bufferToClip"), colourRgbaUniform("colour.rgba"), colourIndexUniform("colour.index")
     {
         updateKey(typeid(this), {});
-
-        glGenBuffers(1, &storageBuffer);
     }
     PixelLineProgram(const PixelLineProgram &other) :
         RenderProgram(other),
-        storageBuffer(0)
-    {
-        glGenBuffers(1, &storageBuffer);
-    }
-
-    virtual ~PixelLineProgram() override {
-        glDeleteBuffers(1, &storageBuffer);
-    }
+        worldToBufferUniform("worldToBuffer"), bufferToClipUniform("bufferToClip"), colourRgbaUniform("colour.rgba"), colourIndexUniform("colour.index")
+    {}
 
     void render(const std::vector<Stroke::Point> &points, const Colour &colour, const Mat4 &worldToBuffer, const Mat4 &bufferToClip, Buffer *const dest, const Buffer *const destPalette);
 
 protected:
-    GLuint storageBuffer;
+    UniformHandle<Mat4> worldToBufferUniform;
+    UniformHandle<Mat4> bufferToClipUniform;
+    UniformHandle<Rgba> colourRgbaUniform;
+    UniformHandle<GLuint> colourIndexUniform;
 
     virtual QString generateSource(QOpenGLShader::ShaderTypeBit stage) const override;
 };
@@ -595,21 +829,14 @@ class BrushDabProgram : public RenderProgram {
 public:
     BrushDabProgram(const Brush::Dab::Type type, const int metric, const Buffer::Format destFormat, const bool destIndexed, const Buffer::Format destPaletteFormat, const int blendMode, const int composeMode) :
         RenderProgram(destFormat, destIndexed, destPaletteFormat, blendMode, composeMode),
-        type(type), metric(metric), storageBuffer(0)
+        type(type), metric(metric)
     {
         updateKey(typeid(this), {static_cast<int>(type), metric});
-
-        glGenBuffers(1, &storageBuffer);
     }
     BrushDabProgram(const BrushDabProgram &other) :
         RenderProgram(other),
         type(other.type), metric(other.metric)
-    {
-        glGenBuffers(1, &storageBuffer);
-    }
-    virtual ~BrushDabProgram() override {
-        glDeleteBuffers(1, &storageBuffer);
-    }
+    {}
 
     void render(const std::vector<Stroke::Point> &points, const Brush::Dab &dab, const Colour &colour, const Mat4 &worldToBuffer, const Mat4 &bufferToClip, Buffer *const dest, const Buffer *const destPalette);
 
@@ -618,8 +845,6 @@ protected:
 
     const Brush::Dab::Type type;
     const int metric;
-
-    GLuint storageBuffer;
 };
 
 class ColourPlaneProgram : public Program {
@@ -629,30 +854,17 @@ public:
         colourSpace(colourSpace), useXAxis(useXAxis), useYAxis(useYAxis),
         destFormat(destFormat),
         blendMode(blendMode),
-        quantise(quantise), quantisePaletteFormat(quantisePaletteFormat),
-        uniformBuffer(0), uniformData()
+        quantise(quantise), quantisePaletteFormat(quantisePaletteFormat)
     {
         updateKey(typeid(this), {static_cast<int>(colourSpace), useXAxis, useYAxis, static_cast<int>(destFormat.componentType), destFormat.componentSize, destFormat.componentCount, blendMode, quantise, static_cast<int>(quantisePaletteFormat.componentType), quantisePaletteFormat.componentSize, quantisePaletteFormat.componentCount});
-
-        glGenBuffers(1, &uniformBuffer);
-        glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBuffer);
     }
     ColourPlaneProgram(const ColourPlaneProgram &other) :
         Program(other),
         colourSpace(other.colourSpace), useXAxis(other.useXAxis), useYAxis(other.useYAxis),
         destFormat(other.destFormat),
         blendMode(other.blendMode),
-        quantise(other.quantise), quantisePaletteFormat(other.quantisePaletteFormat),
-        uniformBuffer(0), uniformData()
-    {
-        glGenBuffers(1, &uniformBuffer);
-        glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
-        glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformData), &uniformData, GL_DYNAMIC_DRAW);
-    }
-    virtual ~ColourPlaneProgram() override {
-        glDeleteBuffers(1, &uniformBuffer);
-    }
+        quantise(other.quantise), quantisePaletteFormat(other.quantisePaletteFormat)
+    {}
 
     void render(const Colour &colour, const int xComponent, const int yComponent, const Mat4 &worldToClip, Buffer *const dest, const Buffer *const quantisePalette);
 
@@ -670,9 +882,6 @@ protected:
     const int blendMode;
     const bool quantise;
     const Buffer::Format quantisePaletteFormat;
-
-    GLuint uniformBuffer;
-    UniformData uniformData;
 };
 
 class ColourPaletteProgram : public Program {
@@ -715,6 +924,7 @@ public:
         glGenBuffers(1, &uniformBuffer);
         glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
         glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBuffer);
+        GLObjectRegistry::add(GLObjectRegistry::Type::UniformBuffer, uniformBuffer);
     }
     ColourPalettePickProgram(const ColourPalettePickProgram &other) :
         ToolProgram(other),
@@ -724,8 +934,10 @@ public:
         glGenBuffers(1, &uniformBuffer);
         glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
         glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBuffer);
+        GLObjectRegistry::add(GLObjectRegistry::Type::UniformBuffer, uniformBuffer);
     }
     virtual ~ColourPalettePickProgram() override {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::UniformBuffer, uniformBuffer);
         glDeleteBuffers(1, &uniformBuffer);
     }
 
@@ -789,15 +1001,30 @@ protected:
 class ProgramManager {
 public:
     explicit ProgramManager() :
-        programs()
+        programs(), pending(), prewarmed(), reflections(), reflectionsMutex(), m_notReadyCount(0)
     {
     }
     ~ProgramManager() {
+        clear();
+    }
+
+    // Deletes every program, grabbed or not
+    void clear() {
         for (auto &[key, value] : programs) {
-            delete value.first;
+            deleteProgram(value.first);
+        }
+        programs.clear();
+        for (auto &[keyString, value] : prewarmed) {
+            deleteProgram(value.second);
         }
+        prewarmed.clear();
+        QMutexLocker locker(&reflectionsMutex);
+        reflections.clear();
     }
 
+    // Built when a program is first grabbed, or on first use for programs compiled in the background
+    const ProgramReflection &reflection(const QOpenGLShaderProgram *const program);
+
     bool contains(const Program::Key &key) const {
         return programs.contains(key);
     }
@@ -806,7 +1033,9 @@ public:
         Q_ASSERT(contains(key) || createFunc);
         if (!contains(key)) {
             qDebug() << "Compile program:" << key.first.name() << key.second;////////////////////////
+            const Tracer::Scope traceScope("ProgramManager::grab", "compile", Tracer::isEnabled() ? QString(key.first.name()) : QString());
             programs[key] = std::make_pair(createFunc(), 0);
+            reflection(programs[key].first);
         }
         programs[key].second++;
         return programs[key].first;
@@ -815,13 +1044,55 @@ public:
         Q_ASSERT(programs.contains(key));
         programs[key].second--;
         if (programs[key].second == 0) {
-            delete programs[key].first;
+            {
+                QMutexLocker locker(&reflectionsMutex);
+                reflections.erase(programs[key].first);
+            }
+            deleteProgram(programs[key].first);
             programs.erase(key);
         }
     }
 
+    bool isPending(const Program::Key &key) const {
+        return pending.contains(key);
+    }
+    // Queues a compile on the program compiler, the program is added once linked
+    void request(const Program::Key &key, const ProgramSources &sources);
+    // Programs from the program compiler wait unreferenced until grabbed
+    void add(const Program::Key &key, QOpenGLShaderProgram *const program) {
+        pending.erase(key);
+        if (contains(key)) {
+            // Compiled synchronously meanwhile
+            deleteProgram(program);
+            return;
+        }
+        programs[key] = std::make_pair(program, 0);
+    }
+
+    // Programs loaded from the program cache by key string before their Program exists
+    void addPrewarmed(const QString &keyString, const QByteArray &hash, QOpenGLShaderProgram *const program) {
+        if (prewarmed.contains(keyString)) deleteProgram(prewarmed[keyString].second);
+        prewarmed[keyString] = std::make_pair(hash, program);
+    }
+    // Takes over a prewarmed program if its sources are unchanged, returns whether the program is present
+    bool adoptPrewarmed(const Program::Key &key, const std::function<ProgramSources()> &sourcesFunc);
+
+    // Draws skipped because their program wasn't ready, a change over a frame means the frame is incomplete
+    void countNotReady() { ++m_notReadyCount; }
+    quint64 notReadyCount() const { return m_notReadyCount; }
+
 protected:
+    static void deleteProgram(QOpenGLShaderProgram *const program) {
+        GLObjectRegistry::remove(GLObjectRegistry::Type::Program, program->programId());
+        delete program;
+    }
+
     std::map<Program::Key, std::pair<QOpenGLShaderProgram *, int>> programs;
+    std::set<Program::Key> pending;
+    std::map<QString, std::pair<QByteArray, QOpenGLShaderProgram *>> prewarmed;
+    std::unordered_map<const QOpenGLShaderProgram *, ProgramReflection> reflections;
+    QMutex reflectionsMutex;
+    quint64 m_notReadyCount;
 };
 
 } // namespace GfxPaint
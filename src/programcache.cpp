@@ -0,0 +1,234 @@
+#include "programcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <algorithm>
+
+namespace GfxPaint {
+
+ProgramCache::ProgramCache() :
+    directory(), driver(),
+    usage(), mutex(), m_stats()
+{
+}
+
+ProgramCache::~ProgramCache()
+{
+    Q_ASSERT(!isOpen());
+}
+
+void ProgramCache::open(QOpenGLContext *const context)
+{
+    OpenGLFunctions *const gl = context->extraFunctions();
+    GLint formatCount = 0;
+    gl->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    if (formatCount <= 0) {
+        qDebug() << "Program binaries not supported, programs aren't cached";
+        return;
+    }
+    driver = QByteArray(reinterpret_cast<const char *>(gl->glGetString(GL_VENDOR))) + '\n' +
+             QByteArray(reinterpret_cast<const char *>(gl->glGetString(GL_RENDERER))) + '\n' +
+             QByteArray(reinterpret_cast<const char *>(gl->glGetString(GL_VERSION)));
+
+    const QString path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/programs";
+    if (!QDir().mkpath(path)) return;
+    directory = path;
+    loadUsageLog();
+}
+
+void ProgramCache::close()
+{
+    if (!isOpen()) return;
+
+    saveUsageLog();
+    report();
+    directory.clear();
+}
+
+QString ProgramCache::keyString(const Program::Key &key)
+{
+    QString string = QString::fromLatin1(key.first.name());
+    for (const int value : key.second) {
+        string += ' ' + QString::number(value);
+    }
+    return string;
+}
+
+QByteArray ProgramCache::hash(const ProgramSources &sources) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(driver);
+    for (const auto &[stage, src] : sources) {
+        hash.addData(QByteArray::number(static_cast<int>(stage)));
+        hash.addData(src.toUtf8());
+    }
+    return hash.result().toHex();
+}
+
+QOpenGLShaderProgram *ProgramCache::link(const ProgramSources &sources, const QByteArray &hash)
+{
+    if (isOpen()) {
+        QOpenGLShaderProgram *const program = load(hash);
+        if (program) return program;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QOpenGLShaderProgram *const program = new QOpenGLShaderProgram();
+    program->create();
+    // Linked binaries are stored here, so Qt's own per program cache would only duplicate them
+    if (isOpen()) QOpenGLContext::currentContext()->extraFunctions()->glProgramParameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    for (const auto &[stage, src] : sources) {
+        program->addShaderFromSourceCode(stage, src);
+    }
+    program->link();
+    if (isOpen() && program->isLinked()) store(program, hash);
+    // Driver memory for the linked code is roughly its binary size
+    GLint binaryLength = 0;
+    if (program->isLinked()) QOpenGLContext::currentContext()->extraFunctions()->glGetProgramiv(program->programId(), GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    GLObjectRegistry::add(GLObjectRegistry::Type::Program, program->programId(), binaryLength);
+
+    QMutexLocker locker(&mutex);
+    ++m_stats.misses;
+    m_stats.compileTime += timer.nsecsElapsed();
+    return program;
+}
+
+QOpenGLShaderProgram *ProgramCache::load(const QByteArray &hash)
+{
+    QFile file(binaryPath(hash));
+    if (!file.open(QIODevice::ReadOnly)) return nullptr;
+
+    QElapsedTimer timer;
+    timer.start();
+    QDataStream stream(&file);
+    quint32 format = 0;
+    QByteArray binary;
+    stream >> format >> binary;
+    if (stream.status() != QDataStream::Ok || binary.isEmpty()) return nullptr;
+
+    QOpenGLShaderProgram *const program = new QOpenGLShaderProgram();
+    program->create();
+    QOpenGLContext::currentContext()->extraFunctions()->glProgramBinary(program->programId(), format, binary.constData(), binary.size());
+    // Without shaders attached link() only checks the status left by glProgramBinary
+    if (!program->link()) {
+        // Rejected by a driver update that kept its version string
+        delete program;
+        file.remove();
+        return nullptr;
+    }
+    GLObjectRegistry::add(GLObjectRegistry::Type::Program, program->programId(), binary.size());
+
+    QMutexLocker locker(&mutex);
+    ++m_stats.hits;
+    m_stats.loadTime += timer.nsecsElapsed();
+    return program;
+}
+
+void ProgramCache::recordUsage(const Program::Key &key, const QByteArray &hash)
+{
+    Usage &entry = usage[keyString(key)];
+    if (!entry.used) {
+        ++entry.sessions;
+        entry.used = true;
+    }
+    entry.hash = hash;
+}
+
+std::vector<std::pair<QString, QByteArray>> ProgramCache::usedPrograms() const
+{
+    std::vector<std::pair<QString, QByteArray>> programs;
+    std::vector<std::pair<int, std::map<QString, Usage>::const_iterator>> sorted;
+    for (auto it = usage.begin(); it != usage.end(); ++it) {
+        sorted.push_back({it->second.sessions, it});
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b){
+        return a.first > b.first;
+    });
+    for (int i = 0; i < std::min(static_cast<int>(sorted.size()), maxPrewarmPrograms); ++i) {
+        programs.push_back({sorted[i].second->first, sorted[i].second->second.hash});
+    }
+    return programs;
+}
+
+ProgramCache::Stats ProgramCache::stats() const
+{
+    QMutexLocker locker(&mutex);
+    return m_stats;
+}
+
+void ProgramCache::report() const
+{
+    const Stats stats = this->stats();
+    qDebug().nospace() << "Program cache: " << stats.hits << " hits in " << stats.loadTime / 1.0e6 << " ms, "
+                       << stats.misses << " misses compiled in " << stats.compileTime / 1.0e6 << " ms";
+}
+
+QString ProgramCache::binaryPath(const QByteArray &hash) const
+{
+    return directory + '/' + QString::fromLatin1(hash) + ".bin";
+}
+
+QString ProgramCache::usageLogPath() const
+{
+    return directory + "/usage.log";
+}
+
+void ProgramCache::loadUsageLog()
+{
+    QFile file(usageLogPath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return;
+
+    // Lines of session count, source hash and key string
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        const QStringList fields = stream.readLine().split(' ');
+        if (fields.size() < 3) continue;
+        usage[fields.mid(2).join(' ')] = {fields[1].toLatin1(), fields[0].toInt(), false};
+    }
+}
+
+void ProgramCache::saveUsageLog() const
+{
+    std::vector<std::map<QString, Usage>::const_iterator> sorted;
+    for (auto it = usage.begin(); it != usage.end(); ++it) {
+        sorted.push_back(it);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b){
+        return a->second.sessions > b->second.sessions;
+    });
+
+    QSaveFile file(usageLogPath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return;
+    QTextStream stream(&file);
+    for (int i = 0; i < std::min(static_cast<int>(sorted.size()), maxUsageLogEntries); ++i) {
+        stream << sorted[i]->second.sessions << ' ' << QString::fromLatin1(sorted[i]->second.hash) << ' ' << sorted[i]->first << '\n';
+    }
+    stream.flush();
+    file.commit();
+}
+
+void ProgramCache::store(QOpenGLShaderProgram *const program, const QByteArray &hash)
+{
+    OpenGLFunctions *const gl = QOpenGLContext::currentContext()->extraFunctions();
+    GLint length = 0;
+    gl->glGetProgramiv(program->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    QByteArray binary(length, Qt::Uninitialized);
+    GLenum format = 0;
+    gl->glGetProgramBinary(program->programId(), length, nullptr, &format, binary.data());
+
+    QSaveFile file(binaryPath(hash));
+    if (!file.open(QIODevice::WriteOnly)) return;
+    QDataStream stream(&file);
+    stream << static_cast<quint32>(format) << binary;
+    file.commit();
+}
+
+} // namespace GfxPaint
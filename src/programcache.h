@@ -0,0 +1,76 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QOpenGLContext>
+#include <QString>
+#include <map>
+
+#include "program.h"
+
+namespace GfxPaint {
+
+// Linked program binaries on disk, keyed by a hash of the generated sources and the driver that linked them,
+// and a log of the programs used in previous sessions so they can be loaded ahead of first use
+class ProgramCache
+{
+public:
+    struct Stats {
+        int hits = 0;
+        int misses = 0;
+        qint64 loadTime = 0;
+        qint64 compileTime = 0;
+    };
+    // Most used programs loaded at startup
+    static constexpr int maxPrewarmPrograms = 256;
+    // More are logged than prewarmed so programs used in recent sessions can work their way up
+    static constexpr int maxUsageLogEntries = 1024;
+
+    explicit ProgramCache();
+    ~ProgramCache();
+
+    // Needs the render context current for the driver identity
+    void open(QOpenGLContext *const context);
+    // Saves the usage log and reports cache use
+    void close();
+    bool isOpen() const { return !directory.isEmpty(); }
+
+    static QString keyString(const Program::Key &key);
+    QByteArray hash(const ProgramSources &sources) const;
+
+    // Loads the cached binary or compiles and stores it, thread safe with any context sharing with the render context
+    QOpenGLShaderProgram *link(const ProgramSources &sources, const QByteArray &hash);
+    // Returns nullptr if there is no usable binary
+    QOpenGLShaderProgram *load(const QByteArray &hash);
+
+    void recordUsage(const Program::Key &key, const QByteArray &hash);
+    // Key strings and source hashes of the most used programs, most used first
+    std::vector<std::pair<QString, QByteArray>> usedPrograms() const;
+
+    Stats stats() const;
+    void report() const;
+
+protected:
+    struct Usage {
+        QByteArray hash;
+        int sessions;
+        bool used;
+    };
+
+    QString binaryPath(const QByteArray &hash) const;
+    QString usageLogPath() const;
+    void loadUsageLog();
+    void saveUsageLog() const;
+    void store(QOpenGLShaderProgram *const program, const QByteArray &hash);
+
+    QString directory;
+    QByteArray driver;
+    std::map<QString, Usage> usage;
+    mutable QMutex mutex;
+    Stats m_stats;
+};
+
+} // namespace GfxPaint
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,109 @@
+#include "programcompiler.h"
+
+#include "application.h"
+#include "tracer.h"
+
+namespace GfxPaint {
+
+ProgramCompiler::ProgramCompiler(QObject *const parent) :
+    QObject(parent),
+    thread(), surface(),
+    context(nullptr), worker(nullptr)
+{
+}
+
+ProgramCompiler::~ProgramCompiler()
+{
+    Q_ASSERT(!context);
+}
+
+void ProgramCompiler::start(QOpenGLContext *const shareContext)
+{
+    // Surface and context have to be created on the main thread, the context is then only used by the worker
+    surface.setFormat(shareContext->format());
+    surface.create();
+    context = new QOpenGLContext();
+    context->setFormat(shareContext->format());
+    context->setShareContext(shareContext);
+    if (!context->create()) {
+        qDebug() << "Program compiler context creation failed, compiling on first use";
+        delete context;
+        context = nullptr;
+        surface.destroy();
+        return;
+    }
+
+    worker = new QObject();
+    worker->moveToThread(&thread);
+    context->moveToThread(&thread);
+    QObject::connect(&thread, &QThread::finished, worker, [this](){
+        context->doneCurrent();
+    });
+    thread.setObjectName("Program compiler");
+    thread.start();
+}
+
+void ProgramCompiler::stop()
+{
+    if (!context) return;
+
+    thread.quit();
+    thread.wait();
+    delete worker;
+    worker = nullptr;
+    delete context;
+    context = nullptr;
+    surface.destroy();
+}
+
+void ProgramCompiler::compile(const Program::Key &key, const ProgramSources &sources, const QByteArray &hash)
+{
+    Q_ASSERT(context);
+    QThread *const mainThread = QObject::thread();
+    QMetaObject::invokeMethod(worker, [this, key, sources, hash, mainThread](){
+        if (QOpenGLContext::currentContext() != context) context->makeCurrent(&surface);
+
+        const Tracer::Scope traceScope("ProgramCompiler::compile", "compile", Tracer::isEnabled() ? QString(key.first.name()) : QString());
+        QOpenGLShaderProgram *const program = qApp->renderManager.programCache.link(sources, hash);
+        // Linking may be deferred by the driver, finish it here rather than on first use
+        context->functions()->glFinish();
+
+        program->moveToThread(mainThread);
+        QMetaObject::invokeMethod(this, [this, key, program](){
+            finish(key, program);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+void ProgramCompiler::prewarm(const std::vector<std::pair<QString, QByteArray>> &programs)
+{
+    if (!context) return;
+
+    QThread *const mainThread = QObject::thread();
+    for (const auto &[keyString, hash] : programs) {
+        QMetaObject::invokeMethod(worker, [this, keyString, hash, mainThread](){
+            if (QOpenGLContext::currentContext() != context) context->makeCurrent(&surface);
+
+            QOpenGLShaderProgram *const program = qApp->renderManager.programCache.load(hash);
+            if (!program) return;
+            context->functions()->glFinish();
+
+            program->moveToThread(mainThread);
+            QMetaObject::invokeMethod(this, [keyString, hash, program](){
+                qApp->renderManager.renderThread.sync();
+                qApp->renderManager.programManager.addPrewarmed(keyString, hash, program);
+            }, Qt::QueuedConnection);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void ProgramCompiler::finish(const Program::Key &key, QOpenGLShaderProgram *const program)
+{
+    Q_ASSERT_X(program->isLinked(), key.first.name(), "Program linking failed.");
+    // Frames on the render thread look programs up
+    qApp->renderManager.renderThread.sync();
+    qApp->renderManager.programManager.add(key, program);
+    emit programCompiled();
+}
+
+} // namespace GfxPaint
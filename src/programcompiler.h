@@ -0,0 +1,46 @@
+#ifndef PROGRAMCOMPILER_H
+#define PROGRAMCOMPILER_H
+
+#include <QObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QThread>
+
+#include "program.h"
+
+namespace GfxPaint {
+
+// Compiles and links programs on a worker thread with its own context sharing objects with the render context,
+// linked programs are handed to the program manager on the main thread
+class ProgramCompiler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ProgramCompiler(QObject *const parent = nullptr);
+    virtual ~ProgramCompiler() override;
+
+    // Without a worker context programs are compiled synchronously on first use
+    void start(QOpenGLContext *const shareContext);
+    void stop();
+    bool isRunning() const { return context; }
+
+    void compile(const Program::Key &key, const ProgramSources &sources, const QByteArray &hash);
+    // Loads cached binaries of programs used in previous sessions, compiles queued meanwhile are handled in between
+    void prewarm(const std::vector<std::pair<QString, QByteArray>> &programs);
+
+signals:
+    void programCompiled();
+
+protected:
+    void finish(const Program::Key &key, QOpenGLShaderProgram *const program);
+
+    QThread thread;
+    QOffscreenSurface surface;
+    QOpenGLContext *context;
+    QObject *worker;
+};
+
+} // namespace GfxPaint
+
+#endif // PROGRAMCOMPILER_H
@@ -1,8 +1,10 @@
 #include "renderedwidget.h"
 
+#include <QShowEvent>
 #include <cmath>
 
 #include "application.h"
+#include "tracer.h"
 #include "utils.h"
 
 namespace GfxPaint {
@@ -13,18 +15,16 @@ RenderedWidget::RenderedWidget(QWidget *const parent) :
     QOpenGLWidget(parent), OpenGL(),
     mouseTransform(), viewportTransform(),
     vao(),
-    widgetBuffer(nullptr),
+    widgetBuffer(nullptr), presentBuffer(nullptr),
     patternProgram(nullptr), widgetProgram(nullptr),
-    repaintTimer(), timer()
+    asyncRender(true), framePending(false), frameInFlight(false), bufferGeneration(0)
 {
-    const float framesPerSecond = 60.0f;
-    repaintTimer.start(1000.0f / framesPerSecond, this);
-    timer.start();
 }
 
 RenderedWidget::~RenderedWidget()
 {
-    repaintTimer.stop();
+    qApp->renderManager.frameScheduler.cancelFrame(this);
+    syncFrame();
     if (context()) {
         ContextBinder contextBinder(this);
         vao.destroy();
@@ -34,6 +34,7 @@ RenderedWidget::~RenderedWidget()
         delete widgetProgram;
         delete patternProgram;
         delete widgetBuffer;
+        delete presentBuffer;
     }
 }
 
@@ -75,6 +76,11 @@ void RenderedWidget::resizeGL(int w, int h)
         ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
         delete widgetBuffer;
         widgetBuffer = new Buffer(QSize(w, h), format);
+        delete presentBuffer;
+        presentBuffer = nullptr;
+        ++bufferGeneration;
+        // Work buffers pooled at the old size won't be asked for again
+        qApp->workBufferManager.purge();
         qDebug() << "RESIZE!";//////////////////////////
     }
 }
@@ -82,30 +88,48 @@ void RenderedWidget::resizeGL(int w, int h)
 void RenderedWidget::paintGL()
 {
     QOpenGLWidget::paintGL();
-
-    // Render to buffer
-    {
+    // QOpenGLWidget binds its own framebuffer and viewport before painting
+    OpenGLState::current().invalidate();
+
+    // Render to buffer, on the render thread once there is a frame to show meanwhile
+    RenderThread &renderThread = qApp->renderManager.renderThread;
+    if (asyncRender && renderThread.isRunning() && presentBuffer) {
+        if (framePending && !frameInFlight) {
+            prepareFrame();
+            if (renderThread.enqueueFrame(this, [this](){
+                renderFrame();
+            }, [this, generation = bufferGeneration](){
+                frameInFlight = false;
+                // Buffers made meanwhile already show a newer frame
+                if (generation == bufferGeneration) std::swap(widgetBuffer, presentBuffer);
+                update();
+                frameFinished();
+            })) {
+                framePending = false;
+                frameInFlight = true;
+            }
+        }
+    }
+    else {
+        framePending = false;
+        prepareFrame();
         ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-        widgetBuffer->clear();
-        widgetBuffer->bindFramebuffer();
-
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_BLEND);
-
-        render();
+        renderFrame();
+        if (asyncRender) {
+            if (!presentBuffer) presentBuffer = new Buffer(widgetBuffer->size(), format);
+            std::swap(widgetBuffer, presentBuffer);
+        }
     }
+    Buffer *const shownBuffer = presentBuffer ? presentBuffer : widgetBuffer;
+    FrameProfiler::Scope profileScope("Widget present");
 
     // Draw checkers
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
-//    const float time = timer.elapsed() / 1000.0f;
-    const float time = qApp->time();
-    const float degreesPerSecond = 45.0f;
+    // Static so an idle application stops rendering
     Mat4 transform;
     transform.scale(16.0f, 16.0f);
-    transform.rotate(time * degreesPerSecond, {0.0f, 0.0f, 1.0f});
     transform.translate(0.0f, 1.0f);
-    transform.rotate(-time * degreesPerSecond, {0.0f, 0.0f, 1.0f});
     transform = viewportTransform * transform;
     patternProgram->render(RenderManager::flipTransform * transform);
 
@@ -114,13 +138,43 @@ void RenderedWidget::paintGL()
     glEnable(GL_BLEND);
     Mat4 matrix;
     matrix.scale(width(), height());
-    widgetProgram->render(widgetBuffer, viewportTransform);
+    widgetProgram->render(shownBuffer, viewportTransform);
+
+    // Frames held back by the in flight limit are retried next refresh, finished frames request their own repaint
+    if (framePending && !frameInFlight) requestFrame();
+}
+
+void RenderedWidget::requestFrame()
+{
+    framePending = true;
+    qApp->renderManager.frameScheduler.requestFrame(this);
+}
+
+void RenderedWidget::syncFrame()
+{
+    // Other widgets' frames may read the same scene
+    qApp->renderManager.renderThread.sync();
+}
+
+void RenderedWidget::renderFrame()
+{
+    const Tracer::Scope traceScope("Frame", "frame");
+    widgetBuffer->clear();
+    widgetBuffer->bindFramebuffer();
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    const QMutexLocker frameLocker(&frameMutex);
+    render();
+    overlay.flush(widgetBuffer);
 }
 
-void RenderedWidget::timerEvent(QTimerEvent *event)
+void RenderedWidget::showEvent(QShowEvent *event)
 {
-    if (event->timerId() == repaintTimer.timerId()) update();
-    else QWidget::timerEvent(event);
+    QOpenGLWidget::showEvent(event);
+
+    requestFrame();
 }
 
 } // namespace GfxPaint
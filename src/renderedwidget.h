@@ -6,10 +6,10 @@
 
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
-#include <QBasicTimer>
-#include <QElapsedTimer>
+#include <QMutex>
 
 #include "buffer.h"
+#include "overlaybatcher.h"
 #include "rendermanager.h"
 
 namespace GfxPaint {
@@ -22,14 +22,29 @@ public:
 
     static const Buffer::Format format;
 
+    void requestFrame();
+
 protected:
     virtual void initializeGL() override;
     virtual void resizeGL(int w, int h) override;
     virtual void paintGL() override;
 
-    void timerEvent(QTimerEvent *event) override;
+    virtual void showEvent(QShowEvent *event) override;
+
+    void renderFrame();
 
     virtual void render() {}
+    // Called on the main thread before each frame while none of this widget's frames are in flight, widgets copy
+    // state events change for render() to read here instead of syncing whenever it changes
+    virtual void prepareFrame() {}
+    // Called on the main thread once a frame from the render thread is shown
+    virtual void frameFinished() {}
+
+    // Waits for frames rendering on the render thread, before changing state render() reads
+    void syncFrame();
+    // Held while render() runs, widgets whose render() only reads their own members lock it to change them
+    // rather than syncing, which would wait for every other widget's queued frames
+    QMutex frameMutex;
 
     Mat4 mouseTransform;
     Mat4 viewportTransform;
@@ -37,12 +52,19 @@ protected:
     QOpenGLVertexArrayObject vao;
 
     Buffer *widgetBuffer;
+    // With asyncRender frames render into widgetBuffer on the render thread while presentBuffer is shown. The first frame
+    // after a resize still renders on the main thread, as do frames while the render thread isn't running.
+    Buffer *presentBuffer;
+    // Markers and previews drawn over render() with one draw per frame
+    OverlayBatcher overlay;
 
     BackgroundCheckersProgram *patternProgram;
     RenderedWidgetProgram *widgetProgram;
 
-    QBasicTimer repaintTimer;
-    QElapsedTimer timer;
+    bool asyncRender;
+    bool framePending;
+    bool frameInFlight;
+    quint64 bufferGeneration;
 };
 
 } // namespace GfxPaint
@@ -1,13 +1,17 @@
 #include "rendermanager.h"
 
 #include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QMutex>
 #include <QRegularExpression>
 #include <cstring>
 #include <iostream>
+#include <numeric>
 
 #undef ERROR // for simplecpp to build on windows
 #include "simplecpp/simplecpp.h"
+#include "tracer.h"
 #include "utils.h"
 #include "application.h"
 #include "renderedwidget.h"
@@ -139,9 +143,13 @@ RenderManager::RenderManager() :
     OpenGL(),
     surface(), context(),
     logger(),
-    vao(),
-    models(), programManager(), programs(),
-    includeSources{}
+    vao(), streamBuffer(),
+    models(), programManager(), programCache(), programCompiler(), renderThread(), gpuWorkers(), profiler(), programs(),
+    frameScheduler(),
+    interactiveResolution(),
+    compositor(Compositor::DrawPerLayer), computeCompositor(),
+    bufferAtlas(), bufferBatcher(),
+    includeFiles(), includeTokenLists(), bufferUberPrograms(), transientVertexArrays()
 {
     // Create offscreen render context
     // OpenGL ES
@@ -204,6 +212,7 @@ RenderManager::RenderManager() :
 
     vao.create();
     vao.bind();
+    streamBuffer.create();
 
     models["clipQuad"] = new Model(GL_TRIANGLE_STRIP, {2,}, {
             -1.0f, -1.0f,
@@ -223,42 +232,6 @@ RenderManager::RenderManager() :
             0, 1, 2, 3,
         }, {4,});
 
-    models["sliderMarker"] = new Model(GL_TRIANGLES, {2, 4,}, {
-            0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-            0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-        }, {
-            0, 1, 2,
-            3, 4, 5,
-        }, {3, 3,});
-
-    models["planeMarker"] = new Model(GL_TRIANGLES, {2, 4,}, {
-            0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-            1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-            0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-        }, {
-            0, 1, 2,
-            3, 4, 5,
-        }, {3, 3,});
-
-    models["paletteMouseMarker"] = new Model(GL_TRIANGLES, {2, 4,}, {
-            0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f, 0.5f, 0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f, 0.5f, 1.0f, 1.0f, 1.0f, 1.0f,
-            0.5f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-            0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
-        }, {
-            0, 1, 2,
-            3, 4, 5,
-        }, {3, 3,});
-
     std::vector<QString> includes = {};
     QDirIterator it(shadersPath, QDirIterator::Subdirectories);
     while (it.hasNext()) {
@@ -272,20 +245,60 @@ RenderManager::RenderManager() :
     addGlslIncludes(includes);
 
     programs["marker"] = new VertexColourModelProgram(RenderedWidget::format, false, Buffer::Format(), 0, RenderManager::composeModeDefault);
+
+    profiler.start(&context);
+    programCache.open(&context);
+    programCompiler.start(&context);
+    programCompiler.prewarm(programCache.usedPrograms());
+    // Direct colour fallbacks, the most likely to be needed by the first frames
+    for (const bool srcPyramid : {false, true}) {
+        bufferUberProgram(RenderedWidget::format, Buffer::Format(), RenderedWidget::format, Buffer::Format(), srcPyramid, false)->prepare();
+    }
+
+    renderThread.start(&context, &surface);
+    gpuWorkers.start(&renderThread, &context, &surface);
 }
 
 RenderManager::~RenderManager()
 {
+    gpuWorkers.stop();
+    renderThread.stop();
+    programCompiler.stop();
+    programCache.close();
+    OpenGLState::report();
     {
         ContextBinder contextBinder(&context, &surface);
 
+        for (auto &[name, model] : models) {
+            delete model;
+        }
         models.clear();
+        for (auto &[name, program] : programs) {
+            delete program;
+        }
         programs.clear();
+        for (auto &[key, program] : bufferUberPrograms) {
+            delete program;
+        }
+        bufferUberPrograms.clear();
+        for (auto &[attributeSizes, vertexArray] : transientVertexArrays) {
+            GLObjectRegistry::remove(GLObjectRegistry::Type::VertexArray, vertexArray);
+            glDeleteVertexArrays(1, &vertexArray);
+        }
+        transientVertexArrays.clear();
+        computeCompositor.release();
+        bufferBatcher.release();
+        bufferAtlas.release();
+        profiler.stop();
+        streamBuffer.destroy();
+        programManager.clear();
 
         logger.stopLogging();
 
         vao.destroy();
     }
+    // Editors, nodes and widgets are gone by now, so anything left was never released
+    GLObjectRegistry::reportLeaks();
 }
 
 bool RenderManager::isOpenGLES()
@@ -311,14 +324,53 @@ QString RenderManager::glslVersionString()
     return src;
 }
 
+BufferUberProgram *RenderManager::bufferUberProgram(const Buffer::Format &srcFormat, const Buffer::Format &srcPaletteFormat, const Buffer::Format &destFormat, const Buffer::Format &destPaletteFormat, const bool srcPyramid, const bool instanced)
+{
+    const std::tuple key{BufferUberProgram::samplerKey(srcFormat), BufferUberProgram::samplerKey(srcPaletteFormat), BufferUberProgram::samplerKey(destFormat), BufferUberProgram::samplerKey(destPaletteFormat), srcPyramid, instanced};
+    auto found = bufferUberPrograms.find(key);
+    if (found == bufferUberPrograms.end()) {
+        found = bufferUberPrograms.insert({key, new BufferUberProgram(srcFormat, srcPaletteFormat, destFormat, destPaletteFormat, srcPyramid, instanced)}).first;
+    }
+    return found->second;
+}
+
+void RenderManager::drawTransient(const GLenum primitive, const std::vector<GLsizei> &attributeSizes, const GLfloat *const vertices, const GLsizei vertexCount)
+{
+    Q_ASSERT(QOpenGLContext::currentContext() == &context);
+    if (vertexCount <= 0) return;
+
+    auto found = transientVertexArrays.find(attributeSizes);
+    if (found == transientVertexArrays.end()) {
+        // Attribute formats are fixed, only the vertex buffer binding changes per draw
+        GLuint vertexArray = 0;
+        glGenVertexArrays(1, &vertexArray);
+        GLObjectRegistry::add(GLObjectRegistry::Type::VertexArray, vertexArray);
+        glBindVertexArray(vertexArray);
+        for (GLuint i = 0, offset = 0; i < static_cast<GLuint>(attributeSizes.size()); offset += attributeSizes[i], ++i) {
+            glVertexAttribFormat(i, attributeSizes[i], GL_FLOAT, false, offset * sizeof(GLfloat));
+            glVertexAttribBinding(i, 0);
+            glEnableVertexAttribArray(i);
+        }
+        found = transientVertexArrays.insert({attributeSizes, vertexArray}).first;
+    }
+
+    const GLsizei vertexStride = sizeof(GLfloat) * std::accumulate(attributeSizes.begin(), attributeSizes.end(), 0);
+    const StreamBuffer::Range range = streamBuffer.write(vertices, static_cast<GLsizeiptr>(vertexCount) * vertexStride, sizeof(GLfloat));
+    glBindVertexArray(found->second);
+    glBindVertexBuffer(0, streamBuffer.buffer(), range.offset, vertexStride);
+    glDrawArrays(primitive, 0, vertexCount);
+    glBindVertexArray(vao.objectId());
+}
+
 GLuint RenderManager::bufferAddDepthStencilAttachment(Buffer *const buffer)
 {
     ContextBinder contextBinder(&context, &surface);
     FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, buffer->framebuffer());
     GLuint texture = 0;
     glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    OpenGLState::current().bindTexture(GL_TEXTURE_2D, texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, buffer->width(), buffer->height(), 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+    GLObjectRegistry::add(GLObjectRegistry::Type::DepthStencil, texture, static_cast<qint64>(buffer->width()) * buffer->height() * 4);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
     return texture;
 }
@@ -328,21 +380,25 @@ void RenderManager::bufferRemoveDepthStencilAttachment(Buffer *const buffer, con
     ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
     FramebufferBinder framebufferBinder(GL_FRAMEBUFFER, buffer->framebuffer());
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-    glDeleteTextures(1, &texture);
+    OpenGLState::deleteTextures(1, &texture);
 }
 
 void RenderManager::addGlslIncludes(const std::vector<QString> &includes)
 {
     const QDir shadersDir(shadersPath);
+    simplecpp::OutputList outputList;
     for (const QString &path : includes) {
         const QString &include = shadersDir.relativeFilePath(path);
-        const QString &src = resourceShaderPart(include);
-        includeSources[include.toStdString()] = src.toStdString();
+        std::istringstream stream(resourceShaderPart(include).toStdString());
+        auto tokenList = std::make_unique<simplecpp::TokenList>(stream, includeFiles, include.toStdString(), &outputList);
+        tokenList->removeComments();
+        includeTokenLists[include.toStdString()] = std::move(tokenList);
     }
 }
 
 QString RenderManager::preprocessGlsl(const QString &src, const QString &filename, const std::unordered_map<QString, QString> &defines = {})
 {
+    const Tracer::Scope traceScope("RenderManager::preprocessGlsl", "compile", filename);
     simplecpp::DUI dui;
     for (const auto &[name, value] : defines) {
         QString str = name;
@@ -352,34 +408,18 @@ QString RenderManager::preprocessGlsl(const QString &src, const QString &filenam
         dui.defines.push_back(str.toStdString());
     }
     simplecpp::OutputList outputList;
-    std::vector<std::string> files;
+    // File indices of the cached include tokens stay valid
+    std::vector<std::string> files = includeFiles;
     std::istringstream inputStream(src.toStdString());
     simplecpp::TokenList rawTokens(inputStream, files, filename.toStdString(), &outputList);
     rawTokens.removeComments();
-    std::map<std::string, simplecpp::TokenList*> includeTokenLists = simplecpp::load(rawTokens, files, dui, &outputList);
-//    auto it = files.begin();
-//    while (it != files.end()) {
-//        std::string path = *it;
-//        if (!includeTokenLists.contains(path)) {
-//            std::string src = includeSources[path];
-//            std::istringstream f(src);
-//            simplecpp::TokenList rawtokens(f,files,path,&outputList);
-//            includeTokenLists[path] = new simplecpp::TokenList(rawtokens);
-//        }
-//        it = files.erase(it);
-//    }
-    for (const auto &[path, src] : includeSources) {
-        std::istringstream f(src);
-        simplecpp::TokenList rawtokens(f,files,path,&outputList);
-        includeTokenLists[path] = new simplecpp::TokenList(rawtokens);
-    }
-    for (auto &[path, tokenList] : includeTokenLists) {
-        tokenList->removeComments();
+    // Includes are only looked up when reached, so nothing is tokenised here
+    std::map<std::string, simplecpp::TokenList *> tokenLists;
+    for (const auto &[path, tokenList] : includeTokenLists) {
+        tokenLists[path] = tokenList.get();
     }
-    for (const auto &file : files) qDebug() << "FILE:" << QString::fromStdString(file);//////////////////////////
-    qDebug() << "INCLUDES:" << includeTokenLists.size();//////////////////////////
     simplecpp::TokenList outputTokens(files);
-    simplecpp::preprocess(outputTokens, rawTokens, files, includeTokenLists, dui, &outputList);
+    simplecpp::preprocess(outputTokens, rawTokens, files, tokenLists, dui, &outputList);
     QString preprocessedSrc;
     preprocessedSrc += qApp->renderManager.glslVersionString();
     if (isOpenGLES()) {
@@ -387,47 +427,114 @@ QString RenderManager::preprocessGlsl(const QString &src, const QString &filenam
 //        preprocessedSrc += "#include \"precision.glsl\"\n";
     }
     preprocessedSrc += QString::fromStdString(outputTokens.stringify());
-    simplecpp::cleanup(includeTokenLists);
-    qDebug().noquote() << "PREPROCESSED:" << preprocessedSrc;
+    // Headers simplecpp found on disk itself aren't cached
+    for (auto &[path, tokenList] : tokenLists) {
+        if (!includeTokenLists.contains(path)) delete tokenList;
+    }
     return preprocessedSrc;
 }
 
-QString RenderManager::headerShaderPart()
+void RenderManager::benchmarkProgramGeneration(const int iterations)
 {
-    QString src;
-    src += qApp->renderManager.glslVersionString();
-    if (isOpenGLES()) {
-        src += resourceShaderPart("precision.glsl");
+    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+
+    // Every blend and compose mode between two buffers of one format
+    const Buffer::Format format(Buffer::Format::ComponentType::UNorm, 1, 4);
+    std::vector<BufferProgram *> programs;
+    for (int blendMode = 0; blendMode < blendModes.size(); ++blendMode) {
+        for (int composeMode = 0; composeMode < composeModes.size(); ++composeMode) {
+            programs.push_back(new BufferProgram(format, false, Buffer::Format(), format, false, Buffer::Format(), blendMode, composeMode));
+        }
     }
-    src += resourceShaderPart("types.glsl");
-    src += resourceShaderPart("util.glsl");
-    return src;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        for (const BufferProgram *const program : programs) {
+            program->sources();
+        }
+    }
+    const qint64 generateNsecs = timer.nsecsElapsed();
+
+    const QString src =
+        "#include \"types.glsl\"\n"
+        "#include \"util.glsl\"\n"
+        "#include \"compositing.glsl\"\n"
+        "#include \"blending.glsl\"\n";
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        qApp->renderManager.preprocessGlsl(src, "benchmark.glsl", {});
+    }
+    const qint64 preprocessNsecs = timer.nsecsElapsed();
+
+    for (const BufferProgram *const program : programs) {
+        delete program;
+    }
+
+    qDebug() << "Program generation benchmark:" << programs.size() << "programs," << iterations << "iterations";
+    qDebug() << "  generate:" << generateNsecs / iterations / static_cast<qint64>(programs.size()) / 1000.0 << "us per program";
+    qDebug() << "  preprocess:" << preprocessNsecs / iterations / 1000.0 << "us per source";
+}
+
+const QString &RenderManager::internedShaderPart(const QString &key, const std::function<QString()> &generate)
+{
+    // Programs are created on the main thread, the render thread and GPU workers. Parts generate other parts so the
+    // lock isn't held while generating, map nodes stay put so returned references outlive later inserts.
+    static QMutex mutex;
+    static std::unordered_map<QString, QString> parts;
+    {
+        const QMutexLocker locker(&mutex);
+        const auto found = parts.find(key);
+        if (found != parts.end()) return found->second;
+    }
+    QString part = generate();
+    const QMutexLocker locker(&mutex);
+    // Another thread generating the same part first wins, both generated the same source
+    return parts.try_emplace(key, std::move(part)).first->second;
+}
+
+QString RenderManager::headerShaderPart()
+{
+    return internedShaderPart("header", [](){
+        QString src;
+        src += qApp->renderManager.glslVersionString();
+        if (isOpenGLES()) {
+            src += resourceShaderPart("precision.glsl");
+        }
+        src += resourceShaderPart("types.glsl");
+        src += resourceShaderPart("util.glsl");
+        return src;
+    });
 }
 
 QString RenderManager::resourceShaderPart(const QString &filename)
 {
-    QString src;
-    src += QString("#line 0 \"%1\"\n").arg(filename);
-    src += fileToString(":/shaders/" + filename);
-    return src;
+    return internedShaderPart("resource:" + filename, [&filename](){
+        QString src;
+        src += QString("#line 0 \"%1\"\n").arg(filename);
+        src += fileToString(":/shaders/" + filename);
+        return src;
+    });
 }
 
 QString RenderManager::colourSpaceShaderPart()
 {
-    QString src;
-    src += resourceShaderPart("ColorSpaces.inc.glsl");
-    for (const auto &[key, value] : colourSpaceInfo) {
-        QString str = R"(
+    return internedShaderPart("colourSpace", [](){
+        QString src;
+        src += resourceShaderPart("ColorSpaces.inc.glsl");
+        for (const auto &[key, value] : colourSpaceInfo) {
+            QString str = R"(
 vec3 $COLOURSPACE_to_$COLOURSPACE(vec3 rgb) {
     return rgb;
 }
 )";
-        stringMultiReplace(str, {
-            {"$COLOURSPACE", value.funcName},
-        });
-        src += str;
-    }
-    return src;
+            stringMultiReplace(str, {
+                {"$COLOURSPACE", value.funcName},
+            });
+            src += str;
+        }
+        return src;
+    });
 }
 
 QString RenderManager::attributelessShaderPart(const AttributelessModel model)
@@ -483,6 +590,50 @@ void main(void) {
     return src;
 }
 
+QString RenderManager::drawDataVertexMainShaderPart()
+{
+    QString src;
+    src += R"(
+out layout(location = 0) vec2 pos;
+
+void main(void) {
+    vec2 vertexPos = vertices[gl_VertexID];
+    pos = (drawData.object * vec4(vertexPos, 0.0, 1.0)).xy;
+    gl_Position = (drawData.transform * drawData.object) * vec4(vertexPos, 0.0, 1.0);
+}
+)";
+    return src;
+}
+
+QString RenderManager::instancedVertexMainShaderPart(const GLint storageBinding)
+{
+    QString src;
+    src += R"(
+struct Instance {
+    mat4 transform;
+    vec2 origin;
+    vec2 size;
+};
+
+layout(std430, binding = $STORAGE_BINDING) readonly buffer instanceData {
+    Instance instances[];
+};
+
+out layout(location = 0) vec2 pos;
+
+void main(void) {
+    Instance instance = instances[gl_InstanceID];
+    vec2 vertexPos = vertices[gl_VertexID] * instance.size;
+    pos = instance.origin + vertexPos;
+    gl_Position = instance.transform * vec4(vertexPos, 0.0, 1.0);
+}
+)";
+    stringMultiReplace(src, {
+        {"$STORAGE_BINDING", QString::number(storageBinding)},
+    });
+    return src;
+}
+
 QString RenderManager::patternShaderPart(const QString &name, const Pattern pattern)
 {
     QString src;
@@ -532,7 +683,7 @@ vec4 $NAMEPalette(const uint index) {
     return src;
 }
 
-QString RenderManager::bufferShaderPart(const QString &name, const GLint uniformBlockBinding, const GLint bufferTextureLocation, const Buffer::Format bufferFormat, const bool indexed, const GLint paletteTextureLocation, const Buffer::Format paletteFormat)
+QString RenderManager::bufferShaderPart(const QString &name, const GLint uniformBlockBinding, const GLint bufferTextureLocation, const Buffer::Format bufferFormat, const bool indexed, const GLint paletteTextureLocation, const Buffer::Format paletteFormat, const bool originInDrawData)
 {
     Q_ASSERT(!indexed || paletteFormat.isValid());
 
@@ -540,6 +691,11 @@ QString RenderManager::bufferShaderPart(const QString &name, const GLint uniform
     if (indexed && paletteFormat.isValid()) src += paletteShaderPart(name, paletteTextureLocation, paletteFormat);
     src += R"(
 uniform layout(location = $TEXTURE_LOCATION) $SAMPLER_TYPE $NAMETexture;
+)";
+    if (!originInDrawData) src += R"(
+uniform ivec2 $NAMEOrigin;
+)";
+    src += R"(
 
 layout(std140, binding = $UNIFORM_BLOCK_BINDING) uniform $NAMEUniformData {
     mat4 matrix;
@@ -551,16 +707,16 @@ Colour $NAME(const vec2 pos) {
 //    Colour transparent = $NAMEData.transparent;
 )";
     if (indexed && paletteFormat.isValid()) src += R"(
-    colour.index = texelFetch($NAMETexture, ivec2(floor(pos)), 0).x;
+    colour.index = texelFetch($NAMETexture, ivec2(floor(pos)) + $ORIGIN, 0).x;
 //    colour.rgba = (colour.index == transparent.index ? vec4(0.0) : $NAMEPalette(colour.index));
     colour.rgba = $NAMEPalette(colour.index);
 )";
     else if (indexed && !paletteFormat.isValid()) src += R"(
-    float grey = toUnit(texelFetch($NAMETexture, ivec2(floor(pos)), 0).x, $SCALAR_VALUE_TYPE($FORMAT_SCALE));
+    float grey = toUnit(texelFetch($NAMETexture, ivec2(floor(pos)) + $ORIGIN, 0).x, $SCALAR_VALUE_TYPE($FORMAT_SCALE));
     colour.rgba = (colour.index == transparent.index ? vec4(0.0) : vec4(vec3(grey), 1.0));
 )";
     else src += R"(
-    vec4 texelRgba = toUnit(texelFetch($NAMETexture, ivec2(floor(pos)), 0), $SCALAR_VALUE_TYPE($FORMAT_SCALE));
+    vec4 texelRgba = toUnit(texelFetch($NAMETexture, ivec2(floor(pos)) + $ORIGIN, 0), $SCALAR_VALUE_TYPE($FORMAT_SCALE));
 //    colour.rgba = (texelRgba == transparent.rgba ? vec4(0.0) : texelRgba);
 //    if (transparent.rgba != RGBA_INVALID) {
 //        colour.rgba = (texelRgba == transparent.rgba ? vec4(0.0) : texelRgba);
@@ -574,6 +730,7 @@ Colour $NAME(const vec2 pos) {
 }
 )";
     stringMultiReplace(src, {
+        {"$ORIGIN", (originInDrawData ? "drawData." : "") + name + "Origin"},
         {"$NAME", name},
         {"$TEXTURE_LOCATION", QString::number(bufferTextureLocation)},
         {"$SAMPLER_TYPE", bufferFormat.shaderSamplerType()},
@@ -584,6 +741,80 @@ Colour $NAME(const vec2 pos) {
     return src;
 }
 
+QString RenderManager::uberBufferShaderPart(const QString &name, const GLint uniformBlockBinding, const GLint bufferTextureLocation, const Buffer::Format bufferFormat, const GLint paletteTextureLocation, const Buffer::Format paletteFormat)
+{
+    QString src;
+    src += R"(
+uniform layout(location = $PALETTE_TEXTURE_LOCATION) $PALETTE_SAMPLER_TYPE $NAMEPaletteTexture;
+uniform float $NAMEPaletteScale;
+uniform layout(location = $TEXTURE_LOCATION) $SAMPLER_TYPE $NAMETexture;
+uniform ivec2 $NAMEOrigin;
+uniform float $NAMEScale;
+// Direct colour, indexed with a palette or indexed without one
+uniform int $NAMEMode;
+
+layout(std140, binding = $UNIFORM_BLOCK_BINDING) uniform $NAMEUniformData {
+    mat4 matrix;
+    Colour transparent;
+} $NAMEData;
+
+vec4 $NAMEPalette(const uint index) {
+    return toUnit(vec4(paletteSample($NAMEPaletteTexture, index)), $NAMEPaletteScale);
+}
+
+Colour $NAME(const vec2 pos) {
+    Colour colour = COLOUR_INVALID;
+    vec4 texel = vec4(texelFetch($NAMETexture, ivec2(floor(pos)) + $NAMEOrigin, 0));
+    if ($NAMEMode == 1) {
+        colour.index = Index(texel.x);
+        colour.rgba = $NAMEPalette(colour.index);
+    }
+    else if ($NAMEMode == 2) {
+        colour.rgba = vec4(vec3(toUnit(texel.x, $NAMEScale)), 1.0);
+    }
+    else colour.rgba = toUnit(texel, $NAMEScale);
+    return colour;
+}
+)";
+    stringMultiReplace(src, {
+        {"$NAME", name},
+        {"$TEXTURE_LOCATION", QString::number(bufferTextureLocation)},
+        {"$SAMPLER_TYPE", bufferFormat.shaderSamplerType()},
+        {"$PALETTE_TEXTURE_LOCATION", QString::number(paletteTextureLocation)},
+        {"$PALETTE_SAMPLER_TYPE", paletteFormat.isValid() ? paletteFormat.shaderSamplerType() : "sampler2D"},
+        {"$UNIFORM_BLOCK_BINDING", QString::number(uniformBlockBinding)},
+    });
+    return src;
+}
+
+QString RenderManager::bufferPyramidShaderPart(const QString &name, const GLint pyramidTextureLocation, const bool levelInDrawData)
+{
+    QString src;
+    src += R"(
+uniform layout(location = $TEXTURE_LOCATION) sampler2D $NAMEPyramidTexture;
+)";
+    if (!levelInDrawData) src += R"(
+uniform int $NAMEPyramidLevel;
+)";
+    src += R"(
+Colour $NAMEPyramid(const vec2 pos) {
+    if ($LEVEL <= 0) return $NAME(pos);
+    // Pyramid texture levels start from pyramid level 1
+    int level = $LEVEL - 1;
+    ivec2 texelPos = min(ivec2(floor(pos / float(1 << $LEVEL))), textureSize($NAMEPyramidTexture, level) - 1);
+    Colour colour = COLOUR_INVALID;
+    colour.rgba = texelFetch($NAMEPyramidTexture, texelPos, level);
+    return colour;
+}
+)";
+    stringMultiReplace(src, {
+        {"$LEVEL", (levelInDrawData ? "drawData." : "") + name + "PyramidLevel"},
+        {"$NAME", name},
+        {"$TEXTURE_LOCATION", QString::number(pyramidTextureLocation)},
+    });
+    return src;
+}
+
 QString RenderManager::colourPlaneShaderPart(const QString &name, const ColourSpace colourSpace, const bool useXAxis, const bool useYAxis, const bool quantise, const GLint quantisePaletteTextureLocation, const Buffer::Format quantisePaletteFormat)
 {
     QString src;
@@ -732,6 +963,60 @@ void main(void) {
     return src;
 }
 
+QString RenderManager::uberFragmentMainShaderPart(const Buffer::Format format)
+{
+    QString src;
+    src += resourceShaderPart("compositing.glsl");
+    src += resourceShaderPart("blending.glsl");
+    src += resourceShaderPart("palette.glsl");
+    src += R"(
+uniform Colour srcTransparent;
+uniform int blendModeIndex;
+uniform int composeModeIndex;
+
+out layout(location = 0) $VALUE_TYPE fragment;
+
+vec3 blendByMode(const int mode, const vec3 dest, const vec3 src) {
+    switch (mode) {
+)";
+    for (int i = 0; i < blendModes.size(); ++i) {
+        src += QString("    case %1: return %2(dest, src);\n").arg(i).arg(blendModes[i].functionName);
+    }
+    src += R"(
+    default: return src;
+    }
+}
+
+vec4 composeByMode(const int mode, const vec4 dest, const vec4 src) {
+    switch (mode) {
+)";
+    for (int i = 0; i < composeModes.size(); ++i) {
+        src += QString("    case %1: return %2(dest, src);\n").arg(i).arg(composeModes[i].functionName);
+    }
+    src += R"(
+    default: return src;
+    }
+}
+
+void main(void) {
+    Colour destColour = dest(gl_FragCoord.xy);
+    Colour srcColour = src();
+    vec4 blended = vec4(blendByMode(blendModeIndex, destColour.rgba.rgb, srcColour.rgba.rgb), srcColour.rgba.a);
+    vec4 composed = unpremultiply(composeByMode(composeModeIndex, destColour.rgba, blended));
+    if (destMode == 1) fragment = $VALUE_TYPE(quantiseBruteForce(destPaletteTexture, uint(destPaletteScale), composed, 0.5, destData.transparent.index));
+    else if (destMode == 2) fragment = $VALUE_TYPE(fromUnit((composed.r + composed.g + composed.b) / 3.0, $SCALAR_VALUE_TYPE(destScale)));
+    else fragment = $VALUE_TYPE(fromUnit(composed, $SCALAR_VALUE_TYPE(destScale)));
+}
+)";
+    // Extra output components are ignored by attachments with fewer
+    const Buffer::Format outputFormat(format.componentType, format.componentSize, 4);
+    stringMultiReplace(src, {
+        {"$VALUE_TYPE", outputFormat.shaderValueType()},
+        {"$SCALAR_VALUE_TYPE", outputFormat.shaderScalarValueType()},
+    });
+    return src;
+}
+
 QString RenderManager::widgetFragmentMainShaderPart()
 {
     QString src;
@@ -747,10 +1032,31 @@ void main(void) {
 
 void RenderManager::bindBufferShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint bufferTextureLocation, const Buffer *const buffer)
 {
-    glUniform1i(program.uniformLocation(name + "Texture"), bufferTextureLocation);
+    glUniform1i(programManager.reflection(&program).uniformLocation(name + "Texture"), bufferTextureLocation);
+    glUniform2i(programManager.reflection(&program).uniformLocation(name + "Origin"), buffer->origin().x(), buffer->origin().y());
     buffer->bindTextureUnit(bufferTextureLocation);
 }
 
+void RenderManager::bindUberBufferShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint bufferTextureLocation, const Buffer *const buffer, const bool indexed, const GLint paletteTextureLocation, const Buffer *const palette)
+{
+    bindBufferShaderPart(program, name, bufferTextureLocation, buffer);
+    glUniform1f(programManager.reflection(&program).uniformLocation(name + "Scale"), buffer->format().scale());
+    glUniform1i(programManager.reflection(&program).uniformLocation(name + "Mode"), !indexed ? 0 : (palette ? 1 : 2));
+    // Set even when unused so the palette sampler never shares a unit with a sampler of another type
+    glUniform1i(programManager.reflection(&program).uniformLocation(name + "PaletteTexture"), paletteTextureLocation);
+    if (indexed && palette) {
+        glUniform1f(programManager.reflection(&program).uniformLocation(name + "PaletteScale"), palette->format().scale());
+        palette->bindTextureUnit(paletteTextureLocation);
+    }
+}
+
+void RenderManager::bindBufferPyramidShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint pyramidTextureLocation, const GLuint pyramidTexture, const int level)
+{
+    glUniform1i(programManager.reflection(&program).uniformLocation(name + "PyramidTexture"), pyramidTextureLocation);
+    glUniform1i(programManager.reflection(&program).uniformLocation(name + "PyramidLevel"), level);
+    OpenGLState::current().bindTextureUnit(pyramidTextureLocation, GL_TEXTURE_2D, pyramidTexture);
+}
+
 void RenderManager::bindIndexedBufferShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint bufferTextureLocation, const Buffer *const buffer, const bool indexed, const GLint paletteTextureLocation, const Buffer *const palette)
 {
     bindBufferShaderPart(program, name, bufferTextureLocation, buffer);
@@ -10,12 +10,27 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
+#include <memory>
 #include <set>
 
 #include "buffer.h"
 #include "brush.h"
+#include "framescheduler.h"
+#include "bufferatlas.h"
+#include "streambuffer.h"
+#include "bufferbatcher.h"
+#include "computecompositor.h"
 #include "types.h"
 #include "program.h"
+#include "programcache.h"
+#include "programcompiler.h"
+#include "renderthread.h"
+#include "gpuworkerpool.h"
+#include "frameprofiler.h"
+
+namespace simplecpp {
+class TokenList;
+}
 
 namespace GfxPaint {
 
@@ -55,6 +70,27 @@ public:
         QString functionName;
     };
 
+    // Scene resolution policy while the view transform is being changed interactively
+    struct InteractiveResolution {
+        enum class Mode {
+            Full,
+            Fixed,
+            Adaptive,
+        };
+
+        Mode mode = Mode::Adaptive;
+        float fixedScale = 0.5f;
+        float minScale = 0.25f;
+        // Milliseconds
+        float targetFrameTime = 16.0f;
+        int refineDelay = 200;
+    };
+
+    enum class Compositor {
+        DrawPerLayer,
+        Compute,
+    };
+
     static constexpr std::tuple<int, int> openGLVersion = {4, 3};
     static constexpr std::tuple<int, int> openGLESVersion = {3, 2};
 
@@ -71,10 +107,22 @@ public:
     QOpenGLContext context;
     QOpenGLDebugLogger logger;
     QOpenGLVertexArrayObject vao;
+    StreamBuffer streamBuffer;
 
     std::map<QString, Model *> models;
     ProgramManager programManager;
+    ProgramCache programCache;
+    ProgramCompiler programCompiler;
+    RenderThread renderThread;
+    GpuWorkerPool gpuWorkers;
+    FrameProfiler profiler;
     std::map<QString, Program *> programs;
+    FrameScheduler frameScheduler;
+    InteractiveResolution interactiveResolution;
+    Compositor compositor;
+    ComputeCompositor computeCompositor;
+    BufferAtlas bufferAtlas;
+    BufferBatcher bufferBatcher;
 
     explicit RenderManager();
     virtual ~RenderManager();
@@ -83,12 +131,21 @@ public:
     static bool isOpenGLES();
     static QString glslVersionString();
 
+    // Shared fallback for buffer programs not compiled yet
+    BufferUberProgram *bufferUberProgram(const Buffer::Format &srcFormat, const Buffer::Format &srcPaletteFormat, const Buffer::Format &destFormat, const Buffer::Format &destPaletteFormat, const bool srcPyramid, const bool instanced);
+
+    // Immediate mode geometry for one draw, float vertices of the given attribute sizes are written to the stream
+    // buffer and drawn with a vertex array kept per attribute layout, so no GL objects are made per call
+    void drawTransient(const GLenum primitive, const std::vector<GLsizei> &attributeSizes, const GLfloat *const vertices, const GLsizei vertexCount);
+
     GLuint bufferAddDepthStencilAttachment(Buffer *const buffer);
     void bufferRemoveDepthStencilAttachment(Buffer *const buffer, const GLuint texture);
 
     static const QString shadersPath;
     void addGlslIncludes(const std::vector<QString> &includes);
     QString preprocessGlsl(const QString &src, const QString &filename, const std::unordered_map<QString, QString> &defines);
+    // Source generation and preprocessing time for the buffer program permutations of one format
+    static void benchmarkProgramGeneration(const int iterations = 20);
 
     static QString headerShaderPart();
     static QString resourceShaderPart(const QString &filename);
@@ -96,21 +153,41 @@ public:
     static QString attributelessShaderPart(const AttributelessModel model);
     static QString modelVertexMainShaderPart();
     static QString vertexMainShaderPart();
+    // Transforms read from the drawData uniform block
+    static QString drawDataVertexMainShaderPart();
+    // Unit quad per instance, scaled and transformed by instance data read from a storage buffer
+    static QString instancedVertexMainShaderPart(const GLint storageBinding);
     static QString patternShaderPart(const QString &name, const Pattern pattern);
     static QString paletteShaderPart(const QString &name, const GLint paletteTextureLocation, const Buffer::Format paletteFormat);
-    static QString bufferShaderPart(const QString &name, const GLint uniformBlockBinding, const GLint bufferTextureLocation, const Buffer::Format bufferFormat, const bool indexed, const GLint paletteTextureLocation, const Buffer::Format paletteFormat);
+    // With originInDrawData the origin is read from the drawData uniform block instead of a uniform
+    static QString bufferShaderPart(const QString &name, const GLint uniformBlockBinding, const GLint bufferTextureLocation, const Buffer::Format bufferFormat, const bool indexed, const GLint paletteTextureLocation, const Buffer::Format paletteFormat, const bool originInDrawData = false);
+    // Format scales, palette use and indexing chosen by uniforms, only sampler types are fixed
+    static QString uberBufferShaderPart(const QString &name, const GLint uniformBlockBinding, const GLint bufferTextureLocation, const Buffer::Format bufferFormat, const GLint paletteTextureLocation, const Buffer::Format paletteFormat);
+    static QString bufferPyramidShaderPart(const QString &name, const GLint pyramidTextureLocation, const bool levelInDrawData = false);
     static QString standardInputFragmentShaderPart(const QString &name);
     static QString modelFragmentShaderPart(const QString &name);
     static QString colourPlaneShaderPart(const QString &name, const ColourSpace colourSpace, const bool useXAxis, const bool useYAxis, const bool quantise, const GLint quantisePaletteTextureLocation, const Buffer::Format quantisePaletteFormat);
     static QString colourPaletteShaderPart(const QString &name);
     static QString standardFragmentMainShaderPart(const Buffer::Format format, const bool indexed, const GLint paletteTextureLocation, const Buffer::Format paletteFormat, const int blendMode, const int composeMode);
+    // Blend and compose modes chosen by uniforms, for use with uber buffer parts
+    static QString uberFragmentMainShaderPart(const Buffer::Format format);
     static QString widgetFragmentMainShaderPart();
 
     void bindBufferShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint bufferTextureLocation, const Buffer *const buffer);
     void bindIndexedBufferShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint bufferTextureLocation, const Buffer *const buffer, const bool indexed, const GLint paletteTextureLocation, const Buffer *const palette);
+    void bindUberBufferShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint bufferTextureLocation, const Buffer *const buffer, const bool indexed, const GLint paletteTextureLocation, const Buffer *const palette);
+    void bindBufferPyramidShaderPart(QOpenGLShaderProgram &program, const QString &name, const GLint pyramidTextureLocation, const GLuint pyramidTexture, const int level);
 
 private:
-    std::map<std::string, std::string> includeSources;
+    // Shader parts that only depend on their key, generated once and shared by every program source
+    static const QString &internedShaderPart(const QString &key, const std::function<QString()> &generate);
+
+    // Tokenised once when added, token locations refer to includeFiles
+    std::vector<std::string> includeFiles;
+    std::map<std::string, std::unique_ptr<simplecpp::TokenList>> includeTokenLists;
+    std::map<std::tuple<int, int, int, int, bool, bool>, BufferUberProgram *> bufferUberPrograms;
+    // Vertex arrays are not shared between contexts, these belong to the render context
+    std::map<std::vector<GLsizei>, GLuint> transientVertexArrays;
 };
 
 } // namespace GfxPaint
@@ -0,0 +1,141 @@
+#include "renderthread.h"
+
+#include "application.h"
+
+namespace GfxPaint {
+
+RenderThread::RenderThread(QObject *const parent) :
+    QObject(parent),
+    thread(), mainThread(nullptr), worker(nullptr),
+    context(nullptr), surface(nullptr),
+    mutex(), returned(), commands(),
+    lent(false), handOffPosted(false), m_framesInFlight(0)
+{
+}
+
+RenderThread::~RenderThread()
+{
+    Q_ASSERT(!worker);
+}
+
+void RenderThread::start(QOpenGLContext *const context, QOffscreenSurface *const surface)
+{
+    this->context = context;
+    this->surface = surface;
+    mainThread = QThread::currentThread();
+    worker = new QObject();
+    worker->moveToThread(&thread);
+    thread.setObjectName("Render");
+    thread.start();
+    ContextBinder::reclaim = &RenderThread::reclaim;
+}
+
+void RenderThread::stop()
+{
+    if (!worker) return;
+
+    sync();
+    ContextBinder::reclaim = nullptr;
+    thread.quit();
+    thread.wait();
+    delete worker;
+    worker = nullptr;
+}
+
+bool RenderThread::enqueueFrame(QObject *const receiver, const std::function<void()> &render, const std::function<void()> &finished)
+{
+    if (m_framesInFlight >= maxFramesInFlight) return false;
+
+    ++m_framesInFlight;
+    push([this, receiver, render, finished](){
+        render();
+        // Frames are shown from the widget context, which only sees writes that have finished
+        context->functions()->glFinish();
+        --m_framesInFlight;
+        QMetaObject::invokeMethod(receiver, finished, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+void RenderThread::sync()
+{
+    Q_ASSERT(QThread::currentThread() == mainThread);
+    QMutexLocker locker(&mutex);
+    while (lent) returned.wait(&mutex);
+    // Commands not handed off yet run here, so nothing queued outlives what it refers to
+    while (!commands.empty()) {
+        const std::function<void()> command = std::move(commands.front());
+        commands.pop_front();
+        locker.unlock();
+        {
+            ContextBinder contextBinder(context, surface);
+            command();
+        }
+        locker.relock();
+    }
+}
+
+void RenderThread::push(const std::function<void()> &command)
+{
+    QMutexLocker locker(&mutex);
+    commands.push_back(command);
+    // A running queue picks the command up
+    if (lent || handOffPosted) return;
+
+    handOffPosted = true;
+    locker.unlock();
+    if (QThread::currentThread() == mainThread && QOpenGLContext::currentContext() != context) handOff();
+    else QMetaObject::invokeMethod(this, &RenderThread::handOff, Qt::QueuedConnection);
+}
+
+void RenderThread::handOff()
+{
+    QMutexLocker locker(&mutex);
+    handOffPosted = false;
+    if (!worker || lent || commands.empty()) return;
+    // Bound by a context binder further up the stack, from a nested event loop
+    if (QOpenGLContext::currentContext() == context) {
+        handOffPosted = true;
+        QMetaObject::invokeMethod(this, &RenderThread::handOff, Qt::QueuedConnection);
+        return;
+    }
+
+    context->moveToThread(&thread);
+    lent = true;
+    locker.unlock();
+    QMetaObject::invokeMethod(worker, [this](){
+        runQueue();
+    }, Qt::QueuedConnection);
+}
+
+void RenderThread::runQueue()
+{
+    const bool makeCurrentSuccess = context->makeCurrent(surface);
+    Q_ASSERT(makeCurrentSuccess);
+
+    QMutexLocker locker(&mutex);
+    while (!commands.empty()) {
+        const std::function<void()> command = std::move(commands.front());
+        commands.pop_front();
+        locker.unlock();
+        command();
+        locker.relock();
+    }
+
+    context->doneCurrent();
+    context->moveToThread(mainThread);
+    lent = false;
+    returned.wakeAll();
+}
+
+// Every main thread bind of the render context waits for queued frames. Widget frames go through enqueueFrame, what
+// still binds on the main thread is creating and deleting GL objects: programs when a widget's brush, palette or
+// colour space changes, widget buffers on resize and the first frame after it, node buffers, tool programs and
+// work buffers.
+void RenderThread::reclaim(QOpenGLContext *const context)
+{
+    RenderThread &renderThread = qApp->renderManager.renderThread;
+    if (context == renderThread.context && QThread::currentThread() == renderThread.mainThread) renderThread.sync();
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,104 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QFuture>
+#include <QMutex>
+#include <QObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QPromise>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+#include "opengl.h"
+
+namespace GfxPaint {
+
+// Runs queued commands on a dedicated thread with the render context current. The context is lent to the thread
+// while commands are queued and comes back to the main thread once the queue is empty, so main thread code that
+// binds the render context waits for running commands rather than racing them.
+class RenderThread : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Frames queued or rendering at once, beyond this widgets keep showing their last frame so latency stays bounded
+    static constexpr int maxFramesInFlight = 2;
+
+    explicit RenderThread(QObject *const parent = nullptr);
+    virtual ~RenderThread() override;
+
+    void start(QOpenGLContext *const context, QOffscreenSurface *const surface);
+    void stop();
+    bool isRunning() const { return worker; }
+
+    // Results come back through the future, commands run in the order they were queued
+    template<typename Result>
+    QFuture<Result> enqueue(const std::function<Result()> &command);
+    // Waits for the result, runs the command directly if the render context is already current on this thread
+    template<typename Result>
+    Result run(const std::function<Result()> &command);
+
+    // Returns false while maxFramesInFlight frames are queued, finished is called on the receiver's thread
+    bool enqueueFrame(QObject *const receiver, const std::function<void()> &render, const std::function<void()> &finished);
+    int framesInFlight() const { return m_framesInFlight; }
+
+    // Finishes everything queued and takes the render context back, for main thread code about to change state commands read
+    void sync();
+
+protected:
+    void push(const std::function<void()> &command);
+    void handOff();
+    void runQueue();
+    static void reclaim(QOpenGLContext *const context);
+
+    QThread thread;
+    QThread *mainThread;
+    QObject *worker;
+    QOpenGLContext *context;
+    QOffscreenSurface *surface;
+
+    QMutex mutex;
+    QWaitCondition returned;
+    std::deque<std::function<void()>> commands;
+    bool lent;
+    bool handOffPosted;
+    std::atomic<int> m_framesInFlight;
+};
+
+template<typename Result>
+QFuture<Result> RenderThread::enqueue(const std::function<Result()> &command)
+{
+    const std::shared_ptr<QPromise<Result>> promise = std::make_shared<QPromise<Result>>();
+    QFuture<Result> future = promise->future();
+    promise->start();
+    push([promise, command](){
+        if constexpr (std::is_void_v<Result>) command();
+        else promise->addResult(command());
+        promise->finish();
+    });
+    return future;
+}
+
+template<typename Result>
+Result RenderThread::run(const std::function<Result()> &command)
+{
+    if (QOpenGLContext::currentContext() == context) return command();
+    if (!isRunning()) {
+        ContextBinder contextBinder(context, surface);
+        return command();
+    }
+
+    QFuture<Result> future = enqueue(command);
+    future.waitForFinished();
+    if constexpr (!std::is_void_v<Result>) return future.result();
+}
+
+} // namespace GfxPaint
+
+#endif // RENDERTHREAD_H
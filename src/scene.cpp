@@ -3,17 +3,28 @@
 #include <QImageReader>
 #include <QJsonDocument>
 #include <QMdiSubWindow>
+#include <QElapsedTimer>
 #include <functional>
+#include <cmath>
+#include <map>
+#include <tuple>
 
 #include "application.h"
 #include "utils.h"
 
 namespace GfxPaint {
 
-Traversal::State::~State() {
-    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
-    // TODO: crash with delete here
-//    delete palette;
+Traversal::State Traversal::state()
+{
+    std::shared_ptr<Buffer> palette;
+    if (!paletteStack.isEmpty()) {
+        // Saved states can outlive the render they were taken in, so release the copy in the render context
+        palette = std::shared_ptr<Buffer>(new Buffer(*paletteStack.top()), [](Buffer *const buffer){
+            ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+            delete buffer;
+        });
+    }
+    return {!renderTargetStack.isEmpty() ? renderTargetStack.top() : RenderTarget(), transformStack.top(), *(++transformStack.rbegin()), palette, rendering};
 }
 
 Scene::Scene(const QString &filename) :
@@ -21,14 +32,18 @@ Scene::Scene(const QString &filename) :
     bufferEditors(),
     file(),
     m_filename(filename),
-    m_modified(false)
+    m_modified(false),
+    m_flatNodes(), m_flatNodeIndices(), m_flatDepth(0), m_structureModified(true), m_structureVersion(nextVersion()),
+    m_traversal()
 {}
 
 Scene::Scene(const Scene &other) :
     root(other.root),
     bufferEditors(other.bufferEditors),
     m_filename(other.m_filename),
-    m_modified(other.m_modified)
+    m_modified(other.m_modified),
+    m_flatNodes(), m_flatNodeIndices(), m_flatDepth(0), m_structureModified(true), m_structureVersion(nextVersion()),
+    m_traversal()
 {}
 
 Scene *Scene::clone() const
@@ -93,6 +108,9 @@ Scene *Scene::open(const QString &filename)
         scene->m_filename = filename;
         scene->root.insertChild(scene->root.children.length(), node);
         scene->m_modified = false;
+        scene->setStructureModified();
+        scene->packSprites();
+        scene->packLayers();
         return scene;
     }
     return nullptr;
@@ -135,33 +153,519 @@ void Scene::afterChildren(Node *const node, Traversal &traversal)
     node->afterChildren(traversal);
 }
 
-void Scene::renderSubGraph(Node *const node, Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, const Mat4 &parentTransform, std::unordered_map<Node *, Traversal::State> *const saveStates)
+void Scene::renderSubGraph(Node *const node, Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, const Mat4 &parentTransform, std::unordered_map<Node *, Traversal::State> *const saveStates, const QRect &scissor)
 {
-    Traversal traversal;
+    const std::vector<FlatNode> &nodes = flatNodes();
 
+    Traversal &traversal = m_traversal;
     traversal.saveStates = saveStates;
+    traversal.renderTargetStack.clear();
+    traversal.transformStack.clear();
+    traversal.paletteStack.clear();
+    traversal.renderTargetStack.reserve(m_flatDepth + 1);
+    traversal.transformStack.reserve(m_flatDepth + 1);
+    traversal.paletteStack.reserve(m_flatDepth + 1);
 
-    if (buffer) traversal.renderTargetStack.push({buffer, indexed, palette, viewTransform});
+    if (buffer) traversal.renderTargetStack.push({buffer, indexed, palette, viewTransform, scissor});
 //    else traversal.renderTargetStack.push({});
+    traversal.compositor = compositorFor(buffer, indexed);
+    traversal.batcher = batcherFor(buffer, traversal.compositor);
     traversal.transformStack.push(parentTransform);
     if (palette) traversal.paletteStack.push(palette);
 
-    traverse<Traversal &>(node, Scene::beforeChildren, Scene::afterChildren, traversal);
-//    traverse(node, traversal);
+    const auto found = m_flatNodeIndices.find(node);
+    if (found != m_flatNodeIndices.end()) {
+        const int begin = found->second;
+        const int end = begin + nodes[begin].skip;
+        for (int i = begin; i <= end; ++i) {
+            const FlatNode &flatNode = nodes[i];
+            if (!flatNode.exit) beforeChildren(flatNode.node, traversal);
+            else afterChildren(flatNode.node, traversal);
+        }
+    }
+    // Node is disabled or not part of this scene
+    else traverse<Traversal &>(node, Scene::beforeChildren, Scene::afterChildren, traversal);
 
+    if (traversal.compositor) traversal.compositor->flush();
+    traversal.compositor = nullptr;
+    if (traversal.batcher) traversal.batcher->flush();
+    traversal.batcher = nullptr;
     if (palette) traversal.paletteStack.pop();
     traversal.transformStack.pop();
     if (buffer) traversal.renderTargetStack.pop();
+    traversal.saveStates = nullptr;
+}
+
+void Scene::render(Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, std::unordered_map<Node *, Traversal::State> *const saveStates, const QRect &scissor)
+{
+    renderSubGraph(&root, buffer, indexed, palette, viewTransform, Mat4(), saveStates, scissor);
+}
+
+void Scene::renderSegments(const std::vector<int> &splits, const SegmentFunc &beginSegment, const Mat4 &viewTransform, std::unordered_map<Node *, Traversal::State> *const saveStates, SubtreeCaches *const subtreeCaches)
+{
+    const std::vector<FlatNode> &nodes = flatNodes();
+
+    Traversal &traversal = m_traversal;
+    traversal.saveStates = saveStates;
+    traversal.renderTargetStack.clear();
+    traversal.transformStack.clear();
+    traversal.paletteStack.clear();
+    traversal.renderTargetStack.reserve(1);
+    traversal.transformStack.reserve(m_flatDepth + 1);
+    traversal.paletteStack.reserve(m_flatDepth + 1);
+
+    traversal.transformStack.push(Mat4());
+    if (subtreeCaches) {
+        for (auto &[node, cache] : *subtreeCaches) cache.used = false;
+    }
+
+    int begin = 0;
+    for (int segment = 0; segment <= static_cast<int>(splits.size()); ++segment) {
+        const int end = segment < static_cast<int>(splits.size()) ? splits[segment] : static_cast<int>(nodes.size());
+        Q_ASSERT(begin <= end && end <= static_cast<int>(nodes.size()));
+
+        Buffer *const buffer = beginSegment(segment);
+        if (buffer) traversal.renderTargetStack.push({buffer, false, nullptr, viewTransform});
+        // Segments only harvesting states keep their caches for when they're drawn again
+        else if (subtreeCaches) {
+            for (auto &[node, cache] : *subtreeCaches) {
+                const auto found = m_flatNodeIndices.find(node);
+                if (found != m_flatNodeIndices.end() && found->second >= begin && found->second < end) cache.used = true;
+            }
+        }
+        traversal.compositor = compositorFor(buffer, false);
+        traversal.batcher = batcherFor(buffer, traversal.compositor);
+        for (int i = begin; i < end; ++i) {
+            const FlatNode &flatNode = nodes[i];
+            // The root is the whole scene, which the editor keeps as its previous frame
+            if (subtreeCaches && buffer && !flatNode.exit && i > 0 && i + flatNode.skip < end && renderCachedSubtree(i, *subtreeCaches)) {
+                i += flatNode.skip;
+                continue;
+            }
+            if (!flatNode.exit) beforeChildren(flatNode.node, traversal);
+            else afterChildren(flatNode.node, traversal);
+        }
+        // Next segment's buffer may be cleared or read by beginSegment
+        if (traversal.compositor) traversal.compositor->flush();
+        traversal.compositor = nullptr;
+        if (traversal.batcher) traversal.batcher->flush();
+        traversal.batcher = nullptr;
+        if (buffer) traversal.renderTargetStack.pop();
+
+        begin = end;
+    }
+
+    traversal.transformStack.pop();
+    traversal.saveStates = nullptr;
+
+    // Caches of groups that were removed, came to hold a saved node or now cross a split
+    if (subtreeCaches) {
+        for (auto iterator = subtreeCaches->begin(); iterator != subtreeCaches->end();) {
+            if (iterator->second.used) {
+                ++iterator;
+                continue;
+            }
+            qApp->workBufferManager.returnBuffer(iterator->second.buffer);
+            iterator = subtreeCaches->erase(iterator);
+        }
+    }
+}
+
+void Scene::releaseSubtreeCaches(SubtreeCaches &subtreeCaches)
+{
+    for (auto &[node, cache] : subtreeCaches) qApp->workBufferManager.returnBuffer(cache.buffer);
+    subtreeCaches.clear();
+}
+
+bool Scene::renderCachedSubtree(const int index, SubtreeCaches &subtreeCaches)
+{
+    const std::vector<FlatNode> &nodes = flatNodes();
+    Traversal &traversal = m_traversal;
+    const FlatNode &flatNode = nodes[index];
+    const int exit = index + flatNode.skip;
+    if (flatNode.skip < minSubtreeCacheEntries || traversal.renderTargetStack.isEmpty()) return false;
+    // Caches are composited over the whole target with plain colour
+    const Traversal::RenderTarget target = traversal.renderTargetStack.top();
+    if (target.indexed || target.palette || !target.scissor.isNull()) return false;
+    if (traversal.saveStates) {
+        for (const auto &[node, state] : *traversal.saveStates) {
+            const int savedIndex = flatIndex(node);
+            if (savedIndex >= index && savedIndex <= exit) return false;
+        }
+    }
+    if (!subtreeCaches.contains(flatNode.node) && static_cast<int>(subtreeCaches.size()) >= maxSubtreeCaches) return false;
+
+    SubtreeCache &cache = subtreeCaches[flatNode.node];
+    cache.used = true;
+    if (!cache.buffer || cache.buffer->size() != target.buffer->size() || cache.buffer->format() != target.buffer->format()) {
+        qApp->workBufferManager.returnBuffer(cache.buffer);
+        cache.buffer = qApp->workBufferManager.takeBuffer(target.buffer->format(), target.buffer->size());
+        cache.version = 0;
+    }
+
+    // Keep layer order with nodes queued before the subtree
+    if (traversal.compositor) traversal.compositor->flush();
+    if (traversal.batcher) traversal.batcher->flush();
+
+    const Mat4 transform = target.transform * traversal.transformStack.top();
+    const Buffer *const palette = !traversal.paletteStack.isEmpty() ? traversal.paletteStack.top() : nullptr;
+    const quint64 version = std::max(contentVersion(index, exit + 1), palette ? palette->version() : 0);
+    if (cache.version != version || cache.transform != transform || cache.palette != palette) {
+        FrameProfiler::Scope profileScope("Subtree cache", flatNode.node->name);
+        cache.version = version;
+        cache.transform = transform;
+        cache.palette = palette;
+        cache.buffer->clear();
+        traversal.renderTargetStack.push({cache.buffer, false, nullptr, target.transform});
+        for (int i = index; i <= exit; ++i) {
+            if (!nodes[i].exit) beforeChildren(nodes[i].node, traversal);
+            else afterChildren(nodes[i].node, traversal);
+        }
+        if (traversal.compositor) traversal.compositor->flush();
+        if (traversal.batcher) traversal.batcher->flush();
+        traversal.renderTargetStack.pop();
+    }
+
+    // Blended over what is below like the subtree's nodes would have been, one at a time
+    Buffer *const destCopy = qApp->workBufferManager.takeBuffer(target.buffer->format(), target.buffer->size());
+    destCopy->copy(*target.buffer);
+    target.buffer->bindFramebuffer();
+    qApp->renderManager.bufferUberProgram(cache.buffer->format(), Buffer::Format(), target.buffer->format(), Buffer::Format(), false, false)
+        ->render(cache.buffer, false, nullptr, Colour{}, viewportToClipTransform(target.buffer->size()), destCopy, false, nullptr, Colour{}, 0, RenderManager::composeModeDefault);
+    qApp->workBufferManager.returnBuffer(destCopy);
+    return true;
+}
+
+void Scene::setStructureModified()
+{
+    m_structureModified = true;
+    m_structureVersion = nextVersion();
+}
+
+const std::vector<Scene::FlatNode> &Scene::flatNodes()
+{
+    if (m_structureModified) flatten();
+    return m_flatNodes;
 }
 
-void Scene::render(Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, std::unordered_map<Node *, Traversal::State> *const saveStates)
+int Scene::flatIndex(Node *const node)
 {
-    renderSubGraph(&root, buffer, indexed, palette, viewTransform, Mat4(), saveStates);
+    flatNodes();
+    const auto found = m_flatNodeIndices.find(node);
+    return found != m_flatNodeIndices.end() ? found->second : -1;
+}
+
+quint64 Scene::contentVersion(const int begin, const int end)
+{
+    const std::vector<FlatNode> &nodes = flatNodes();
+    quint64 version = m_structureVersion;
+    for (int i = begin; i < end; ++i) {
+        if (!nodes[i].exit) version = std::max(version, nodes[i].node->contentVersion());
+    }
+    return version;
+}
+
+int Scene::packSprites(const int minSprites)
+{
+    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+
+    const std::vector<FlatNode> &nodes = flatNodes();
+    std::vector<BufferNode *> candidates;
+    std::unordered_set<GLuint> candidateTextures;
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        // Only leaves, nodes with children are render targets for them
+        BufferNode *const bufferNode = !nodes[i].exit && nodes[i].skip == 1 ? dynamic_cast<BufferNode *>(nodes[i].node) : nullptr;
+        if (!bufferNode || bufferNode->indexed || !BufferAtlas::accepts(bufferNode->buffer)) continue;
+        candidates.push_back(bufferNode);
+        candidateTextures.insert(bufferNode->buffer.texture());
+    }
+    if (static_cast<int>(candidateTextures.size()) < minSprites) return 0;
+
+    // Nodes sharing a buffer keep sharing it
+    std::unordered_map<GLuint, Buffer> sprites;
+    int packed = 0;
+    for (BufferNode *const bufferNode : candidates) {
+        Buffer &buffer = bufferNode->buffer;
+        auto found = sprites.find(buffer.texture());
+        if (found == sprites.end()) {
+            const GLuint texture = buffer.texture();
+            if (!qApp->renderManager.bufferAtlas.pack(buffer)) continue;
+            sprites.insert({texture, buffer});
+        }
+        else buffer = found->second;
+        ++packed;
+    }
+    return packed;
+}
+
+int Scene::packLayers(const int minLayers)
+{
+    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    if (!BufferArray::isSupported()) return 0;
+
+    // Group in scene order so packed layers are consecutive for batching
+    using Key = std::tuple<int, int, Buffer::Format>;
+    std::map<Key, std::vector<BufferNode *>> groups;
+    // Layers already packed count towards minLayers, nodes added later join their arrays while they have free layers
+    std::map<Key, std::vector<std::shared_ptr<BufferArray>>> arrays;
+    std::map<Key, int> packedCounts;
+    for (const FlatNode &flatNode : flatNodes()) {
+        BufferNode *const bufferNode = flatNode.exit ? nullptr : dynamic_cast<BufferNode *>(flatNode.node);
+        if (!bufferNode || bufferNode->buffer.isNull() || bufferNode->buffer.atlasPage()) continue;
+        const Key key{bufferNode->buffer.width(), bufferNode->buffer.height(), bufferNode->buffer.format()};
+        if (bufferNode->buffer.array()) {
+            std::vector<std::shared_ptr<BufferArray>> &keyArrays = arrays[key];
+            if (std::find(keyArrays.begin(), keyArrays.end(), bufferNode->buffer.sharedArray()) == keyArrays.end()) keyArrays.push_back(bufferNode->buffer.sharedArray());
+            ++packedCounts[key];
+        }
+        else groups[key].push_back(bufferNode);
+    }
+
+    const int maxCapacity = BufferArray::maxCapacity();
+    int packed = 0;
+    for (const auto &[key, nodes] : groups) {
+        if (static_cast<int>(nodes.size()) + packedCounts[key] < minLayers) continue;
+        const auto &[width, height, format] = key;
+        std::vector<std::shared_ptr<BufferArray>> &keyArrays = arrays[key];
+        // Nodes sharing a buffer keep sharing it
+        std::unordered_map<GLuint, Buffer> layers;
+        for (std::size_t i = 0; i < nodes.size(); ++i, ++packed) {
+            Buffer &buffer = nodes[i]->buffer;
+            auto found = layers.find(buffer.texture());
+            if (found == layers.end()) {
+                auto array = std::find_if(keyArrays.begin(), keyArrays.end(), [](const std::shared_ptr<BufferArray> &array){
+                    return !array->isFull();
+                });
+                if (array == keyArrays.end()) {
+                    // Spare layers let copy on write keep edited copies in the array
+                    const int count = std::min(static_cast<int>(nodes.size() - i), maxCapacity);
+                    const int capacity = std::min(count + count / 4 + 1, maxCapacity);
+                    keyArrays.push_back(std::make_shared<BufferArray>(QSize(width, height), format, capacity));
+                    array = std::prev(keyArrays.end());
+                }
+                Buffer layer(*array);
+                layer.copy(buffer);
+                found = layers.insert({buffer.texture(), layer}).first;
+            }
+            buffer = found->second;
+        }
+    }
+    return packed;
+}
+
+void Scene::flatten()
+{
+    m_flatNodes.clear();
+    m_flatNodeIndices.clear();
+    m_flatDepth = 0;
+
+    std::vector<std::pair<Node *, int>> stack; // Node and index of next child to visit
+    m_flatNodeIndices[&root] = 0;
+    m_flatNodes.push_back({&root, 0, false});
+    stack.push_back({&root, 0});
+    while (!stack.empty()) {
+        m_flatDepth = std::max(m_flatDepth, static_cast<int>(stack.size()));
+        Node *const node = stack.back().first;
+        const int childIndex = stack.back().second++;
+        if (childIndex < node->children.size()) {
+            Node *const child = node->children[childIndex];
+            if (child->enabled) {
+                m_flatNodeIndices[child] = static_cast<int>(m_flatNodes.size());
+                m_flatNodes.push_back({child, 0, false});
+                stack.push_back({child, 0});
+            }
+        }
+        else {
+            const int enterIndex = m_flatNodeIndices[node];
+            m_flatNodes[enterIndex].skip = static_cast<int>(m_flatNodes.size()) - enterIndex;
+            m_flatNodes.push_back({node, 0, true});
+            stack.pop_back();
+        }
+    }
+
+    m_structureModified = false;
+}
+
+ComputeCompositor *Scene::compositorFor(const Buffer *const buffer, const bool indexed)
+{
+    // Image stores would address the whole atlas page
+    if (!buffer || buffer->atlasPage() || qApp->renderManager.compositor != RenderManager::Compositor::Compute || !ComputeCompositor::accepts(false, buffer->format(), indexed)) return nullptr;
+    return &qApp->renderManager.computeCompositor;
+}
+
+BufferBatcher *Scene::batcherFor(const Buffer *const buffer, const ComputeCompositor *const compositor)
+{
+    if (!buffer || compositor || !BufferBatcher::isSupported()) return nullptr;
+    return &qApp->renderManager.bufferBatcher;
+}
+
+void Scene::benchmarkTraversal(const int nodeCount, const int iterations)
+{
+    // Two level graph of spatial nodes, no render target so no GL work is done
+    Scene scene;
+    const int groupSize = std::max(1, static_cast<int>(std::sqrt(nodeCount)));
+    int count = 0;
+    while (count < nodeCount) {
+        Node *const group = new SpatialNode();
+        scene.root.insertChild(scene.root.children.length(), group);
+        ++count;
+        for (int i = 0; i < groupSize - 1 && count < nodeCount; ++i, ++count) {
+            group->insertChild(i, new SpatialNode());
+        }
+    }
+    scene.setStructureModified();
+
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        Traversal traversal;
+        traversal.transformStack.push(Mat4());
+        traverse<Traversal &>(&scene.root, Scene::beforeChildren, Scene::afterChildren, traversal);
+    }
+    const qint64 queueNsecs = timer.nsecsElapsed();
+
+    timer.start();
+    scene.flatNodes();
+    const qint64 flattenNsecs = timer.nsecsElapsed();
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        scene.render(nullptr, false, nullptr, Mat4());
+    }
+    const qint64 flatNsecs = timer.nsecsElapsed();
+
+    qDebug() << "Traversal benchmark:" << nodeCount << "nodes," << iterations << "iterations";
+    qDebug() << "  queue:" << queueNsecs / iterations / 1000.0 << "us";
+    qDebug() << "  flat:" << flatNsecs / iterations / 1000.0 << "us" << "(flatten" << flattenNsecs / 1000.0 << "us)";
+}
+
+void Scene::benchmarkCompositors(const int layerCount, const QSize &size, const int iterations)
+{
+    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    OpenGLFunctions gl;
+    gl.initializeOpenGLFunctions();
+
+    // Stack of overlapping, slightly offset layers over one render target
+    const Buffer::Format format(Buffer::Format::ComponentType::UInt, 1, 4);
+    Scene scene;
+    for (int i = 0; i < layerCount; ++i) {
+        Buffer buffer(size, format);
+        buffer.clearUInt(255 * i / layerCount, 128, 255 - 255 * i / layerCount, 128);
+        BufferNode *const node = new BufferNode(buffer, false);
+        Mat4 transform;
+        transform.translate(QVector2D(i % 16, i / 16));
+        node->setTransform(transform);
+        scene.root.insertChild(scene.root.children.length(), node);
+    }
+    scene.setStructureModified();
+    Buffer target(size, format);
+    const Mat4 viewTransform = viewportToClipTransform(size);
+
+    const RenderManager::Compositor previousCompositor = qApp->renderManager.compositor;
+    std::map<RenderManager::Compositor, qint64> nsecs;
+    for (const RenderManager::Compositor compositor : {RenderManager::Compositor::DrawPerLayer, RenderManager::Compositor::Compute}) {
+        qApp->renderManager.compositor = compositor;
+        // Warm up program compilation
+        scene.render(&target, false, nullptr, viewTransform);
+        gl.glFinish();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            target.clear();
+            scene.render(&target, false, nullptr, viewTransform);
+        }
+        gl.glFinish();
+        nsecs[compositor] = timer.nsecsElapsed();
+    }
+
+    // Compute again with the layers in texture arrays
+    qApp->renderManager.compositor = RenderManager::Compositor::Compute;
+    qint64 arrayNsecs = 0;
+    if (scene.packLayers() > 0) {
+        scene.render(&target, false, nullptr, viewTransform);
+        gl.glFinish();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            target.clear();
+            scene.render(&target, false, nullptr, viewTransform);
+        }
+        gl.glFinish();
+        arrayNsecs = timer.nsecsElapsed();
+    }
+    qApp->renderManager.compositor = previousCompositor;
+
+    qDebug() << "Compositor benchmark:" << layerCount << "layers," << size << iterations << "iterations";
+    qDebug() << "  draw per layer:" << nsecs[RenderManager::Compositor::DrawPerLayer] / iterations / 1000000.0 << "ms";
+    qDebug() << "  compute:" << nsecs[RenderManager::Compositor::Compute] / iterations / 1000000.0 << "ms";
+    if (arrayNsecs) qDebug() << "  compute, texture arrays:" << arrayNsecs / iterations / 1000000.0 << "ms";
+}
+
+void Scene::benchmarkSprites(const int spriteCount, const QSize &spriteSize, const int iterations)
+{
+    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    OpenGLFunctions gl;
+    gl.initializeOpenGLFunctions();
+
+    // Grid of separate sprite buffers drawn one node at a time, then from the atlas, then all sharing one buffer
+    const Buffer::Format format(Buffer::Format::ComponentType::UInt, 1, 4);
+    const int columns = std::max(1, static_cast<int>(std::ceil(std::sqrt(spriteCount))));
+    const QSize size(columns * spriteSize.width(), ((spriteCount + columns - 1) / columns) * spriteSize.height());
+    Scene scene;
+    for (int i = 0; i < spriteCount; ++i) {
+        Buffer buffer(spriteSize, format);
+        buffer.clearUInt(255 * i / spriteCount, 128, 255 - 255 * i / spriteCount, 255);
+        BufferNode *const node = new BufferNode(buffer, false);
+        Mat4 transform;
+        transform.translate(QVector2D((i % columns) * spriteSize.width(), (i / columns) * spriteSize.height()));
+        node->setTransform(transform);
+        scene.root.insertChild(scene.root.children.length(), node);
+    }
+    scene.setStructureModified();
+    Buffer target(size, format);
+    const Mat4 viewTransform = viewportToClipTransform(size);
+
+    const RenderManager::Compositor previousCompositor = qApp->renderManager.compositor;
+    qApp->renderManager.compositor = RenderManager::Compositor::DrawPerLayer;
+    std::array<qint64, 3> nsecs = {0, 0, 0};
+    for (int pass = 0; pass < 3; ++pass) {
+        if (pass == 1 && scene.packSprites() == 0) continue;
+        if (pass == 2) {
+            const Buffer shared(spriteSize, format);
+            for (const FlatNode &flatNode : scene.flatNodes()) {
+                BufferNode *const bufferNode = flatNode.exit ? nullptr : dynamic_cast<BufferNode *>(flatNode.node);
+                if (bufferNode) bufferNode->buffer = shared;
+            }
+        }
+        // Warm up program compilation
+        scene.render(&target, false, nullptr, viewTransform);
+        gl.glFinish();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            target.clear();
+            scene.render(&target, false, nullptr, viewTransform);
+        }
+        gl.glFinish();
+        nsecs[pass] = timer.nsecsElapsed();
+    }
+    qApp->renderManager.compositor = previousCompositor;
+
+    qDebug() << "Sprite benchmark:" << spriteCount << "sprites," << spriteSize << iterations << "iterations";
+    qDebug() << "  separate buffers:" << nsecs[0] / iterations / 1000000.0 << "ms";
+    if (nsecs[1]) qDebug() << "  atlas batches:" << nsecs[1] / iterations / 1000000.0 << "ms";
+    qDebug() << "  shared buffer batches:" << nsecs[2] / iterations / 1000000.0 << "ms";
 }
 
 void Scene::bufferAddEditor(Buffer *const buffer, const Editor *const editor)
 {
     if (!bufferEditors.contains(buffer)) {
+        // Depth stencil attachments are the size of the buffer, not its atlas page
+        buffer->unpack();
         bufferEditors[buffer] = {};
         // add depth stencil attachment
         bufferEditors[buffer].first = qApp->renderManager.bufferAddDepthStencilAttachment(buffer);
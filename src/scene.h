@@ -11,7 +11,10 @@
 #include <QOpenGLFramebufferObject>
 #include <QStack>
 #include <QJsonObject>
+#include <memory>
 #include <unordered_set>
+#include <vector>
+#include <functional>
 
 #include "buffer.h"
 #include "node.h"
@@ -19,6 +22,8 @@
 namespace GfxPaint {
 
 class Editor;
+class ComputeCompositor;
+class BufferBatcher;
 
 class Traversal
 {
@@ -28,15 +33,15 @@ public:
         bool indexed = false;
         const Buffer *palette = nullptr;
         Mat4 transform = Mat4();
+        QRect scissor = QRect();
     };
 
     struct State {
-        ~State();
         RenderTarget renderTarget;
         Mat4 transform;
         Mat4 parentTransform;
-        Buffer *palette = nullptr;
-        //Buffer palette;
+        // States are copied into saved state maps, the palette copy goes with the last of them
+        std::shared_ptr<Buffer> palette = nullptr;
         bool rendering;
     };
 
@@ -46,20 +51,44 @@ public:
     QStack<Mat4> transformStack;
     QStack<const Buffer *> paletteStack;
     bool rendering;
+    // Set when buffer layers are batched for the compute compositor instead of drawn
+    ComputeCompositor *compositor;
+    // Set when drawing, consecutive nodes sharing a buffer or atlas page are then drawn in instanced batches
+    BufferBatcher *batcher;
 
     Traversal() :
         saveStates(nullptr),
-        renderTargetStack(), transformStack(), paletteStack()
+        renderTargetStack(), transformStack(), paletteStack(),
+        compositor(nullptr), batcher(nullptr)
     {}
 
-    State state() {
-        return {!renderTargetStack.isEmpty() ? renderTargetStack.top() : RenderTarget(), transformStack.top(), *(++transformStack.rbegin()), !paletteStack.isEmpty() ? new Buffer(*paletteStack.top()) : nullptr, rendering};/////////////////////////////////////
-    }
+    State state();
 };
 
 class Scene
 {
 public:
+    // Pre-order entry of the flattened scene graph. Each node appears once on
+    // entry and once on exit; an entry's skip is the offset to its exit.
+    struct FlatNode {
+        Node *node;
+        int skip;
+        bool exit;
+    };
+
+    // Group subtree composited on its own, reused while its nodes, the transform and palette above it are unchanged
+    struct SubtreeCache {
+        Buffer *buffer = nullptr;
+        quint64 version = 0;
+        Mat4 transform;
+        const Buffer *palette = nullptr;
+        bool used = false;
+    };
+    using SubtreeCaches = std::unordered_map<Node *, SubtreeCache>;
+    // Smaller subtrees composite about as fast as their cache, beyond the count subtrees are drawn as usual
+    static constexpr int minSubtreeCacheEntries = 8;
+    static constexpr int maxSubtreeCaches = 8;
+
     explicit Scene(const QString &filename = QString());
     explicit Scene(const Scene &other);
 
@@ -112,8 +141,30 @@ public:
     }
     static void beforeChildren(Node *const node, Traversal &traversal);
     static void afterChildren(Node *const node, Traversal &traversal);
-    void renderSubGraph(Node *const node, Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, const Mat4 &parentTransform, std::unordered_map<Node *, Traversal::State> * const saveStates = nullptr);
-    void render(Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, std::unordered_map<Node *, Traversal::State> * const saveStates = nullptr);
+    void renderSubGraph(Node *const node, Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, const Mat4 &parentTransform, std::unordered_map<Node *, Traversal::State> * const saveStates = nullptr, const QRect &scissor = QRect());
+    void render(Buffer *const buffer, const bool indexed, const Buffer *const palette, const Mat4 &viewTransform, std::unordered_map<Node *, Traversal::State> * const saveStates = nullptr, const QRect &scissor = QRect());
+
+    using SegmentFunc = std::function<Buffer *(const int segment)>;
+    // Renders the flattened graph in segments split before the given entry indices. Each segment
+    // is rendered into the buffer returned by beginSegment, or only harvests states if it is null.
+    // With caches, groups lying within a segment and holding no node whose state is saved come from them.
+    void renderSegments(const std::vector<int> &splits, const SegmentFunc &beginSegment, const Mat4 &viewTransform, std::unordered_map<Node *, Traversal::State> * const saveStates = nullptr, SubtreeCaches *const subtreeCaches = nullptr);
+    static void releaseSubtreeCaches(SubtreeCaches &subtreeCaches);
+
+    void setStructureModified();
+    quint64 structureVersion() const { return m_structureVersion; }
+    const std::vector<FlatNode> &flatNodes();
+    int flatIndex(Node *const node);
+    quint64 contentVersion(const int begin, const int end);
+    // Moves buffer nodes of the same size and format into shared texture arrays, returns the number of nodes moved.
+    // Called again as nodes are added, new nodes then go into free layers of existing arrays first.
+    int packLayers(const int minLayers = 2);
+    // Moves small leaf buffer nodes into the buffer atlas, returns the number of nodes moved. Fewer distinct sprites
+    // than minSprites are left alone, a page for a handful of them costs more than it saves.
+    int packSprites(const int minSprites = 16);
+    static void benchmarkTraversal(const int nodeCount = 10000, const int iterations = 100);
+    static void benchmarkCompositors(const int layerCount = 100, const QSize &size = {1024, 1024}, const int iterations = 20);
+    static void benchmarkSprites(const int spriteCount = 1000, const QSize &spriteSize = {32, 32}, const int iterations = 20);
 
     Node root;
 
@@ -122,9 +173,22 @@ public:
     void bufferRemoveEditor(Buffer *const buffer, const Editor *const editor);
 
 protected:
+    void flatten();
+    // Composites the subtree entered at the index from its cache, updating the cache first if needed
+    bool renderCachedSubtree(const int index, SubtreeCaches &subtreeCaches);
+    static ComputeCompositor *compositorFor(const Buffer *const buffer, const bool indexed);
+    static BufferBatcher *batcherFor(const Buffer *const buffer, const ComputeCompositor *const compositor);
+
     QFile file;
     QString m_filename;
     bool m_modified;
+
+    std::vector<FlatNode> m_flatNodes;
+    std::unordered_map<Node *, int> m_flatNodeIndices;
+    int m_flatDepth;
+    bool m_structureModified;
+    quint64 m_structureVersion;
+    Traversal m_traversal; // Reused so stacks keep their capacity between traversals
 };
 
 } // namespace GfxPaint
@@ -1,5 +1,6 @@
 #include "scenemodel.h"
 
+#include "application.h"
 #include "scene.h"
 
 namespace GfxPaint {
@@ -93,11 +94,14 @@ QVariant SceneModel::data(const QModelIndex &index, int role) const
 
 bool SceneModel::setData(const QModelIndex &index, const QVariant &value, int role)
 {
+    // Editor frames on the render thread read the scene
+    qApp->renderManager.renderThread.sync();
     Node *const node = nodeFromIndex(index);
     switch (role) {
     case Qt::EditRole:
         if (index.column() == 0 && node) {
             node->name = value.toString();
+            node->touch();
             emit dataChanged(index, index, {role});
             return true;
         }
@@ -105,6 +109,8 @@ bool SceneModel::setData(const QModelIndex &index, const QVariant &value, int ro
     case Qt::CheckStateRole:
         if (index.column() == 0 && index.parent().isValid()) {
             node->enabled = (value == Qt::Checked ? true : false);
+            node->touch();
+            scene.setStructureModified();
             emit dataChanged(index, index, {role});
             return true;
         }
@@ -166,6 +172,7 @@ bool SceneModel::dropMimeData(const QMimeData *data, Qt::DropAction action, int
 
 void SceneModel::moveIndices(const QModelIndexList &indices, int row, QModelIndex parent)
 {
+    qApp->renderManager.renderThread.sync();
     Q_ASSERT(parent.isValid());
     Q_ASSERT(row >= 0 && row <= rowCount(parent));
 
@@ -179,11 +186,13 @@ void SceneModel::moveIndices(const QModelIndexList &indices, int row, QModelInde
             endMoveRows();
         }
     }
+    scene.setStructureModified();
     scene.setModified();
 }
 
 void SceneModel::copyIndices(const QModelIndexList &indices, int row, QModelIndex parent)
 {
+    qApp->renderManager.renderThread.sync();
     Q_ASSERT(parent.isValid());
     Q_ASSERT(row >= 0 && row <= rowCount(parent));
 
@@ -194,11 +203,14 @@ void SceneModel::copyIndices(const QModelIndexList &indices, int row, QModelInde
         destParentNode->insertChild(row + i, sourceNode->cloneWithSubGraph());
     }
     endInsertRows();
+    scene.setStructureModified();
+    scene.packLayers();
     scene.setModified();
 }
 
 QModelIndexList SceneModel::insertNodes(const QList<Node *> &nodes, int row, QModelIndex parent)
 {
+    qApp->renderManager.renderThread.sync();
     Q_ASSERT(parent.isValid());
     Q_ASSERT(row >= 0 && row <= rowCount(parent));
 
@@ -210,18 +222,23 @@ QModelIndexList SceneModel::insertNodes(const QList<Node *> &nodes, int row, QMo
         indices << createIndex(row + i, 0, nodes[i]);
     }
     endInsertRows();
+    scene.setStructureModified();
+    // Added layers join texture arrays of layers of the same size and format
+    scene.packLayers();
     scene.setModified();
     return indices;
 }
 
 void SceneModel::eraseIndices(const QModelIndexList &indices)
 {
+    qApp->renderManager.renderThread.sync();
     for (auto index : indices) {
         Node *const parentNode = nodeFromIndex(index.parent());
         beginRemoveRows(index.parent(), index.row(), index.row());
         parentNode->eraseChild(index.row());
         endRemoveRows();
     }
+    scene.setStructureModified();
     scene.setModified();
 }
 
@@ -0,0 +1,143 @@
+#include "streambuffer.h"
+
+#include <cstring>
+
+#include "frameprofiler.h"
+
+namespace GfxPaint {
+
+StreamBuffer::StreamBuffer() :
+    OpenGL(false),
+    m_buffer(0), capacity(0), regionSize(0),
+    mapped(nullptr), head(0), currentRegion(0),
+    fences{},
+    uniformAlignment(1), storageAlignment(1),
+    m_stallCount(0)
+{
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    Q_ASSERT(!m_buffer);
+}
+
+void StreamBuffer::create(const GLsizeiptr capacity)
+{
+    initialize();
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    allocate(capacity);
+}
+
+void StreamBuffer::destroy()
+{
+    if (!m_buffer) return;
+    for (GLsync &fence : fences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        mapped = nullptr;
+    }
+    // Draws still reading the storage keep it alive until they finish
+    GLObjectRegistry::remove(GLObjectRegistry::Type::StreamBuffer, m_buffer);
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+}
+
+StreamBuffer::Range StreamBuffer::write(const void *const data, const GLsizeiptr size, const GLsizeiptr alignment)
+{
+    Q_ASSERT(m_buffer);
+    if (size <= 0) return Range();
+    // Grow so one write fits in a region
+    if (size > regionSize) {
+        GLsizeiptr newCapacity = capacity;
+        while (size > newCapacity / regionCount) newCapacity *= 2;
+        destroy();
+        allocate(newCapacity);
+    }
+
+    GLintptr offset = (head + alignment - 1) / alignment * alignment;
+    // Writes start at the next region rather than straddle two. The fence of a region is placed when writing leaves
+    // it, before the draw reading a straddling write is issued, so that fence wouldn't cover the draw.
+    if (offset / regionSize != (offset + size - 1) / regionSize) offset = (offset / regionSize + 1) * regionSize;
+    if (offset + size > capacity) offset = 0;
+    const int region = static_cast<int>(offset / regionSize);
+    while (currentRegion != region) {
+        enterRegion((currentRegion + 1) % regionCount);
+    }
+
+    if (mapped) std::memcpy(mapped + offset, data, static_cast<std::size_t>(size));
+    else {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    }
+    head = offset + size;
+    FrameProfiler::count(FrameProfiler::Counter::BytesMoved, static_cast<quint64>(size));
+    return {offset, size};
+}
+
+StreamBuffer::Range StreamBuffer::bind(const GLenum target, const GLuint index, const void *const data, const GLsizeiptr size)
+{
+    Q_ASSERT(target == GL_UNIFORM_BUFFER || target == GL_SHADER_STORAGE_BUFFER);
+    const Range range = write(data, size, target == GL_UNIFORM_BUFFER ? uniformAlignment : storageAlignment);
+    if (range.size > 0) glBindBufferRange(target, index, m_buffer, range.offset, range.size);
+    return range;
+}
+
+void StreamBuffer::allocate(const GLsizeiptr capacity)
+{
+    this->capacity = capacity;
+    regionSize = capacity / regionCount;
+    head = 0;
+    currentRegion = 0;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    using BufferStorageFunction = void (QOPENGLF_APIENTRYP)(GLenum, GLsizeiptr, const void *, GLbitfield);
+    QOpenGLContext *const context = QOpenGLContext::currentContext();
+    const BufferStorageFunction bufferStorage = reinterpret_cast<BufferStorageFunction>(context->getProcAddress(context->isOpenGLES() ? "glBufferStorageEXT" : "glBufferStorage"));
+    if (bufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_COPY_WRITE_BUFFER, capacity, nullptr, flags);
+        mapped = static_cast<char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags));
+    }
+    if (!mapped) {
+        // Storage made by glBufferStorage is immutable, so fall back with a fresh buffer
+        if (bufferStorage) {
+            glDeleteBuffers(1, &m_buffer);
+            glGenBuffers(1, &m_buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        }
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    }
+    GLObjectRegistry::add(GLObjectRegistry::Type::StreamBuffer, m_buffer, capacity);
+}
+
+void StreamBuffer::enterRegion(const int region)
+{
+    // The GPU is done with the region being left once every command issued so far completes
+    Q_ASSERT(!fences[currentRegion]);
+    fences[currentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    currentRegion = region;
+    waitForRegion(region);
+}
+
+void StreamBuffer::waitForRegion(const int region)
+{
+    GLsync &fence = fences[region];
+    if (!fence) return;
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        ++m_stallCount;
+        do {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (result == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+} // namespace GfxPaint
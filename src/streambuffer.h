@@ -0,0 +1,68 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <array>
+
+#include "opengl.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace GfxPaint {
+
+// One ring of buffer storage shared by every draw for data written once and read by that draw only, like
+// stroke points and per-draw uniforms. The ring is split into regions, a fence is placed when writing leaves
+// a region and waited on before writing enters it again, so writes never reallocate or implicitly synchronise.
+// Storage is persistently mapped where glBufferStorage exists, otherwise written with glBufferSubData.
+class StreamBuffer : protected OpenGL
+{
+public:
+    static constexpr GLsizeiptr defaultCapacity = 16 << 20;
+    static constexpr int regionCount = 4;
+
+    struct Range {
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+    };
+
+    explicit StreamBuffer();
+    StreamBuffer(const StreamBuffer &other) = delete;
+    ~StreamBuffer();
+
+    // Both need the render context current
+    void create(const GLsizeiptr capacity = defaultCapacity);
+    void destroy();
+
+    bool isPersistent() const { return mapped != nullptr; }
+    GLuint buffer() const { return m_buffer; }
+    // Times writing had to wait for the GPU to finish reading a region
+    int stallCount() const { return m_stallCount; }
+
+    Range write(const void *const data, const GLsizeiptr size, const GLsizeiptr alignment);
+    // Writes with the offset alignment of the target and binds the range to the indexed binding point
+    Range bind(const GLenum target, const GLuint index, const void *const data, const GLsizeiptr size);
+
+protected:
+    void allocate(const GLsizeiptr capacity);
+    void enterRegion(const int region);
+    void waitForRegion(const int region);
+
+    GLuint m_buffer;
+    GLsizeiptr capacity;
+    GLsizeiptr regionSize;
+    char *mapped;
+    GLintptr head;
+    int currentRegion;
+    std::array<GLsync, regionCount> fences;
+    GLint uniformAlignment;
+    GLint storageAlignment;
+    int m_stallCount;
+};
+
+} // namespace GfxPaint
+
+#endif // STREAMBUFFER_H
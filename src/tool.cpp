@@ -27,7 +27,7 @@ void PixelTool::end(EditingContext &context, const Mat4 &viewTransform)
             Mat4 bufferToClip = bufferNode->viewportTransform();
 
             PixelLineProgram *pixelLineProgram = static_cast<PixelLineProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "render"));
-            pixelLineProgram->render(context.toolStroke.points, context.colour, worldToBuffer, bufferToClip, restoreBuffer, state.palette);
+            pixelLineProgram->render(context.toolStroke.points, context.colour, worldToBuffer, bufferToClip, restoreBuffer, state.palette.get());
         }
     }
 }
@@ -64,7 +64,7 @@ void BrushTool::end(EditingContext &context, const Mat4 &viewTransform)
             Mat4 bufferToClip = bufferNode->viewportTransform();
 
             BrushDabProgram *brushDabProgram = static_cast<BrushDabProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "render"));
-            brushDabProgram->render(context.toolStroke.points, context.brush.dab, context.colour, worldToBuffer, bufferToClip, restoreBuffer, state.palette);
+            brushDabProgram->render(context.toolStroke.points, context.brush.dab, context.colour, worldToBuffer, bufferToClip, restoreBuffer, state.palette.get());
 
 //            const QRectF lastSegmentBounds;
 //            const Brush &brush = context.brush();
@@ -116,7 +116,7 @@ void PrimitiveTool::end(EditingContext &context, const Mat4 &viewTransform)
             //            const Mat4 toolSpaceTransform = viewTransform; // World-space to view-space
             Mat4 toolSpaceTransform = Editor::toolSpace(context, viewTransform, *bufferNode, context.toolSpace);
             BoundedPrimitiveProgram *program = dynamic_cast<BoundedPrimitiveProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "render"));
-            program->render({context.toolStroke.points.front().pos, context.toolStroke.points.back().pos}, context.colour, toolSpaceTransform, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer, state.palette);
+            program->render({context.toolStroke.points.front().pos, context.toolStroke.points.back().pos}, context.colour, toolSpaceTransform, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer, state.palette.get());
         }
     }
 }
@@ -131,15 +131,14 @@ void PrimitiveTool::onCanvasPreview(EditingContext &context, const Mat4 &viewTra
 void PrimitiveTool::onTopPreview(Editor &editor, EditingContext &context, const Mat4 &viewTransform, const bool isActive)
 {
     if (isActive) {
-        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-        Model *const markerModel = qApp->renderManager.models["planeMarker"];
-        VertexColourModelProgram *const markerProgram = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
-        Mat4 markerTransform = editor.getViewportTransform();
+        OverlayBatcher &overlay = editor.getOverlay();
+        overlay.setTransform(editor.getViewportTransform());
+        Mat4 markerTransform;
         const Vec2 viewportPoint = viewTransform * context.toolStroke.points[0].pos;
         markerTransform.translate(viewportPoint.toVector3D());
         float markerSize = 16.0f;
         markerTransform.scale(markerSize, markerSize);
-        markerProgram->render(markerModel, markerTransform, editor.getWidgetBuffer(), nullptr);
+        overlay.marker(OverlayBatcher::Marker::Plane, markerTransform);
     }
 }
 
@@ -188,14 +187,14 @@ void ContourTool::end(EditingContext &context, const Mat4 &viewTransform)
 
             const Bounds2 &bounds = context.toolStroke.bounds;
 //            qDebug() << context.toolStroke.bounds;///////////////////////////
-            Model model = {GL_TRIANGLE_STRIP, {2}, {
-                            (float)bounds.min.x(), (float)bounds.min.y(),
-                            (float)bounds.max.x(), (float)bounds.min.y(),
-                            (float)bounds.min.x(), (float)bounds.max.y(),
-                            (float)bounds.max.x(), (float)bounds.max.y()},
-                           {{0, 1, 2, 3}}, {4}};
+            const std::vector<vec2> quad = {
+                vec2{(float)bounds.min.x(), (float)bounds.min.y()},
+                vec2{(float)bounds.max.x(), (float)bounds.min.y()},
+                vec2{(float)bounds.min.x(), (float)bounds.max.y()},
+                vec2{(float)bounds.max.x(), (float)bounds.max.y()},
+            };
             SingleColourModelProgram *modelProgram = static_cast<SingleColourModelProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "colour"));
-            modelProgram->render(&model, context.colour, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer, state.palette);
+            modelProgram->render(GL_TRIANGLE_STRIP, quad, context.colour, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer, state.palette.get());
 
             stencilProgram->postRender();
         }
@@ -212,15 +211,14 @@ void ContourTool::onCanvasPreview(EditingContext &context, const Mat4 &viewTrans
 void ContourTool::onTopPreview(Editor &editor, EditingContext &context, const Mat4 &viewTransform, const bool isActive)
 {
     if (isActive) {
-        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-        Model *const markerModel = qApp->renderManager.models["planeMarker"];
-        VertexColourModelProgram *const markerProgram = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
-        Mat4 markerTransform = editor.getViewportTransform();
+        OverlayBatcher &overlay = editor.getOverlay();
+        overlay.setTransform(editor.getViewportTransform());
+        Mat4 markerTransform;
         const Vec2 viewportPoint = viewTransform * context.toolStroke.points[0].pos;
         markerTransform.translate(viewportPoint.toVector3D());
         float markerSize = 16.0f;
         markerTransform.scale(markerSize, markerSize);
-        markerProgram->render(markerModel, markerTransform, editor.getWidgetBuffer(), nullptr);
+        overlay.marker(OverlayBatcher::Marker::Plane, markerTransform);
     }
 }
 
@@ -248,14 +246,14 @@ void PourFillTool::end(EditingContext &context, const Mat4 &viewTransform)
             stencilProgram->render(context.toolStroke.points, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer);
 
             const Bounds2 &bounds = context.toolStroke.bounds;
-            Model model = {GL_TRIANGLE_STRIP, {2}, {
-                (float)bounds.min.x(), (float)bounds.min.y(),
-                (float)bounds.max.x(), (float)bounds.min.y(),
-                (float)bounds.min.x(), (float)bounds.max.y(),
-                (float)bounds.max.x(), (float)bounds.max.y()},
-            {{0, 1, 2, 3}}, {4}};
+            const std::vector<vec2> quad = {
+                vec2{(float)bounds.min.x(), (float)bounds.min.y()},
+                vec2{(float)bounds.max.x(), (float)bounds.min.y()},
+                vec2{(float)bounds.min.x(), (float)bounds.max.y()},
+                vec2{(float)bounds.max.x(), (float)bounds.max.y()},
+            };
             SingleColourModelProgram *modelProgram = static_cast<SingleColourModelProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "colour"));
-            modelProgram->render(&model, context.colour, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer, state.palette);
+            modelProgram->render(GL_TRIANGLE_STRIP, quad, context.colour, bufferNode->viewportTransform() * state.transform.inverted(), restoreBuffer, state.palette.get());
 
             stencilProgram->postRender();
         }
@@ -272,15 +270,14 @@ void PourFillTool::onCanvasPreview(EditingContext &context, const Mat4 &viewTran
 void PourFillTool::onTopPreview(Editor &editor, EditingContext &context, const Mat4 &viewTransform, const bool isActive)
 {
     if (isActive) {
-        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-        Model *const markerModel = qApp->renderManager.models["planeMarker"];
-        VertexColourModelProgram *const markerProgram = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
-        Mat4 markerTransform = editor.getViewportTransform();
+        OverlayBatcher &overlay = editor.getOverlay();
+        overlay.setTransform(editor.getViewportTransform());
+        Mat4 markerTransform;
         const Vec2 viewportPoint = viewTransform * context.toolStroke.points[0].pos;
         markerTransform.translate(viewportPoint.toVector3D());
         float markerSize = 16.0f;
         markerTransform.scale(markerSize, markerSize);
-        markerProgram->render(markerModel, markerTransform, editor.getWidgetBuffer(), nullptr);
+        overlay.marker(OverlayBatcher::Marker::Plane, markerTransform);
     }
 }
 
@@ -301,9 +298,11 @@ void ColourPickTool::update(EditingContext &context, const Mat4 &viewTransform)
         BufferNode *const bufferNode = dynamic_cast<BufferNode *>(node);
         if (bufferNode) {
             const Vec2 bufferPoint = state.transform.inverted() * context.toolStroke.points.back().pos;
-            ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-            ColourPickProgram *colourPickProgram = static_cast<ColourPickProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "pick"));
-            context.colour = colourPickProgram->pick(&bufferNode->buffer, bufferNode->indexed ? state.palette : nullptr, bufferPoint);
+            // Readback on the render thread, after frames queued before it
+            context.colour = qApp->renderManager.renderThread.run<Colour>([&](){
+                ColourPickProgram *colourPickProgram = static_cast<ColourPickProgram *>(context.toolProgram(bufferNode->buffer.format(), bufferNode->indexed, state.palette ? state.palette->format() : Buffer::Format(), this, "pick"));
+                return colourPickProgram->pick(&bufferNode->buffer, bufferNode->indexed ? state.palette.get() : nullptr, bufferPoint);
+            });
         }
     }
 }
@@ -392,13 +391,12 @@ void RotoZoomTool::update(EditingContext &context, const Mat4 &viewTransform)
 void RotoZoomTool::onTopPreview(Editor &editor, EditingContext &context, const Mat4 &viewTransform, const bool isActive)
 {
     if (isActive) {
-        ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
-        Model *const markerModel = qApp->renderManager.models["planeMarker"];
-        VertexColourModelProgram *const markerProgram = static_cast<VertexColourModelProgram *>(qApp->renderManager.programs["marker"]);
-        Mat4 markerTransform = editor.getViewportTransform();
+        OverlayBatcher &overlay = editor.getOverlay();
+        overlay.setTransform(editor.getViewportTransform());
+        Mat4 markerTransform;
         float markerSize = 16.0f;
         markerTransform.scale(markerSize, markerSize);
-        markerProgram->render(markerModel, markerTransform, editor.getWidgetBuffer(), nullptr);
+        overlay.marker(OverlayBatcher::Marker::Plane, markerTransform);
     }
 }
 
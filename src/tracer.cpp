@@ -0,0 +1,104 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+namespace GfxPaint {
+
+Tracer::Scope::Scope(const char *const name, const char *const category, const QString &detail) :
+    name(name), category(category), detail(detail),
+    start(isEnabled() ? now() : -1)
+{
+}
+
+Tracer::Scope::~Scope()
+{
+    if (start >= 0) record({name, category, detail, start, now() - start, currentThread()});
+}
+
+void Tracer::setEnabled(const bool enabled)
+{
+    QMutexLocker locker(&mutex);
+    if (enabled) {
+        if (!timer.isValid()) timer.start();
+        events.reserve(capacity);
+    }
+    Tracer::enabled = enabled;
+}
+
+void Tracer::instant(const char *const name, const char *const category)
+{
+    if (isEnabled()) record({name, category, QString(), now(), -1, currentThread()});
+}
+
+bool Tracer::save(const QString &filename)
+{
+    std::vector<Event> ordered;
+    std::map<int, QString> names;
+    {
+        QMutexLocker locker(&mutex);
+        // Oldest first once the ring has wrapped
+        ordered.reserve(events.size());
+        ordered.insert(ordered.end(), events.begin() + next, events.end());
+        ordered.insert(ordered.end(), events.begin(), events.begin() + next);
+        names = threadNames;
+    }
+
+    QJsonArray traceEvents;
+    for (const auto &[thread, name] : names) {
+        traceEvents.append(QJsonObject{
+            {"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", thread},
+            {"args", QJsonObject{{"name", name}}},
+        });
+    }
+    for (const Event &event : ordered) {
+        QJsonObject object{
+            {"name", event.name}, {"cat", event.category},
+            {"ts", event.start / 1000.0}, {"pid", 1}, {"tid", event.thread},
+        };
+        if (event.duration >= 0) {
+            object["ph"] = "X";
+            object["dur"] = event.duration / 1000.0;
+        }
+        else {
+            object["ph"] = "i";
+            object["s"] = "g";
+        }
+        if (!event.detail.isEmpty()) object["args"] = QJsonObject{{"detail", event.detail}};
+        traceEvents.append(object);
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    const QJsonObject trace{{"traceEvents", traceEvents}, {"displayTimeUnit", "ms"}};
+    return file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) >= 0;
+}
+
+int Tracer::currentThread()
+{
+    thread_local int thread = -1;
+    if (thread < 0) {
+        thread = nextThread++;
+        QThread *const qThread = QThread::currentThread();
+        QString name = qThread->objectName();
+        if (QCoreApplication::instance() && qThread == QCoreApplication::instance()->thread()) name = "Main";
+        else if (name.isEmpty()) name = QString("Thread %1").arg(thread);
+        QMutexLocker locker(&mutex);
+        threadNames[thread] = name;
+    }
+    return thread;
+}
+
+void Tracer::record(Event &&event)
+{
+    QMutexLocker locker(&mutex);
+    if (events.size() < static_cast<std::size_t>(capacity)) events.push_back(std::move(event));
+    else events[next] = std::move(event);
+    next = (next + 1) % capacity;
+}
+
+} // namespace GfxPaint
@@ -0,0 +1,68 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <map>
+#include <vector>
+
+namespace GfxPaint {
+
+// Ring of the most recent trace events, saved on demand as Chrome trace event JSON for chrome://tracing or Perfetto.
+// Recording an event is two clock reads and a short locked copy, so tracing can stay on.
+class Tracer
+{
+public:
+    static constexpr int capacity = 1 << 16;
+
+    // Names and categories are string literals, details are only worth building while tracing
+    class Scope
+    {
+    public:
+        explicit Scope(const char *const name, const char *const category, const QString &detail = QString());
+        ~Scope();
+
+    private:
+        const char *const name;
+        const char *const category;
+        const QString detail;
+        // Negative when not tracing
+        const qint64 start;
+    };
+
+    static void setEnabled(const bool enabled);
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    // Marks a point in time such as a frame boundary
+    static void instant(const char *const name, const char *const category);
+    // Returns false if the file couldn't be written
+    static bool save(const QString &filename);
+
+protected:
+    struct Event {
+        const char *name;
+        const char *category;
+        QString detail;
+        qint64 start;
+        // Negative for instant events
+        qint64 duration;
+        int thread;
+    };
+
+    static qint64 now() { return timer.nsecsElapsed(); }
+    static int currentThread();
+    static void record(Event &&event);
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<int> nextThread{0};
+    static inline QElapsedTimer timer;
+    static inline QMutex mutex;
+    static inline std::vector<Event> events;
+    static inline std::size_t next = 0;
+    static inline std::map<int, QString> threadNames;
+};
+
+} // namespace GfxPaint
+
+#endif // TRACER_H
@@ -3,6 +3,7 @@
 
 #include <QImage>
 #include <array>
+#include <atomic>
 #include <algorithm>
 #include <iterator>
 #include <cmath>
@@ -224,6 +225,10 @@ inline QDebug operator<<(QDebug debug, const Colour &colour)
 
 static const Colour COLOUR_INVALID = Colour{RGBA_INVALID, INDEX_INVALID};
 
+// Shared by buffer and node content versions so the newest change in a set is the maximum, buffers are also made on
+// the render thread and GPU workers
+inline quint64 nextVersion() { static std::atomic<quint64> version{0}; return version.fetch_add(1, std::memory_order_relaxed) + 1; }
+
 enum class AttributelessModel {
     SingleVertex,
     ClipQuad,
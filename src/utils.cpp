@@ -8,6 +8,7 @@
 #include <regex>
 
 #include "application.h"
+#include "tracer.h"
 #include "types.h"
 
 namespace GfxPaint {
@@ -66,7 +67,7 @@ QColor qColorFromVec4(const vec4 &colour)
     return QColor(static_cast<qreal>(colour[0]), static_cast<qreal>(colour[1]), static_cast<qreal>(colour[2]), static_cast<qreal>(colour[3]));
 }
 
-Buffer bufferFromImageFile(const QString &filename, Buffer *const palette, Colour *const transparent)
+QImage imageFromFile(const QString &filename, Colour *const transparent)
 {
     static const QMap<QImage::Format, QImage::Format> imageFormatConversion = {
         {QImage::Format_Mono, QImage::Format_Indexed8},
@@ -75,14 +76,8 @@ Buffer bufferFromImageFile(const QString &filename, Buffer *const palette, Colou
 //        {QImage::Format_RGB32, QImage::Format_RGB888},
         {QImage::Format_ARGB32_Premultiplied, QImage::Format_ARGB32},
     };
-    static const QMap<QImage::Format, Buffer::Format> imageFromatToBufferFormat = {
-        {QImage::Format_Indexed8, Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 1)},
-        {QImage::Format_RGB888, Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 3)},
-        {QImage::Format_ARGB32, Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 4)},
-    };
-    static const Buffer::Format paletteFormat = Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 4);
 
-    Buffer buffer;
+    const Tracer::Scope traceScope("imageFromFile", "io", filename);
     QImage image(filename);
 
 //    image = image.convertToFormat(QImage::Format_RGB888);
@@ -132,15 +127,68 @@ Buffer bufferFromImageFile(const QString &filename, Buffer *const palette, Colou
 
     image = image.rgbSwapped();
     if (imageFormatConversion.contains(image.format())) image = image.convertToFormat(imageFormatConversion[image.format()]);
+    return image;
+}
+
+ImageUpload uploadImage(const QImage &image)
+{
+    static const QMap<QImage::Format, Buffer::Format> imageFromatToBufferFormat = {
+        {QImage::Format_Indexed8, Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 1)},
+        {QImage::Format_RGB888, Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 3)},
+        {QImage::Format_ARGB32, Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 4)},
+    };
+
+    ImageUpload upload;
     if (imageFromatToBufferFormat.contains(image.format())) {
-        buffer = Buffer(image.size(), imageFromatToBufferFormat[image.format()], image.constBits());
-        if (palette && image.format() == QImage::Format::Format_Indexed8) {
-            *palette = Buffer(QSize(image.colorTable().length(), 1), paletteFormat, image.colorTable().constData());
-        }
+        upload.size = image.size();
+        upload.format = imageFromatToBufferFormat[image.format()];
+        if (image.format() == QImage::Format::Format_Indexed8) upload.colourTable = image.colorTable();
+        // The job holds its own reference to the pixels, so the caller's image can go
+        const Buffer::Format format = upload.format;
+        upload.texture = qApp->renderManager.gpuWorkers.submit<GLuint>([image, format](){
+            const Tracer::Scope traceScope("uploadImage", "io");
+            return BufferData::createTexture(image.size(), format, image.constBits());
+        });
+    }
+    return upload;
+}
+
+Buffer bufferFromUpload(ImageUpload &upload, Buffer *const palette)
+{
+    static const Buffer::Format paletteFormat = Buffer::Format(Buffer::Format::ComponentType::UInt, 1, 4);
+
+    if (!upload.texture.isValid()) return Buffer();
+    const Tracer::Scope traceScope("bufferFromUpload", "io");
+    GpuResult<GLuint> result = upload.texture.result();
+    upload.texture = QFuture<GpuResult<GLuint>>();
+    Buffer buffer(result.wait(), upload.size, upload.format);
+    if (palette && !upload.colourTable.isEmpty()) {
+        *palette = Buffer(QSize(upload.colourTable.length(), 1), paletteFormat, upload.colourTable.constData());
     }
     return buffer;
 }
 
+void discardUpload(ImageUpload &upload)
+{
+    if (!upload.texture.isValid()) return;
+    ContextBinder binder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    GpuResult<GLuint> result = upload.texture.result();
+    upload.texture = QFuture<GpuResult<GLuint>>();
+    const GLuint texture = result.wait();
+    OpenGLState::deleteTextures(1, &texture);
+}
+
+Buffer bufferFromImage(const QImage &image, Buffer *const palette)
+{
+    ImageUpload upload = uploadImage(image);
+    return bufferFromUpload(upload, palette);
+}
+
+Buffer bufferFromImageFile(const QString &filename, Buffer *const palette, Colour *const transparent)
+{
+    return bufferFromImage(imageFromFile(filename, transparent), palette);
+}
+
 void stringMultiReplace(QString &string, const std::map<QString, QString> &replacements)
 {
     for (const auto &key : replacements)
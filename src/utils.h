@@ -5,6 +5,7 @@
 #include <QList>
 #include <QByteArray>
 #include <QWidget>
+#include <QImage>
 //#include <QKeyEventTransition>
 //#include <QMouseEventTransition>
 #include <QKeyEvent>
@@ -12,6 +13,7 @@
 #include <cmath>
 #include "opengl.h"
 #include "buffer.h"
+#include "gpuworkerpool.h"
 #include "types.h"
 
 #define STRINGIZE_EXPAND(string) #string
@@ -61,6 +63,26 @@ Mat4 viewportToClipTransform(const QSize size);
 vec4 qColorToVec4(const QColor &qColor);
 QColor qColorFromVec4(const vec4 &colour);
 
+// Decodes and converts to a buffer compatible format without touching GL, so it can run on any thread
+QImage imageFromFile(const QString &filename, Colour *const transparent = nullptr);
+
+// An image's texture being uploaded by a GPU worker, made into a buffer in the context that uses it
+struct ImageUpload {
+    QFuture<GpuResult<GLuint>> texture;
+    QSize size;
+    Buffer::Format format;
+    // Indexed images only
+    QList<QRgb> colourTable;
+};
+// Submits the upload without waiting for it, from any thread. Images of unsupported formats give an upload without a texture
+ImageUpload uploadImage(const QImage &image);
+// With the consuming context current. Blocks until the worker has run the job unless the caller waited on the texture
+// future beforehand, the upload's GPU work is then waited for on the GPU.
+Buffer bufferFromUpload(ImageUpload &upload, Buffer *const palette = nullptr);
+// For uploads that won't be used, such as those of a cancelled task
+void discardUpload(ImageUpload &upload);
+// Uploads and waits for the upload, for callers that need the buffer straight away
+Buffer bufferFromImage(const QImage &image, Buffer *const palette = nullptr);
 Buffer bufferFromImageFile(const QString &filename, Buffer *const palette = nullptr, Colour *const transparent = nullptr);
 
 template<typename T>
@@ -4,6 +4,13 @@
 
 namespace GfxPaint {
 
+WorkBufferManager::~WorkBufferManager()
+{
+    purge();
+    ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    formats.clear();
+}
+
 Buffer *WorkBufferManager::fitSize(const Buffer::Format format, const QSize size) {
     FormatData &data = formats[format];
     if (size.isValid()) data.minSize = data.minSize.expandedTo(size);
@@ -20,4 +27,58 @@ Buffer *WorkBufferManager::fitSize(const Buffer::Format format, const QSize size
     return data.buffer;
 }
 
+Buffer *WorkBufferManager::takeBuffer(const Buffer::Format &format, const QSize &size)
+{
+    {
+        const QMutexLocker locker(&mutex);
+        // Most recently returned first
+        for (auto iterator = unused.rbegin(); iterator != unused.rend(); ++iterator) {
+            Buffer *const buffer = *iterator;
+            if (buffer->format() == format && buffer->size() == size) {
+                unused.erase(std::next(iterator).base());
+                unusedBytes -= bytes(buffer);
+                return buffer;
+            }
+        }
+    }
+    ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    FramebufferBinder framebufferBinder;
+    return new Buffer(size, format);
+}
+
+void WorkBufferManager::returnBuffer(Buffer *const buffer)
+{
+    if (!buffer) return;
+    std::list<Buffer *> evicted;
+    {
+        const QMutexLocker locker(&mutex);
+        unused.push_back(buffer);
+        unusedBytes += bytes(buffer);
+        while (unusedBytes > maxUnusedBytes && unused.size() > 1) {
+            unusedBytes -= bytes(unused.front());
+            evicted.push_back(unused.front());
+            unused.pop_front();
+        }
+    }
+    deleteBuffers(evicted);
+}
+
+void WorkBufferManager::purge()
+{
+    std::list<Buffer *> purged;
+    {
+        const QMutexLocker locker(&mutex);
+        purged.swap(unused);
+        unusedBytes = 0;
+    }
+    deleteBuffers(purged);
+}
+
+void WorkBufferManager::deleteBuffers(const std::list<Buffer *> &buffers)
+{
+    if (buffers.empty()) return;
+    ContextBinder contextBinder(&qApp->renderManager.context, &qApp->renderManager.surface);
+    for (Buffer *const buffer : buffers) delete buffer;
+}
+
 } // namespace GfxPaint
@@ -1,6 +1,10 @@
 #ifndef WORKBUFFERMANAGER_H
 #define WORKBUFFERMANAGER_H
 
+#include <QMutex>
+#include <list>
+#include <map>
+
 #include "buffer.h"
 
 namespace GfxPaint {
@@ -21,8 +25,11 @@ public:
 
         Buffer *buffer;
     };
-    WorkBufferManager() {}
-    ~WorkBufferManager() {}
+    // Unused pooled buffers beyond this are freed oldest first, sizes seen once during a resize don't stay forever
+    static constexpr qint64 maxUnusedBytes = 128 * 1024 * 1024;
+
+    WorkBufferManager() : mutex(), unused(), unusedBytes(0) {}
+    ~WorkBufferManager();
 
     Buffer *fitSize(const Buffer::Format format, const QSize size = QSize());
 
@@ -31,10 +38,13 @@ public:
         return handle;
     }
 
-    void purge() {
-
-    }
+    // Pooled buffers, returned buffers are reused by later requests of the same format and size. Used from the main
+    // and render threads.
+    Buffer *takeBuffer(const Buffer::Format &format, const QSize &size);
+    void returnBuffer(Buffer *const buffer);
 
+    // Frees every unused pooled buffer, pooled sizes are usually stale once a widget resizes
+    void purge();
 
 protected:
     struct FormatData {
@@ -51,7 +61,13 @@ protected:
 
     QMap<Buffer::Format, FormatData> formats;
 
-    QMap<Buffer::Format, QMap<QSize, Buffer *>> unused;
+    static qint64 bytes(const Buffer *const buffer) { return static_cast<qint64>(buffer->width()) * buffer->height() * buffer->format().pixelSize(); }
+    void deleteBuffers(const std::list<Buffer *> &buffers);
+
+    QMutex mutex;
+    // Least recently returned first
+    std::list<Buffer *> unused;
+    qint64 unusedBytes;
 };
 
 } // namespace GfxPaint